@@ -1,8 +1,10 @@
 #pragma once
 #include <keystone/keystone.h>
 #include <keystone/KeystoneUserInfo.hpp>
+#include <keystone/KeystonePolicy.hpp>
 #include <keystone/KeystoneSafeCall.hpp>
 #include <string>
+#include <vector>
 
 /**
  * \addtogroup keystone_wrapper
@@ -32,6 +34,7 @@ namespace keystone {
      * \note This class is header-only, meaning that it does not suffer from any definition problems of multiple compiler versions
      * 
      * \note It is non-copyable by design. If you wish to pass it around, either use references or (smart)-pointers.
+     *       With C++11 it is movable, so it can also be returned from functions or stored in containers.
      *
      * \note Use of this class still requires linking with the keystone C-library/DLL/so-file(Linux)
      **/
@@ -45,15 +48,45 @@ namespace keystone {
          *                Also note that we require the trailing dash '/' at the end (http://server/keystone/ is valid, http://server/keystone is _not_)
          * 
          */
-        Keystone(const std::string& url) {
+        Keystone(const std::string& url) : data(NULL) {
             KEYSTONE_SAFE_CALL(keystone_init(url.c_str(), &data));
         }
 
+#if KEYSTONE_HAS_MOVE
+        /**
+         * Takes over the keystone resource of \c other. Using \c other afterwards (except for assigning to it) results in an exception.
+         */
+        Keystone(Keystone&& other) KEYSTONE_NOEXCEPT : data(other.data) {
+            other.data = NULL;
+        }
+
+        /**
+         * Frees up the current keystone resource and takes over the one of \c other.
+         * Using \c other afterwards (except for assigning to it) results in an exception.
+         */
+        Keystone& operator=(Keystone&& other) KEYSTONE_NOEXCEPT {
+            if (this != &other) {
+                if (data != NULL) {
+                    keystone_free(data);
+                }
+                data = other.data;
+                other.data = NULL;
+            }
+            return *this;
+        }
+
+        Keystone(const Keystone& other) = delete;
+        Keystone& operator=(const Keystone& other) = delete;
+#endif
+
         /**
          * Frees up the keystone resource
          */
         ~Keystone() {
-            KEYSTONE_SAFE_CALL(keystone_free(data));
+            if (data != NULL) {
+                // Nothing sensible to do about an error here, and destructors must not throw.
+                keystone_free(data);
+            }
         }
 
         /**
@@ -68,11 +101,25 @@ namespace keystone {
          * \throws std::runtime_error if an error occurred. Typically causes are network errors and login error (wrong username/password)
          */
         void login(const std::string& username, const std::string& password, const std::string& tenantName, KeystoneUserInfo& info) {
+            checkData();
             keystone_userinfo_t* userInfo;
             KEYSTONE_SAFE_CALL(keystone_login(data, username.c_str(), password.c_str(), tenantName.c_str(), &userInfo));
             info.setUserInfo(userInfo);
         }
 
+        /**
+         * Like login, but hands out the session of an earlier call for the same account while it lasts,
+         * see \ref keystone_session_login.
+         *
+         * \throws std::runtime_error if an error occurred.
+         */
+        void sessionLogin(const std::string& username, const std::string& password, const std::string& tenantName, KeystoneUserInfo& info) {
+            checkData();
+            keystone_userinfo_t* userInfo;
+            KEYSTONE_SAFE_CALL(keystone_session_login(data, username.c_str(), password.c_str(), tenantName.c_str(), &userInfo));
+            info.setUserInfo(userInfo);
+        }
+
         /**
          * Gets the user information associated to a sessionToken (and throws an exception if it's an invalid sessionToken)
          * 
@@ -85,11 +132,38 @@ namespace keystone {
          * \throws std::runtime_error if an error occurred. Typically causes are network errors and authentication errors (wrong sessionToken)
          */
         void getUserInfoFromToken(const std::string& tenantName, const std::string& sessionToken, KeystoneUserInfo& info) {
+            checkData();
             keystone_userinfo_t* userInfo;
             KEYSTONE_SAFE_CALL(keystone_get_userinfo_from_token(data, tenantName.c_str(), sessionToken.c_str(), &userInfo));
             info.setUserInfo(userInfo);
         }
 
+        /**
+         * Logs the user in and returns the associated userinfo.
+         *
+         * This is the more convenient version of \ref Keystone::login(const std::string&, const std::string&, const std::string&, KeystoneUserInfo&)
+         *
+         * \throws std::runtime_error if an error occurred. Typically causes are network errors and login error (wrong username/password)
+         */
+        KeystoneUserInfo login(const std::string& username, const std::string& password, const std::string& tenantName) {
+            KeystoneUserInfo info;
+            login(username, password, tenantName, info);
+            return info;
+        }
+
+        /**
+         * Gets the user information associated to a sessionToken.
+         *
+         * This is the more convenient version of \ref Keystone::getUserInfoFromToken(const std::string&, const std::string&, KeystoneUserInfo&)
+         *
+         * \throws std::runtime_error if an error occurred. Typically causes are network errors and authentication errors (wrong sessionToken)
+         */
+        KeystoneUserInfo getUserInfoFromToken(const std::string& tenantName, const std::string& sessionToken) {
+            KeystoneUserInfo info;
+            getUserInfoFromToken(tenantName, sessionToken, info);
+            return info;
+        }
+
 	
         /**
          * Set the path to the file containing the certificates from the Certificate Authorities (CA). This might be required for accessing
@@ -101,15 +175,177 @@ namespace keystone {
          */
 
         void setCACertificateFilename(const std::string& certFileName) {
+            checkData();
             KEYSTONE_SAFE_CALL(keystone_set_ca_certificate_filename(data, certFileName.c_str()));
         }
+
+        /**
+         * Multiplexes concurrent calls as HTTP/2 streams of one connection, see \ref keystone_set_http2.
+         *
+         * \throws std::runtime_error if an error occurred.
+         */
+        void setHttp2(keystone_http2_t mode, unsigned maxStreams = 0) {
+            checkData();
+            KEYSTONE_SAFE_CALL(keystone_set_http2(data, mode, maxStreams));
+        }
+
+        /**
+         * Sets the callbacks fired around the calls to the keystone service, see \ref keystone_set_hooks.
+         *
+         * \param[in] hooks the callbacks to use (copied). Callbacks that are NULL are not called.
+         *
+         * \throws std::runtime_error if an error occurred.
+         */
+        void setHooks(const keystone_hooks_t& hooks) {
+            checkData();
+            KEYSTONE_SAFE_CALL(keystone_set_hooks(data, &hooks));
+        }
+
+        /**
+         * Sets the syntax session tokens must have, see \ref keystone_set_token_format.
+         *
+         * \throws std::runtime_error if an error occurred.
+         */
+        void setTokenFormat(keystone_token_charset_t charset, size_t minLength, size_t maxLength) {
+            checkData();
+            KEYSTONE_SAFE_CALL(keystone_set_token_format(data, charset, minLength, maxLength));
+        }
+
+        /**
+         * Remembers the tokens the service rejected, see \ref keystone_set_negative_cache.
+         *
+         * \throws std::runtime_error if an error occurred.
+         */
+        void setNegativeCache(size_t expectedEntries, double ttl) {
+            checkData();
+            KEYSTONE_SAFE_CALL(keystone_set_negative_cache(data, expectedEntries, ttl));
+        }
+
+        /**
+         * Caches the userinfo of session tokens, see \ref keystone_set_token_cache.
+         *
+         * \throws std::runtime_error if an error occurred.
+         */
+        void setTokenCache(size_t maxEntries, double ttl) {
+            checkData();
+            KEYSTONE_SAFE_CALL(keystone_set_token_cache(data, maxEntries, ttl));
+        }
+
+        /**
+         * Puts a per-thread L1 in front of the token cache, see \ref keystone_set_token_cache_l1.
+         *
+         * \throws std::runtime_error if an error occurred.
+         */
+        void setTokenCacheL1(size_t entries, double maxStaleness) {
+            checkData();
+            KEYSTONE_SAFE_CALL(keystone_set_token_cache_l1(data, entries, maxStaleness));
+        }
+
+        /**
+         * Bounds the bytes used by the token cache, see \ref keystone_set_token_cache_memory_limit.
+         *
+         * \throws std::runtime_error if an error occurred.
+         */
+        void setTokenCacheMemoryLimit(size_t maxBytes) {
+            checkData();
+            KEYSTONE_SAFE_CALL(keystone_set_token_cache_memory_limit(data, maxBytes));
+        }
+
+        /**
+         * Attaches to a token cache in shared memory, see \ref keystone_set_shared_cache.
+         * An empty name detaches.
+         *
+         * \throws std::runtime_error if an error occurred.
+         */
+        void setSharedCache(const std::string& name, size_t maxEntries, size_t entrySize, double ttl) {
+            checkData();
+            KEYSTONE_SAFE_CALL(keystone_set_shared_cache(data, name.empty() ? NULL : name.c_str(), maxEntries, entrySize, ttl));
+        }
+
+        /**
+         * Caches the roles of users, see \ref keystone_set_role_cache.
+         *
+         * \throws std::runtime_error if an error occurred.
+         */
+        void setRoleCache(size_t maxEntries, double ttl) {
+            checkData();
+            KEYSTONE_SAFE_CALL(keystone_set_role_cache(data, maxEntries, ttl));
+        }
+
+        /**
+         * Sets up the session cache of sessionLogin, see \ref keystone_set_session_cache.
+         *
+         * \throws std::runtime_error if an error occurred.
+         */
+        void setSessionCache(size_t maxSessions, double lifetime, double refreshAfter) {
+            checkData();
+            KEYSTONE_SAFE_CALL(keystone_set_session_cache(data, maxSessions, lifetime, refreshAfter));
+        }
+
+        /**
+         * Writes the token cache to a file, see \ref keystone_cache_save.
+         *
+         * \throws std::runtime_error if an error occurred.
+         */
+        void saveCache(const std::string& fileName) {
+            checkData();
+            KEYSTONE_SAFE_CALL(keystone_cache_save(data, fileName.c_str()));
+        }
+
+        /**
+         * Fills the token cache from a file, see \ref keystone_cache_load.
+         *
+         * \throws std::runtime_error if an error occurred.
+         */
+        void loadCache(const std::string& fileName) {
+            checkData();
+            KEYSTONE_SAFE_CALL(keystone_cache_load(data, fileName.c_str()));
+        }
+
+        /**
+         * Removes the tokens revoked in a file from the caches every \c interval seconds,
+         * see \ref keystone_set_revocation_file. An empty file name stops polling.
+         *
+         * \throws std::runtime_error if an error occurred.
+         */
+        void setRevocationFile(const std::string& fileName, double interval) {
+            checkData();
+            KEYSTONE_SAFE_CALL(keystone_set_revocation_file(data, fileName.empty() ? NULL : fileName.c_str(), interval));
+        }
+
+        /**
+         * Looks up \c sessionTokens to fill the token cache, see \ref keystone_cache_prewarm.
+         *
+         * \return the number of tokens that are cached now
+         * \throws std::runtime_error if an error occurred.
+         */
+        size_t prewarmCache(const std::string& tenantName, const std::vector<std::string>& sessionTokens,
+                            unsigned concurrency, double maxRate = 0) {
+            checkData();
+            std::vector<const char*> tokens(sessionTokens.size());
+            for (size_t i = 0; i < sessionTokens.size(); i++) {
+                tokens[i] = sessionTokens[i].c_str();
+            }
+            size_t cached = 0;
+            KEYSTONE_SAFE_CALL(keystone_cache_prewarm(data, tenantName.c_str(), tokens.empty() ? NULL : &tokens[0],
+                                                      tokens.size(), concurrency, maxRate, &cached));
+            return cached;
+        }
 	
 
     private: 
         keystone_data_t* data;
+#if !KEYSTONE_HAS_MOVE
         // We do not want to be able to copy this:
         Keystone(const Keystone& other) {}
         Keystone& operator=(const Keystone& other) { return *this; }
+#endif
+
+        inline void checkData() const {
+            if (data == NULL) {
+                throw std::runtime_error("Illegal state for Keystone (it has been moved from)");
+            }
+        }
     };
 }
 /**
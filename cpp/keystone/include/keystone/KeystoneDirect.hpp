@@ -0,0 +1,149 @@
+#pragma once
+#include <keystone/impl/KeystoneUserInfo.hpp>
+#include <keystone/impl/CurlTransport.hpp>
+#include <keystone/impl/Soap.hpp>
+#include <string>
+#include <vector>
+
+/**
+ * \addtogroup keystone_direct
+ * \brief An optional C++ API that talks to the implementation directly instead of going through the C-interface.
+ *
+ * Choose this API for C++ code on the hot path: there is no C handle per userinfo, no per-call
+ * exception translation and the userinfo strings are read in place instead of being copied out.
+ * The transport and the cache are template parameters, so they are resolved (and can be inlined)
+ * at compile time.
+ *
+ * \note Unlike the \ref keystone_wrapper API, this exposes C++ types across the library boundary.
+ *       It requires C++11 and must be built with the same compiler and standard library as the keystone library.
+ *       Use the C-interface (or \ref keystone_wrapper) for anything else.
+ * \{
+ */
+namespace keystone { namespace direct {
+
+    /**
+     * The immutable, reference counted userinfo of the implementation.
+     * Copies are cheap, and getUsername/getToken/getRole return views into the shared record.
+     */
+    typedef impl::KeystoneUserInfo UserInfo;
+
+    /**
+     * \brief Cache policy that does not cache anything.
+     *
+     * A cache policy needs the same two members: \c find returns true (and fills \c info) on a hit,
+     * \c store is called with every userinfo fetched from the server.
+     */
+    struct NoCache {
+        inline bool find(const std::string& /*tenantName*/, const std::string& /*sessionToken*/, UserInfo& /*info*/) {
+            return false;
+        }
+
+        inline void store(const std::string& /*tenantName*/, const std::string& /*sessionToken*/, const UserInfo& /*info*/) {
+        }
+    };
+
+    /**
+     * \brief Access to the keystone service, specialized at compile time on transport and cache.
+     *
+     * \tparam Transport provides <tt>impl::Status post(const std::string& endpoint, const std::string& request, std::string& response)</tt>,
+     *                   see keystone::impl::CurlTransport
+     * \tparam Cache a cache policy, see \ref NoCache
+     */
+    template<class Transport = impl::CurlTransport, class Cache = NoCache>
+    class BasicKeystone {
+    public:
+        /**
+         * \param[in] url the URL for the keystone service, see \ref keystone_init
+         * \param[in] transport the transport to use
+         * \param[in] cache the cache to use
+         */
+        explicit BasicKeystone(const std::string& url, const Transport& transport = Transport(), const Cache& cache = Cache())
+            : url(url), transport(transport), cache(cache) {
+        }
+
+        /**
+         * Logs the user in and returns the associated userinfo.
+         *
+         * \throws keystone::impl::Error (a std::runtime_error) if an error occurred, eg. ERROR_INVALID_CREDENTIALS (wrong username/password) or a network error
+         */
+        UserInfo login(const std::string& username, const std::string& password, const std::string& tenantName) {
+            std::string request;
+            impl::soap::buildGetSessionTokenRequest(username, password, tenantName, request);
+
+            std::string response;
+            post(impl::OPERATION_LOGIN, request, response);
+
+            std::string sessionToken;
+            check(impl::soap::parseGetSessionTokenResponse(response, sessionToken));
+
+            std::vector<std::string> roles;
+            getRoles(sessionToken, request, response, roles);
+            return UserInfo(username, sessionToken, roles);
+        }
+
+        /**
+         * Gets the user information associated to a sessionToken, from the cache if possible.
+         *
+         * \throws keystone::impl::Error (a std::runtime_error) if an error occurred, eg. ERROR_INVALID_TOKEN (wrong sessionToken) or a network error
+         */
+        UserInfo getUserInfoFromToken(const std::string& tenantName, const std::string& sessionToken) {
+            UserInfo info;
+            if (cache.find(tenantName, sessionToken, info)) {
+                return info;
+            }
+
+            std::string request;
+            impl::soap::buildGetUsernameRequest(sessionToken, request);
+
+            std::string response;
+            post(impl::OPERATION_GET_USERNAME, request, response);
+
+            std::string username;
+            check(impl::soap::parseGetUsernameResponse(response, username));
+
+            std::vector<std::string> roles;
+            getRoles(sessionToken, request, response, roles);
+
+            info = UserInfo(username, sessionToken, roles);
+            cache.store(tenantName, sessionToken, info);
+            return info;
+        }
+
+        Transport& getTransport() { return transport; }
+        Cache& getCache() { return cache; }
+
+    private:
+        // Reuses the request and response buffers of the first call.
+        void getRoles(const std::string& sessionToken, std::string& request, std::string& response, std::vector<std::string>& roles) {
+            impl::soap::buildGetRolesRequest(sessionToken, request);
+            post(impl::OPERATION_GET_ROLES, request, response);
+            check(impl::soap::parseGetRolesResponse(response, roles));
+        }
+
+        // The implementation reports errors by status, they become exceptions here.
+        void post(impl::Operation operation, const std::string& request, std::string& response) {
+            impl::Status status = transport.post(url, request, response);
+            if (!status.isOk()) {
+                throw impl::Error(impl::soap::classifyFailure(operation, status, response));
+            }
+        }
+
+        static void check(const impl::Status& status) {
+            if (!status.isOk()) {
+                throw impl::Error(status);
+            }
+        }
+
+        std::string url;
+        Transport transport;
+        Cache cache;
+    };
+
+    /**
+     * The direct API with the default (curl) transport and no caching.
+     */
+    typedef BasicKeystone<> Keystone;
+}}
+/**
+ * \}
+ */
@@ -0,0 +1,106 @@
+#pragma once
+#include <keystone/keystone.h>
+#include <keystone/KeystoneUserInfo.hpp>
+#include <keystone/KeystoneSafeCall.hpp>
+#include <string>
+
+/**
+ * \addtogroup keystone_wrapper
+ * \{
+ */
+namespace keystone {
+
+    /**
+     * \ingroup keystone_wrapper
+     * \brief A wrapper class around a compiled role policy (see \ref keystone_policy_compile)
+     *
+     * A policy such as "admin OR (operator AND tenant-x)" is compiled once and can then be
+     * evaluated against any number of \ref KeystoneUserInfo objects, from several threads at once.
+     *
+     * \note This class is header-only, meaning that it does not suffer from any definition problems of multiple compiler versions
+     *
+     * \note It is non-copyable by design. If you wish to pass it around, either use references or (smart)-pointers.
+     *       With C++11 it is movable.
+     *
+     * \note Use of this class still requires linking with the keystone C-library/DLL/so-file(Linux)
+     **/
+    class KeystonePolicy {
+    public:
+        /**
+         * Compiles the policy.
+         *
+         * \param[in] expression the policy, see \ref keystone_policy_compile for the syntax
+         *
+         * \throws std::runtime_error if the expression is malformed
+         */
+        explicit KeystonePolicy(const std::string& expression) : policy(NULL) {
+            KEYSTONE_SAFE_CALL(keystone_policy_compile(expression.c_str(), &policy));
+        }
+
+#if KEYSTONE_HAS_MOVE
+        /**
+         * Takes over the compiled policy of \c other. Evaluating \c other afterwards results in an exception.
+         */
+        KeystonePolicy(KeystonePolicy&& other) KEYSTONE_NOEXCEPT : policy(other.policy) {
+            other.policy = NULL;
+        }
+
+        /**
+         * Frees up the current policy and takes over the one of \c other. Evaluating \c other afterwards results in an exception.
+         */
+        KeystonePolicy& operator=(KeystonePolicy&& other) KEYSTONE_NOEXCEPT {
+            if (this != &other) {
+                if (policy != NULL) {
+                    keystone_policy_free(policy);
+                }
+                policy = other.policy;
+                other.policy = NULL;
+            }
+            return *this;
+        }
+
+        KeystonePolicy(const KeystonePolicy& other) = delete;
+        KeystonePolicy& operator=(const KeystonePolicy& other) = delete;
+#endif
+
+        /**
+         * Frees up the resources
+         */
+        ~KeystonePolicy() {
+            if (policy != NULL) {
+                keystone_policy_free(policy);
+            }
+        }
+
+        /**
+         * Evaluates the policy against the roles of the user.
+         *
+         * \param[in] info a userinfo that has been passed to either \ref Keystone::login or \ref Keystone::getUserInfoFromToken
+         *
+         * \return true if the roles of the user satisfy the policy
+         *
+         * \throws std::runtime_error if \c info is in an invalid state, or if something bad has happened.
+         */
+        inline bool evaluate(const KeystoneUserInfo& info) const {
+            if (policy == NULL) {
+                throw std::runtime_error("Illegal state for KeystonePolicy (it has been moved from)");
+            }
+            info.checkInfo();
+            int allowed;
+            KEYSTONE_SAFE_CALL(keystone_policy_eval(policy, info.info, &allowed));
+            return allowed != 0;
+        }
+
+    private:
+        keystone_policy_t* policy;
+
+#if !KEYSTONE_HAS_MOVE
+        // Disable copying
+        KeystonePolicy(const KeystonePolicy& other) {}
+        KeystonePolicy& operator=(const KeystonePolicy& other) { return *this; }
+#endif
+    };
+}
+/**
+ * \}
+ */
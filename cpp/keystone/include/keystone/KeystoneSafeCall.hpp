@@ -1,9 +1,23 @@
 #pragma once
 #include <stdexcept>
+#include <string>
+#include <keystone/keystone.h>
 
 /**
  * \file
  */
+
+/**
+ * Defined to 1 when the compiler supports rvalue references, in which case the
+ * wrapper classes are movable.
+ */
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+#define KEYSTONE_HAS_MOVE 1
+#define KEYSTONE_NOEXCEPT noexcept
+#else
+#define KEYSTONE_HAS_MOVE 0
+#define KEYSTONE_NOEXCEPT throw()
+#endif
 /**
  * \example keystone_safe_call_example
  * \code{.c}
@@ -13,13 +27,141 @@
  * \endcode
  */
 
+namespace keystone {
+    /**
+     * \brief Base of the exceptions thrown by the C++ wrapper, carrying the \ref keystone_error_t of the failed call.
+     */
+    class KeystoneError : public std::runtime_error {
+    public:
+        KeystoneError(keystone_error_t code, const std::string& message, long httpStatus = 0)
+            : std::runtime_error(message), code(code), httpStatus(httpStatus) {}
+
+        keystone_error_t getCode() const { return code; }
+
+        /**
+         * The HTTP status of the reply, 0 if there was none.
+         */
+        long getHttpStatus() const { return httpStatus; }
+
+    private:
+        keystone_error_t code;
+        long httpStatus;
+    };
+
+    /**
+     * \brief The service rejected the credentials or the session token.
+     */
+    class AuthenticationError : public KeystoneError {
+    public:
+        AuthenticationError(keystone_error_t code, const std::string& message, long httpStatus = 0)
+            : KeystoneError(code, message, httpStatus) {}
+    };
+
+    /**
+     * \brief Thrown on \ref KEYSTONE_INVALID_CREDENTIALS.
+     */
+    class InvalidCredentialsError : public AuthenticationError {
+    public:
+        InvalidCredentialsError(const std::string& message, long httpStatus = 0)
+            : AuthenticationError(KEYSTONE_INVALID_CREDENTIALS, message, httpStatus) {}
+    };
+
+    /**
+     * \brief Thrown on \ref KEYSTONE_INVALID_TOKEN.
+     */
+    class InvalidTokenError : public AuthenticationError {
+    public:
+        InvalidTokenError(const std::string& message, long httpStatus = 0)
+            : AuthenticationError(KEYSTONE_INVALID_TOKEN, message, httpStatus) {}
+    };
+
+    /**
+     * \brief The service could not be reached or did not answer properly; the call may be retried.
+     * Thrown on \ref KEYSTONE_HTTP_ERROR, \ref KEYSTONE_TIMEOUT, \ref KEYSTONE_CONNECTION_ERROR and \ref KEYSTONE_OVERLOADED.
+     */
+    class TransportError : public KeystoneError {
+    public:
+        TransportError(keystone_error_t code, const std::string& message, long httpStatus = 0)
+            : KeystoneError(code, message, httpStatus) {}
+    };
+
+    /**
+     * \brief Thrown on \ref KEYSTONE_TIMEOUT.
+     */
+    class TimeoutError : public TransportError {
+    public:
+        TimeoutError(const std::string& message)
+            : TransportError(KEYSTONE_TIMEOUT, message) {}
+    };
+
+    /**
+     * \brief Thrown on \ref KEYSTONE_OVERLOADED.
+     */
+    class OverloadedError : public TransportError {
+    public:
+        OverloadedError(const std::string& message, long httpStatus = 0)
+            : TransportError(KEYSTONE_OVERLOADED, message, httpStatus) {}
+    };
+
+    /**
+     * \brief Thrown on \ref KEYSTONE_PARSE_ERROR.
+     */
+    class ParseError : public KeystoneError {
+    public:
+        ParseError(const std::string& message)
+            : KeystoneError(KEYSTONE_PARSE_ERROR, message) {}
+    };
+
+    /**
+     * \brief Thrown on \ref KEYSTONE_INVALID_ARGUMENT.
+     */
+    class InvalidArgumentError : public KeystoneError {
+    public:
+        InvalidArgumentError(const std::string& message)
+            : KeystoneError(KEYSTONE_INVALID_ARGUMENT, message) {}
+    };
+
+    /**
+     * Throws the exception matching \c code, with the details of the last failed call on this thread.
+     */
+    inline void throwKeystoneError(keystone_error_t code) {
+        keystone_error_detail_t detail;
+        std::string message = "Keystone generated an error";
+        long httpStatus = 0;
+        if (keystone_last_error_detail(&detail) == KEYSTONE_SUCCESS && detail.code == code) {
+            message = detail.message;
+            httpStatus = detail.http_status;
+        }
+        switch (code) {
+        case KEYSTONE_INVALID_CREDENTIALS:
+            throw InvalidCredentialsError(message, httpStatus);
+        case KEYSTONE_INVALID_TOKEN:
+            throw InvalidTokenError(message, httpStatus);
+        case KEYSTONE_TIMEOUT:
+            throw TimeoutError(message);
+        case KEYSTONE_OVERLOADED:
+            throw OverloadedError(message, httpStatus);
+        case KEYSTONE_HTTP_ERROR:
+        case KEYSTONE_CONNECTION_ERROR:
+            throw TransportError(code, message, httpStatus);
+        case KEYSTONE_PARSE_ERROR:
+            throw ParseError(message);
+        case KEYSTONE_INVALID_ARGUMENT:
+            throw InvalidArgumentError(message);
+        default:
+            throw KeystoneError(code, message, httpStatus);
+        }
+    }
+}
+
 /**
  *!\public 
- * \brief short utility macro that calls an exception when a method returns a non \ref KEYSTONE_SUCCESS value
+ * \brief short utility macro that throws the matching \ref keystone::KeystoneError subclass when a method returns a non \ref KEYSTONE_SUCCESS value
  * 
  */
 #define KEYSTONE_SAFE_CALL(x) { \
-    if ( x != KEYSTONE_SUCCESS) { \
-    throw std::runtime_error("Keystone generated an error"); \
+    keystone_error_t keystone_safe_call_result = (x); \
+    if (keystone_safe_call_result != KEYSTONE_SUCCESS) { \
+        keystone::throwKeystoneError(keystone_safe_call_result); \
     } \
 }
@@ -1,12 +1,15 @@
 #pragma once
 #include <keystone/keystone.h>
 #include <keystone/KeystoneSafeCall.hpp>
+#include <string>
+#include <vector>
 /**
  * \addtogroup keystone_wrapper
  * \{
  */
 namespace keystone {
     class Keystone;
+    class KeystonePolicy;
 
      
     /**
@@ -15,12 +18,15 @@ namespace keystone {
      * 
      * \note This class is header-only, meaning that it does not suffer from any definition problems of multiple compiler versions
      * 
-     * \note It is non-copyable by design. If you wish to pass it around, either use references or (smart)-pointers.
+     * \note Copies are cheap: the user information is immutable and shared (reference counted) between copies,
+     *       see \ref keystone_userinfo_copy. With C++11 it is also movable, so it can be stored in containers and queues
+     *       or returned from functions without extra allocations.
      *
      * \note Use of this class still requires linking with the keystone C-library/DLL/so-file(Linux)
      **/
     class KeystoneUserInfo {
         friend class Keystone;
+        friend class KeystonePolicy;
     public:
         /**
          * Constructs a new instance. 
@@ -30,15 +36,65 @@ namespace keystone {
          */
         inline KeystoneUserInfo() : info(NULL) {}
 
+        /**
+         * Makes a copy sharing the (immutable) user information with \c other.
+         *
+         * \throws std::runtime_error if the copy could not be made.
+         */
+        inline KeystoneUserInfo(const KeystoneUserInfo& other) : info(NULL) {
+            if (other.info != NULL) {
+                KEYSTONE_SAFE_CALL(keystone_userinfo_copy(other.info, &info));
+            }
+        }
+
+        /**
+         * Makes this a copy sharing the (immutable) user information with \c other.
+         *
+         * \throws std::runtime_error if the copy could not be made.
+         */
+        inline KeystoneUserInfo& operator=(const KeystoneUserInfo& other) {
+            KeystoneUserInfo copy(other);
+            swap(copy);
+            return *this;
+        }
+
+#if KEYSTONE_HAS_MOVE
+        /**
+         * Takes over the user information of \c other, which is left in the same state as a newly constructed object.
+         */
+        inline KeystoneUserInfo(KeystoneUserInfo&& other) KEYSTONE_NOEXCEPT : info(other.info) {
+            other.info = NULL;
+        }
+
+        /**
+         * Takes over the user information of \c other, which is left in the same state as a newly constructed object.
+         */
+        inline KeystoneUserInfo& operator=(KeystoneUserInfo&& other) KEYSTONE_NOEXCEPT {
+            KeystoneUserInfo moved(static_cast<KeystoneUserInfo&&>(other));
+            swap(moved);
+            return *this;
+        }
+#endif
+
         /**
          * Frees up the resources
          */
         ~KeystoneUserInfo() {
             if(info != NULL ) {
-                KEYSTONE_SAFE_CALL(keystone_userinfo_free(info));
+                // Nothing sensible to do about an error here, and destructors must not throw.
+                keystone_userinfo_free(info);
             }
         }
 
+        /**
+         * Exchanges the content of this object with \c other.
+         */
+        inline void swap(KeystoneUserInfo& other) KEYSTONE_NOEXCEPT {
+            keystone_userinfo_t* temporary = info;
+            info = other.info;
+            other.info = temporary;
+        }
+
         /**
          * Gets the username
          * \sa KeystoneUserInfo::getUsername() const
@@ -177,6 +233,91 @@ namespace keystone {
             return token;
         }
 
+        /**
+         * Gets the timing records of the calls made to the keystone service to obtain this userinfo
+         * (see \ref keystone_timing_t), in the order they were made.
+         *
+         * \return one record per call
+         * \throws std::runtime_error if the object is in an invalid state (eg. if it has not been passed to either 
+         *                            \ref Keystone::login or \ref Keystone::getUserInfoFromToken), or if something bad has happened.  
+         */
+        inline std::vector<keystone_timing_t> getTimings() const {
+            checkInfo();
+            size_t timingCount;
+            KEYSTONE_SAFE_CALL(keystone_userinfo_get_timing_count(info, &timingCount));
+
+            std::vector<keystone_timing_t> timings(timingCount);
+            if (timingCount > 0) {
+                size_t timingsWritten;
+                KEYSTONE_SAFE_CALL(keystone_userinfo_get_timings(info, &timings[0], timingCount, &timingsWritten));
+                timings.resize(timingsWritten);
+            }
+            return timings;
+        }
+
+        /**
+         * Interns a role name so that it can be used with \ref KeystoneUserInfo::hasRole.
+         * Typically done once at startup for the roles an application checks.
+         *
+         * \param[in] roleName the name of the role
+         *
+         * \return the process-wide id of the role
+         * \throws std::runtime_error if the role could not be interned
+         */
+        static inline keystone_role_id_t internRole(const std::string& roleName) {
+            keystone_role_id_t roleId;
+            KEYSTONE_SAFE_CALL(keystone_role_intern(roleName.c_str(), &roleId));
+            return roleId;
+        }
+
+        /**
+         * Checks whether the user has the given role (a single bit test).
+         *
+         * \sa KeystoneUserInfo::internRole
+         *
+         * \param[in] roleId the id of the role as returned from \ref KeystoneUserInfo::internRole
+         *
+         * \return true if the user has the role
+         * \throws std::runtime_error if the object is in an invalid state (eg. if it has not been passed to either 
+         *                            \ref Keystone::login or \ref Keystone::getUserInfoFromToken), or if something bad has happened.  
+         */
+        inline bool hasRole(keystone_role_id_t roleId) const {
+            checkInfo();
+            int hasRole;
+            KEYSTONE_SAFE_CALL(keystone_userinfo_has_role(info, roleId, &hasRole));
+            return hasRole != 0;
+        }
+
+        /**
+         * Checks whether the user has at least one of the given roles.
+         *
+         * \param[in] roleIds the ids of the roles as returned from \ref KeystoneUserInfo::internRole
+         *
+         * \return true if the user has any of the roles
+         * \throws std::runtime_error if the object is in an invalid state, or if something bad has happened.
+         */
+        inline bool hasAnyRole(const std::vector<keystone_role_id_t>& roleIds) const {
+            checkInfo();
+            int hasRole;
+            KEYSTONE_SAFE_CALL(keystone_userinfo_has_any_role(info, roleIds.empty() ? NULL : &roleIds[0], roleIds.size(), &hasRole));
+            return hasRole != 0;
+        }
+
+        /**
+         * Checks whether the user has all of the given roles.
+         *
+         * \param[in] roleIds the ids of the roles as returned from \ref KeystoneUserInfo::internRole
+         *
+         * \return true if the user has all of the roles
+         * \throws std::runtime_error if the object is in an invalid state, or if something bad has happened.
+         */
+        inline bool hasAllRoles(const std::vector<keystone_role_id_t>& roleIds) const {
+            checkInfo();
+            int hasRoles;
+            KEYSTONE_SAFE_CALL(keystone_userinfo_has_all_roles(info, roleIds.empty() ? NULL : &roleIds[0], roleIds.size(), &hasRoles));
+            return hasRoles != 0;
+        }
+
         
     private:
         inline void setUserInfo(keystone_userinfo_t* info)  { 
@@ -187,16 +328,19 @@ namespace keystone {
         }
         keystone_userinfo_t* info;
 
-        // Disable copying
-        KeystoneUserInfo(const KeystoneUserInfo& other) {}
-        KeystoneUserInfo& operator=(const KeystoneUserInfo& other) {return *this; }
-
         inline void checkInfo() const {
             if(info == NULL) {
                 throw std::runtime_error("Illegal state for KeystoneUserinfo");
             }
         }
     };
+
+    /**
+     * Exchanges the content of two \ref KeystoneUserInfo objects (found by argument dependent lookup).
+     */
+    inline void swap(KeystoneUserInfo& a, KeystoneUserInfo& b) KEYSTONE_NOEXCEPT {
+        a.swap(b);
+    }
 }
 /**
  * \}
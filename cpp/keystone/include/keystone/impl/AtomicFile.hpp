@@ -0,0 +1,20 @@
+#pragma once
+#include <string>
+#include <stddef.h>
+#include "keystone/keystone_export.h"
+#include "keystone/impl/Error.hpp"
+
+namespace keystone { namespace impl {
+
+    /**
+     * Writes \c size bytes to a new file next to \c path and renames it over
+     * \c path when complete, so readers never see a partial file.
+     *
+     * On POSIX systems the new file is created by mkstemp under a unique name
+     * (so neither a planted symlink nor a concurrent writer can write to it)
+     * and then given \c mode, eg. 0600 for files only the owner may read.
+     * \c mode is ignored on Windows.
+     * \return ERROR_UNKNOWN if the file can not be created, written or renamed
+     */
+    KEYSTONE_EXPORT Status replaceFile(const std::string& path, const char* data, size_t size, unsigned mode);
+}}
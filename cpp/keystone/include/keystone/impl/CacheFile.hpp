@@ -0,0 +1,40 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "keystone/keystone_export.h"
+#include "keystone/impl/Error.hpp"
+#include "keystone/impl/CachedUserInfo.hpp"
+#include "keystone/impl/Hash.hpp"
+
+namespace keystone { namespace impl { namespace cachefile {
+
+    /**
+     * Cache snapshot files, for warm restarts.
+     *
+     * The file is a header, with the SipKey the cache keys were made with,
+     * followed by the entries, each an 8 byte wall clock expiry (nanoseconds
+     * since the Unix epoch, so that it survives a reboot), the CacheKey, the
+     * record size and the flat userinfo record (see
+     * KeystoneUserInfo::getRecord) padded to 8 bytes. Everything is in host
+     * byte order. The header carries a checksum of the entries, and load() maps
+     * the file and validates both the checksum and every record.
+     */
+
+    /**
+     * Writes the entries that have not expired to \c path, through a temporary
+     * file that replaces \c path when it is complete. The file is only readable
+     * by its owner (on POSIX systems).
+     */
+    KEYSTONE_EXPORT Status save(const std::string& path, const SipKey& key, const std::vector<CachedUserInfo>& entries);
+
+    /**
+     * Reads the entries of \c path that have not expired yet, with their expiries
+     * converted back to monotonicNanoseconds(), and sets \c key to the SipKey of their keys.
+     * On POSIX systems the file must be a regular file owned by the effective user with no
+     * group or other permissions, as anyone who can write it can make the caches hand out
+     * any userinfo.
+     * \return ERROR_PARSE if the file is not a valid cache file, ERROR_INVALID_ARGUMENT if
+     *         it is not private to the user
+     */
+    KEYSTONE_EXPORT Status load(const std::string& path, SipKey& key, std::vector<CachedUserInfo>& entries);
+}}}
@@ -0,0 +1,35 @@
+#pragma once
+#include <functional>
+#include <stdint.h>
+#include "keystone/impl/KeystoneUserInfo.hpp"
+#include "keystone/impl/Hash.hpp"
+
+namespace keystone { namespace impl {
+
+    /**
+     * Selects cache entries, eg. those of revoked tokens (see CacheKey::high) or users.
+     */
+    typedef std::function<bool(const CacheKey& key, const KeystoneUserInfo& info)> CacheEntryMatch;
+
+    /**
+     * A cache entry as handed between the caches and the cache files. The userinfo
+     * has no token, see CacheKey.
+     */
+    struct CachedUserInfo {
+        CachedUserInfo() : expiresAt(0) {
+            key.low = 0;
+            key.high = 0;
+        }
+
+        CachedUserInfo(const CacheKey& key, const KeystoneUserInfo& info, int64_t expiresAt)
+            : key(key), info(info), expiresAt(expiresAt) {}
+
+        CacheKey key;
+        KeystoneUserInfo info;
+
+        /**
+         * In monotonicNanoseconds().
+         */
+        int64_t expiresAt;
+    };
+}}
@@ -0,0 +1,30 @@
+#pragma once
+#include <chrono>
+#include <stdint.h>
+#include <time.h>
+
+namespace keystone { namespace impl {
+
+    /**
+     * Monotonic time in nanoseconds, for deadlines.
+     */
+    inline int64_t monotonicNanoseconds() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /**
+     * Like monotonicNanoseconds() but only accurate to a few milliseconds, and
+     * several times cheaper where the platform has a coarse clock (Linux). Good
+     * enough for cache expiry checks on the hit path.
+     */
+    inline int64_t coarseMonotonicNanoseconds() {
+#if defined(CLOCK_MONOTONIC_COARSE)
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+        return int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+#else
+        return monotonicNanoseconds();
+#endif
+    }
+}}
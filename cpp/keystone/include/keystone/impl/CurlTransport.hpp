@@ -0,0 +1,109 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <stdint.h>
+#include "keystone/keystone_export.h"
+#include "keystone/impl/Error.hpp"
+
+namespace keystone { namespace impl {
+
+    /**
+     * What curl reports about one transfer. The times are in seconds and
+     * cumulative from the start of the transfer.
+     */
+    struct TransferInfo {
+        double nameLookup;
+        double connect;
+        double appConnect;
+        double startTransfer;
+        double total;
+        uint64_t bytesSent;
+        uint64_t bytesReceived;
+        long newConnections;
+        long httpStatus;
+
+        TransferInfo()
+            : nameLookup(0), connect(0), appConnect(0), startTransfer(0), total(0),
+              bytesSent(0), bytesReceived(0), newConnections(0), httpStatus(0) {}
+    };
+
+    /**
+     * Whether CurlTransport uses HTTP/2, see CurlTransport::setHttp2.
+     */
+    enum Http2Mode {
+        // No multiplexing, each call runs its own transfer with curl's default HTTP version.
+        HTTP2_OFF = 0,
+        // HTTP/2 if the server picks it with ALPN, HTTP/1.1 otherwise and over cleartext.
+        HTTP2_NEGOTIATE = 1,
+        // HTTP/2 without negotiation (h2c over cleartext), for servers known to speak it.
+        HTTP2_PRIOR_KNOWLEDGE = 2,
+        HTTP2_MODE_COUNT = 3
+    };
+
+    /**
+     * Posts SOAP requests over HTTP(S) with libcurl.
+     *
+     * This is the default transport of impl::Keystone and of the direct C++ API
+     * (see keystone/KeystoneDirect.hpp). A transport only needs to provide
+     * \ref post with the same signature.
+     *
+     * The transfers share a curl share handle (the DNS cache, the TLS sessions
+     * for resumption and, with curl 7.57 or later, the connection pool) and a
+     * pool of easy handles, so that connections and TLS sessions outlive the
+     * calls, and each pooled handle keeps the CA store it parsed (curl 7.87 or
+     * later) instead of reading the CA bundle for every handshake. Copies of a
+     * transport share all of this until the CA file or the HTTP/2 mode of one
+     * is set. post is thread safe.
+     *
+     * With HTTP/2 (see setHttp2), the calling threads hand their transfers to
+     * a thread of the transport that drives them all with one curl multi
+     * handle, so that concurrent calls to an endpoint are multiplexed as
+     * streams of one connection instead of each taking a connection.
+     */
+    class KEYSTONE_EXPORT CurlTransport {
+    public:
+        /**
+         * Initializes curl (curl_global_init, which is not thread safe) on first use.
+         * \throw Error if curl cannot be initialized
+         */
+        CurlTransport();
+
+        /**
+         * Set the CA certification file name in order to correctly handle https urls.
+         * If not set, the environment variable KEYSTONE_SET_CA_CERTIFICATE_FILENAME is used (if present).
+         * Replaces the pooled handles (and the HTTP/2 thread), so it must not be called while
+         * other threads use the transport.
+         */
+        void setCaCertFileName(const std::string& caCertFileName);
+
+        /**
+         * Sets whether HTTP/2 is used, with at most \c maxStreams concurrent streams per
+         * connection (0 leaves it to the server); further transfers wait for a stream, or
+         * open another connection if the server limits its streams. The connections of the
+         * old mode are closed. Must not be called while other threads use the transport.
+         * \return ERROR_INVALID_ARGUMENT if curl was built without HTTP/2 support
+         */
+        Status setHttp2(Http2Mode mode, unsigned maxStreams);
+
+        Http2Mode getHttp2Mode() const { return http2Mode; }
+
+        /**
+         * Posts \c request to \c endpoint and stores the body of the reply in \c response.
+         * If \c info is given, it is filled in also when the transfer fails
+         * (\c httpStatus stays 0 if no reply was received).
+         * The body of the reply is kept in \c response also for unexpected HTTP status codes.
+         * \return an error status on transport errors and unexpected HTTP status codes.
+         */
+        Status post(const std::string& endpoint, const std::string& request, std::string& response,
+                  TransferInfo* info = NULL);
+
+    private:
+        struct Shared;
+
+        std::string caCertFileName;
+        bool userDefinedCaCertFile;
+        Http2Mode http2Mode;
+        unsigned maxStreams;
+        std::shared_ptr<Shared> shared;
+    };
+}}
@@ -0,0 +1,104 @@
+#pragma once
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include "keystone/keystone_export.h"
+
+namespace keystone { namespace impl {
+
+    /**
+     * Epoch based reclamation for the lock-free caches.
+     *
+     * Readers hold an EpochGuard while they look at shared nodes. Writers unlink
+     * nodes and hand them to retire(), which frees them once every thread that
+     * could still see them has left its guard. Readers only write to their own
+     * (cache line sized) slot, so they never contend with each other.
+     *
+     * The domain is library-wide: each thread gets a slot on its first guard,
+     * and the slot is reused by another thread once the owner exits.
+     */
+    class KEYSTONE_EXPORT EpochDomain {
+    public:
+        typedef void (*Deleter)(void* node);
+
+        static EpochDomain& instance();
+
+        /**
+         * Frees \c node with \c deleter once no reader can hold it any more.
+         * The node must already be unreachable for new readers.
+         */
+        void retire(void* node, Deleter deleter);
+
+        /**
+         * The number of retired nodes not yet freed.
+         */
+        size_t getPendingCount() const;
+
+        struct Slot {
+            Slot() : epoch(0), inUse(false), depth(0) {}
+
+            // 0 while the owner is outside any guard.
+            std::atomic<uint64_t> epoch;
+            std::atomic<bool> inUse;
+            // Only touched by the owning thread.
+            unsigned depth;
+            char padding[64 - sizeof(std::atomic<uint64_t>) - sizeof(std::atomic<bool>) - sizeof(unsigned)];
+        };
+
+        Slot* localSlot();
+
+        uint64_t currentEpoch() const { return epoch.load(std::memory_order_acquire); }
+
+    private:
+        EpochDomain();
+        EpochDomain(const EpochDomain&);
+        EpochDomain& operator=(const EpochDomain&);
+
+        struct Retired {
+            void* node;
+            Deleter deleter;
+        };
+
+        Slot* acquireSlot();
+        bool tryAdvance();
+
+        std::atomic<uint64_t> epoch;
+
+        mutable std::mutex slotMutex;
+        std::deque<Slot> slots;
+
+        mutable std::mutex retireMutex;
+        // Nodes retired in epoch e are kept in limbo[e % 3] and freed when the
+        // epoch advances to e + 3, by which time every reader has moved on.
+        std::vector<Retired> limbo[3];
+    };
+
+    /**
+     * Pins the current epoch while in scope. Guards may be nested.
+     */
+    class EpochGuard {
+    public:
+        EpochGuard() : slot(EpochDomain::instance().localSlot()) {
+            if (slot->depth++ == 0) {
+                slot->epoch.store(EpochDomain::instance().currentEpoch(), std::memory_order_relaxed);
+                // The announcement must be visible before any shared pointer is read.
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+            }
+        }
+
+        ~EpochGuard() {
+            if (--slot->depth == 0) {
+                slot->epoch.store(0, std::memory_order_release);
+            }
+        }
+
+    private:
+        EpochGuard(const EpochGuard&);
+        EpochGuard& operator=(const EpochGuard&);
+
+        EpochDomain::Slot* slot;
+    };
+}}
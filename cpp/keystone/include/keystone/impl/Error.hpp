@@ -0,0 +1,81 @@
+#pragma once
+#include <stdexcept>
+#include <string>
+#include "keystone/keystone_export.h"
+
+namespace keystone { namespace impl {
+
+    /**
+     * Why an operation failed.
+     * The values match keystone_error_t in the C-interface.
+     */
+    enum ErrorCode {
+        ERROR_NONE = 0,
+        ERROR_UNKNOWN = 1,
+        ERROR_INVALID_CREDENTIALS = 2,
+        ERROR_INVALID_TOKEN = 3,
+        ERROR_HTTP = 4,
+        ERROR_TIMEOUT = 5,
+        ERROR_CONNECTION = 6,
+        ERROR_PARSE = 7,
+        ERROR_OVERLOADED = 8,
+        ERROR_INVALID_ARGUMENT = 9,
+        ERROR_CODE_COUNT = 10
+    };
+
+    /**
+     * A short, static name of the error code (eg. "invalid_token").
+     */
+    KEYSTONE_EXPORT const char* errorName(ErrorCode code);
+
+    /**
+     * The outcome of an internal call. The implementation returns these instead
+     * of throwing, so that a flood of rejected tokens costs no unwinding and no
+     * message formatting. The message is always a static string.
+     */
+    struct Status {
+        ErrorCode code;
+        const char* message;
+        long httpStatus;
+        int transportCode;
+
+        Status() : code(ERROR_NONE), message(""), httpStatus(0), transportCode(0) {}
+
+        Status(ErrorCode code, const char* message, long httpStatus = 0, int transportCode = 0)
+            : code(code), message(message), httpStatus(httpStatus), transportCode(transportCode) {}
+
+        bool isOk() const { return code == ERROR_NONE; }
+    };
+
+    /**
+     * Thrown at the C++ API boundary (the direct API), and by the few internal
+     * calls that are not on the request path (eg. construction), carrying the
+     * error code and what is known about the failed transfer.
+     */
+    class KEYSTONE_EXPORT Error : public std::runtime_error {
+    public:
+        Error(ErrorCode code, const std::string& message, long httpStatus = 0, int transportCode = 0)
+            : std::runtime_error(message), code(code), httpStatus(httpStatus), transportCode(transportCode) {}
+
+        explicit Error(const Status& status)
+            : std::runtime_error(status.message), code(status.code), httpStatus(status.httpStatus),
+              transportCode(status.transportCode) {}
+
+        ErrorCode getCode() const { return code; }
+
+        /**
+         * The HTTP status of the reply, 0 if there was none.
+         */
+        long getHttpStatus() const { return httpStatus; }
+
+        /**
+         * The CURLcode of the transfer, 0 if it succeeded.
+         */
+        int getTransportCode() const { return transportCode; }
+
+    private:
+        ErrorCode code;
+        long httpStatus;
+        int transportCode;
+    };
+}}
@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include "keystone/keystone_export.h"
+
+namespace keystone { namespace impl {
+
+    /**
+     * Estimates how often each hash was seen lately (TinyLFU): a count-min
+     * sketch of 4 bit counters, four per hash, packed sixteen to a word. Once
+     * ten times as many hashes as the sketch was sized for have been counted,
+     * all counters are halved, so old popularity fades.
+     *
+     * The counters are updated with plain atomic loads and stores, so
+     * concurrent increments may be lost. That only makes the estimates a bit
+     * lower, and keeps the lookup path of the caches free of read-modify-write
+     * instructions.
+     */
+    class KEYSTONE_EXPORT FrequencySketch {
+    public:
+        /**
+         * \param expectedEntries the number of entries the estimates should tell apart
+         */
+        explicit FrequencySketch(size_t expectedEntries);
+
+        void increment(uint64_t hash);
+
+        /**
+         * \return the estimated count, 0 to 15
+         */
+        unsigned frequency(uint64_t hash) const;
+
+        size_t getMemoryBytes() const { return width * sizeof(uint64_t); }
+
+    private:
+        FrequencySketch(const FrequencySketch&);
+        FrequencySketch& operator=(const FrequencySketch&);
+
+        void halve();
+
+        size_t width;
+        uint64_t sampleSize;
+        std::unique_ptr<std::atomic<uint64_t>[]> table;
+        std::atomic<uint64_t> additions;
+    };
+}}
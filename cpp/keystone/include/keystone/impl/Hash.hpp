@@ -0,0 +1,198 @@
+#pragma once
+#include <random>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace keystone { namespace impl {
+
+    /**
+     * The murmur3 64 bit finalizer, spreads every input bit over the whole word.
+     */
+    inline uint64_t mix64(uint64_t x) {
+        x ^= x >> 33;
+        x *= UINT64_C(0xff51afd7ed558ccd);
+        x ^= x >> 33;
+        x *= UINT64_C(0xc4ceb9fe1a85ec53);
+        x ^= x >> 33;
+        return x;
+    }
+
+    /**
+     * A 64 bit checksum of a large buffer, eight bytes at a time (several GB/s).
+     * Detects corruption, not tampering.
+     */
+    inline uint64_t checksumBytes(const char* data, size_t length) {
+        uint64_t hash = UINT64_C(0x9e3779b97f4a7c15) ^ length;
+        size_t i = 0;
+        for (; i + 8 <= length; i += 8) {
+            uint64_t word;
+            memcpy(&word, data + i, 8);
+            hash = (hash ^ word) * UINT64_C(0x9fb21c651e98df25);
+            hash ^= hash >> 29;
+        }
+        for (; i < length; i++) {
+            hash = (hash ^ static_cast<unsigned char>(data[i])) * UINT64_C(0x100000001b3);
+        }
+        return mix64(hash);
+    }
+
+    /**
+     * A 128 bit key of sipHash128.
+     */
+    struct SipKey {
+        uint64_t k0;
+        uint64_t k1;
+    };
+
+    /**
+     * A key from the system random source, for hashes that must not be
+     * predictable outside the process.
+     */
+    inline SipKey randomSipKey() {
+        std::random_device device;
+        SipKey key;
+        key.k0 = (uint64_t(device()) << 32) ^ device();
+        key.k1 = (uint64_t(device()) << 32) ^ device();
+        return key;
+    }
+
+    /**
+     * SipHash-2-4 with a 128 bit output: a keyed hash (a MAC) that nobody without
+     * the key can find collisions for, or learn anything about the input from.
+     * Slower than unkeyed hashes, so only for keys chosen by clients or secrets.
+     *
+     * The input may be given in pieces, the result only depends on their
+     * concatenation.
+     */
+    class SipHasher {
+    public:
+        explicit SipHasher(const SipKey& key)
+            : v0(UINT64_C(0x736f6d6570736575) ^ key.k0), v1(UINT64_C(0x646f72616e646f6d) ^ key.k1 ^ 0xee),
+              v2(UINT64_C(0x6c7967656e657261) ^ key.k0), v3(UINT64_C(0x7465646279746573) ^ key.k1),
+              pending(0), pendingBytes(0), length(0) {}
+
+        void update(const char* data, size_t size) {
+            const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+            length += size;
+            size_t i = 0;
+            // Complete the word left over from the last piece.
+            for (; i < size && pendingBytes > 0; i++) {
+                addByte(bytes[i]);
+            }
+            for (; i + 8 <= size; i += 8) {
+                // Little endian, whatever the host.
+                uint64_t m = 0;
+                for (unsigned j = 0; j < 8; j++) {
+                    m |= uint64_t(bytes[i + j]) << (8 * j);
+                }
+                compress(m);
+            }
+            for (; i < size; i++) {
+                addByte(bytes[i]);
+            }
+        }
+
+        void finish(uint64_t out[2]) {
+            uint64_t last = (uint64_t(length) << 56) | pending;
+            compress(last);
+            v2 ^= 0xee;
+            for (int i = 0; i < 4; i++) {
+                round();
+            }
+            out[0] = v0 ^ v1 ^ v2 ^ v3;
+            v1 ^= 0xdd;
+            for (int i = 0; i < 4; i++) {
+                round();
+            }
+            out[1] = v0 ^ v1 ^ v2 ^ v3;
+        }
+
+    private:
+        static uint64_t rotateLeft(uint64_t x, unsigned bits) {
+            return (x << bits) | (x >> (64 - bits));
+        }
+
+        void round() {
+            v0 += v1; v1 = rotateLeft(v1, 13); v1 ^= v0; v0 = rotateLeft(v0, 32);
+            v2 += v3; v3 = rotateLeft(v3, 16); v3 ^= v2;
+            v0 += v3; v3 = rotateLeft(v3, 21); v3 ^= v0;
+            v2 += v1; v1 = rotateLeft(v1, 17); v1 ^= v2; v2 = rotateLeft(v2, 32);
+        }
+
+        void compress(uint64_t m) {
+            v3 ^= m;
+            round();
+            round();
+            v0 ^= m;
+        }
+
+        void addByte(unsigned char byte) {
+            pending |= uint64_t(byte) << (8 * pendingBytes);
+            if (++pendingBytes == 8) {
+                compress(pending);
+                pending = 0;
+                pendingBytes = 0;
+            }
+        }
+
+        uint64_t v0, v1, v2, v3;
+        uint64_t pending;
+        unsigned pendingBytes;
+        uint64_t length;
+    };
+
+    inline void sipHash128(const SipKey& key, const char* data, size_t length, uint64_t out[2]) {
+        SipHasher hasher(key);
+        hasher.update(data, length);
+        hasher.finish(out);
+    }
+
+    /**
+     * What the token caches are keyed by: keyed hashes of the tenant name with
+     * the token (\c low) and of the token alone (\c high), see makeCacheKey.
+     * Collisions are out of reach for anybody without the key, so the caches
+     * compare keys instead of tokens, and keep no tokens. The entries of a
+     * revoked token are found by \c high, without knowing their tenant names.
+     */
+    struct CacheKey {
+        uint64_t low;
+        uint64_t high;
+    };
+
+    /**
+     * Compares in the same time whatever the keys, so a lookup does not tell
+     * how much of a key matched.
+     */
+    inline bool sameCacheKey(const CacheKey& a, const CacheKey& b) {
+        return ((a.low ^ b.low) | (a.high ^ b.high)) == 0;
+    }
+
+    /**
+     * The \c high half of the cache keys of a token.
+     */
+    inline uint64_t tokenHash(const SipKey& key, const char* token, size_t tokenLength) {
+        uint64_t out[2];
+        sipHash128(key, token, tokenLength, out);
+        return out[0];
+    }
+
+    inline CacheKey makeCacheKey(const SipKey& key, const char* tenantName, size_t tenantLength,
+                                 const char* token, size_t tokenLength) {
+        // The length prefix keeps ("ab", "c") and ("a", "bc") apart.
+        unsigned char prefix[8];
+        for (unsigned i = 0; i < 8; i++) {
+            prefix[i] = static_cast<unsigned char>(uint64_t(tenantLength) >> (8 * i));
+        }
+        SipHasher hasher(key);
+        hasher.update(reinterpret_cast<const char*>(prefix), sizeof(prefix));
+        hasher.update(tenantName, tenantLength);
+        hasher.update(token, tokenLength);
+        uint64_t out[2];
+        hasher.finish(out);
+        CacheKey result;
+        result.low = out[0];
+        result.high = tokenHash(key, token, tokenLength);
+        return result;
+    }
+}}
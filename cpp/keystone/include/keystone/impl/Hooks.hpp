@@ -0,0 +1,54 @@
+#pragma once
+#include <memory>
+#include <stddef.h>
+#include "keystone/impl/RequestTiming.hpp"
+#include "keystone/impl/Error.hpp"
+
+namespace keystone { namespace impl {
+
+    /**
+     * What a hook is told about a call.
+     */
+    struct HookEvent {
+        Operation operation;
+
+        /**
+         * In seconds, 0 for the start of a call.
+         */
+        double duration;
+
+        /**
+         * ERROR_NONE if the call succeeded.
+         */
+        ErrorCode outcome;
+    };
+
+    /**
+     * Callbacks fired around the calls made to the keystone service.
+     * Each callback may be NULL, which costs a single check on the request path.
+     */
+    struct Hooks {
+        typedef void (*Callback)(void* userData, const HookEvent& event);
+
+        Hooks() : userData(NULL), requestStart(NULL), requestEnd(NULL), cacheHit(NULL), cacheMiss(NULL) {}
+
+        void* userData;
+        // Keeps userData alive while these hooks are installed, if it is not owned elsewhere.
+        std::shared_ptr<void> userDataOwner;
+        Callback requestStart;
+        Callback requestEnd;
+        Callback cacheHit;
+        Callback cacheMiss;
+    };
+
+    inline void fireHook(Hooks::Callback callback, void* userData, Operation operation,
+                         double duration = 0, ErrorCode outcome = ERROR_NONE) {
+        if (callback != NULL) {
+            HookEvent event;
+            event.operation = operation;
+            event.duration = duration;
+            event.outcome = outcome;
+            callback(userData, event);
+        }
+    }
+}}
@@ -1,57 +1,278 @@
 #pragma once
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
+#include "keystone/keystone_export.h"
 #include "keystone/impl/KeystoneUserInfo.hpp"
-#include <pugi4lunch/pugixml.hpp>
+#include "keystone/impl/CurlTransport.hpp"
+#include "keystone/impl/RequestTiming.hpp"
+#include "keystone/impl/Metrics.hpp"
+#include "keystone/impl/Hooks.hpp"
+#include "keystone/impl/TokenFormat.hpp"
+#include "keystone/impl/NegativeCache.hpp"
+#include "keystone/impl/TokenCache.hpp"
+#include "keystone/impl/SharedCache.hpp"
+#include "keystone/impl/RoleCache.hpp"
+#include "keystone/impl/SessionCache.hpp"
+#include "keystone/impl/Revocation.hpp"
 
 
 namespace keystone { namespace impl {
-    class Keystone {
+    class KEYSTONE_EXPORT Keystone {
     public:
         /**
          * \param url the URL to the base of the keystone service.
          *            this is typically on the form "http://something.com/keystone"
          *            (note we omit the "v2.0" part here)
+         * \throws Error (ERROR_INVALID_ARGUMENT) if the url is empty
          */
         Keystone(const std::string& url);
 
 
         /**
          * Logs the user in and returns the userinfo
-         * \throws runtime_error if anything went wrong (http access, xml parsing, login error)
+         * If \c timings is given, a timing record is added to it for each call made to the server.
+         * \return an error status if anything went wrong (ERROR_INVALID_CREDENTIALS if the login was rejected),
+         *         \c info is then left unchanged.
          */
-        void login(const std::string& username, 
+        Status login(const std::string& username,
             const std::string& password,
             const std::string& tenantName,
-            KeystoneUserInfo& info);
+            KeystoneUserInfo& info,
+            RequestTimings* timings = NULL);
 
 
         /**
-         * Gets the userinfo of a sessionToken.
-         * \throws runtime_error if the username could not be acquired (typically invalid sessiontoken)
+         * Like login, but hands out the session of an earlier call with the same username,
+         * password and tenant while it lasts, see SessionCache. Logs in directly if there
+         * is no session cache.
          */
-        void getUserInfo(const std::string& tenantName, 
-            const std::string& sessionToken, KeystoneUserInfo& info);
+        Status sessionLogin(const std::string& username,
+            const std::string& password,
+            const std::string& tenantName,
+            KeystoneUserInfo& info,
+            RequestTimings* timings = NULL);
+
+
+        /**
+         * Gets the userinfo of a sessionToken. \c info has no token (the caller has it), so that
+         * cache hits hand out the cached userinfo as is, without a copy.
+         * If \c timings is given, a timing record is added to it for each call made to the server.
+         * \return an error status if the userinfo could not be acquired (ERROR_INVALID_TOKEN if the token was rejected),
+         *         \c info is then left unchanged.
+         */
+        Status getUserInfo(const std::string& tenantName,
+            const std::string& sessionToken, KeystoneUserInfo& info,
+            RequestTimings* timings = NULL);
 
         /**
          * Set the CA certification file name in order to correctly handle https urls
+         * Must not be called while other threads use this object.
          * @param caCertFileName
          */
         void setCaCertFileName(const std::string& caCertFileName);
 
+        /**
+         * Multiplexes concurrent calls over HTTP/2, see CurlTransport::setHttp2.
+         * Must not be called while other threads use this object.
+         */
+        Status setHttp2(Http2Mode mode, unsigned maxStreams);
+
+        /**
+         * Sets the callbacks fired around each call to the service. The session refresher is
+         * paused meanwhile, and the previous hooks (with their userDataOwner) are released.
+         * Must not be called while other threads use this object.
+         */
+        void setHooks(const Hooks& hooks);
+
+        /**
+         * Sets the syntax session tokens must have. Tokens that do not match
+         * are rejected by getUserInfo with ERROR_INVALID_TOKEN without any I/O.
+         * Must not be called while other threads use this object.
+         */
+        void setTokenFormat(const TokenFormat& tokenFormat);
+
+        /**
+         * Remembers up to about \c expectedEntries tokens the service rejected for at most
+         * \c ttl seconds, see NegativeCache. getUserInfo rejects them with ERROR_INVALID_TOKEN
+         * without any I/O. 0 entries turns the cache off (the default).
+         * Must not be called while other threads use this object.
+         */
+        void setNegativeCache(size_t expectedEntries, double ttl);
+
+        /**
+         * Caches the userinfo of up to \c capacity tokens for \c ttl seconds, see TokenCache.
+         * getUserInfo answers from it without any I/O, login and getUserInfo fill it.
+         * The cache is keyed by a keyed hash of the tenant name and the token, see makeCacheKey.
+         * 0 turns the cache off (the default).
+         * Must not be called while other threads use this object.
+         */
+        void setTokenCache(size_t capacity, double ttl);
+
+        /**
+         * Puts a per-thread L1 table of \c entries in front of the token cache, whose entries
+         * are used for at most \c maxStaleness seconds, see TokenCache::setLocalCache.
+         * Kept when the token cache is set up again. 0 entries turns it off (the default).
+         * Must not be called while other threads use this object.
+         */
+        void setTokenCacheL1(size_t entries, double maxStaleness);
+
+        /**
+         * Bounds the bytes of the token cache entries, evicting with W-TinyLFU, see
+         * TokenCache::setMemoryLimit. Kept when the token cache is set up again.
+         * 0 turns the limit off (the default).
+         * Must not be called while other threads use this object.
+         */
+        void setTokenCacheMemoryLimit(size_t bytes);
+
+        /**
+         * Attaches the shared memory cache \c name (creating it with \c capacity slots of
+         * \c slotSize bytes if needed), see SharedCache. It is looked up after the token cache,
+         * and login and getUserInfo fill it. The handle adopts the cache key of the segment, which
+         * empties the token cache if it had another one. An empty name detaches.
+         * Must not be called while other threads use this object.
+         */
+        Status setSharedCache(const std::string& name, size_t capacity, size_t slotSize, double ttl);
+
+        /**
+         * Caches the roles of up to \c capacity users (per tenant name) for \c ttl seconds,
+         * see RoleCache. login and getUserInfo then only fetch the roles when they are not
+         * cached. The tenant name given to getUserInfo is trusted to be the one of the token,
+         * lookups with an empty tenant name bypass the cache.
+         * 0 turns the cache off (the default).
+         * Must not be called while other threads use this object.
+         */
+        void setRoleCache(size_t capacity, double ttl);
+
+        /**
+         * Keeps up to \c capacity login sessions for sessionLogin, each handed out for \c lifetime
+         * seconds and renewed in the background \c refreshAfter seconds after its login, see
+         * SessionCache. 0 turns the cache off (the default). Its refresh thread logs in at any
+         * time, so the setters of what login uses (the transport, the hooks and the caches)
+         * pause it while they change them.
+         * Must not be called while other threads use this object.
+         */
+        void setSessionCache(size_t capacity, double lifetime, double refreshAfter);
+
+        /**
+         * Writes the unexpired entries of the token cache (or of the shared cache, if there is
+         * no token cache) to \c path, see cachefile::save.
+         * \return ERROR_INVALID_ARGUMENT if neither cache is set up
+         */
+        Status saveCache(const std::string& path) const;
+
+        /**
+         * Adds the unexpired entries of a file written by saveCache to the token cache and the
+         * shared cache, keeping their expiries (but no later than the ttl of each cache from now),
+         * except the ones the last purge revoked (see purgeRevoked). Nothing is added if the file is corrupt.
+         * Without a shared cache, the handle adopts the cache key of the file (emptying the token
+         * cache if it had another one).
+         * Must not be called while other threads use this object.
+         * \return ERROR_INVALID_ARGUMENT if neither cache is set up, if the file is not private to
+         *         the user (see cachefile::load) or if it was written with another cache key than
+         *         the one of the shared cache
+         */
+        Status loadCache(const std::string& path);
+
+        /**
+         * Looks up \c tokens with getUserInfo from \c concurrency threads (at most four per
+         * core), at most \c maxRate lookups per second (0 for no limit), so that the caches hold
+         * them before traffic arrives. Rejected tokens are skipped. Other threads may use this
+         * object meanwhile.
+         * \param cached set to the number of tokens that are cached now
+         * \return ERROR_INVALID_ARGUMENT if neither the token cache nor the shared cache is set
+         *         up, ERROR_UNKNOWN if no thread could be started, or the first error other than
+         *         ERROR_INVALID_TOKEN, which stops the lookups
+         */
+        Status prewarmCache(const std::string& tenantName, const std::vector<std::string>& tokens,
+                            unsigned concurrency, double maxRate, size_t& cached);
+
+        /**
+         * Polls \c source for revocations every \c interval seconds and removes the revoked
+         * tokens from the caches (see purgeRevoked), so their ttls can be long. A NULL source
+         * stops polling.
+         * Must not be called while other threads use this object.
+         */
+        void setRevocationSource(const RevocationPoller::Source& source, double interval);
+
+        /**
+         * Removes the entries of revoked tokens and users from the token cache (with its
+         * per-thread tables), the shared cache and the session cache. Lookups that were in
+         * flight meanwhile do not cache their results (they check and store under the lock of
+         * the purge). Only the revocations that are not in the previous list are looked for, and
+         * nothing is done if there are none. The list is kept to filter loadCache and the shared
+         * caches attached later.
+         * \return the number of entries removed
+         */
+        size_t purgeRevoked(const RevocationList& revoked);
+
 
     private:
-        void write(const std::string& endpoint,
-                   const KeystoneUserInfo& info,
-                   std::stringstream& in,
-                   std::stringstream& out);
-
-        void printXML(pugi4lunch::pugi::xml_node node, int intendation);
-        void getRoles(const std::string &url, const std::string &sessionToken,
-                                          KeystoneUserInfo& info);
+        Status getRoles(const std::string &sessionToken, std::vector<std::string>& roles,
+                        RequestTimings* timings);
+
+        /**
+         * getRoles through the role cache, if there is one and \c tenantName is not empty.
+         */
+        Status getUserRoles(const std::string& username, const std::string& tenantName,
+                            const std::string& sessionToken, std::vector<std::string>& roles,
+                            RequestTimings* timings);
+
+        CacheKey keyOf(const std::string& tenantName, const std::string& sessionToken) const;
+
+        /**
+         * \param revocationsBefore revocations read before the service was asked, nothing is
+         *                          stored if revocations were purged since (checked under
+         *                          purgeMutex, as is the store)
+         */
+        void storeInCaches(const CacheKey& key, const KeystoneUserInfo& info, uint64_t revocationsBefore);
+
+        /**
+         * Removes the entries of \c revoked from the caches, under purgeMutex.
+         */
+        size_t purgeLocked(const RevocationList& revoked);
+
+        /**
+         * Makes the cache keys with \c key from now on, dropping the entries made with another key.
+         */
+        void rekey(const SipKey& key);
+
+        /**
+         * Posts one request and hands the response to \c parse (returning a Status), recording
+         * the timing (if \c timings is given) and the metrics of the call.
+         */
+        template<class Parse>
+        Status call(Operation operation, const std::string& request, double envelopeBuild,
+                  RequestTimings* timings, Parse parse);
+
         std::string url;
-        std::string caCertFileName;
-        bool userDefinedCaCertFile;
+        CurlTransport transport;
+        EndpointMetrics* metrics;
+        Hooks hooks;
+        TokenFormat tokenFormat;
+        // The SipKey of the cache keys, random per handle unless adopted from a shared cache
+        // or a cache file.
+        SipKey cacheKey;
+        std::unique_ptr<NegativeCache> negativeCache;
+        std::unique_ptr<TokenCache> tokenCache;
+        size_t tokenCacheL1Entries;
+        double tokenCacheL1Staleness;
+        size_t tokenCacheMemoryLimit;
+        std::unique_ptr<SharedCache> sharedCache;
+        std::unique_ptr<RoleCache> roleCache;
+        // After the caches, so its refresh thread stops before anything it logs in with is destroyed.
+        std::unique_ptr<SessionCache> sessionCache;
+        // Bumped by every purge.
+        std::atomic<uint64_t> revocations;
+        // Keeps purges off caches that are being set up, loaded or stored into.
+        std::mutex purgeMutex;
+        // The list of the last purge, under purgeMutex.
+        RevocationList lastRevoked;
+        // Last, so its thread stops before anything it purges is destroyed.
+        std::unique_ptr<RevocationPoller> revocationPoller;
 
     };
- 
+
 }}
@@ -1,28 +1,116 @@
 #pragma once
 #include <string>
 #include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include "keystone/keystone_export.h"
+#include "keystone/impl/RoleTable.hpp"
 
 namespace keystone {
     namespace impl {
-        class KeystoneUserInfo {
+
+        /**
+         * A non-owning view of a string stored inside a userinfo record.
+         * The characters are always followed by a null terminator.
+         */
+        struct StringRef {
+            const char* data;
+            size_t size;
+
+            std::string str() const { return std::string(data, size); }
+        };
+
+        /**
+         * Immutable user information (username, token and roles).
+         *
+         * All data lives in a single allocation: a small reference counted
+         * block followed by a flat record holding a header, a role offset
+         * table and the null terminated strings. The record only contains
+         * offsets, so it can be copied byte for byte (e.g. into shared memory
+         * or a file) and read back with \ref fromRecord.
+         *
+         * Next to the record the block keeps a bitset of the roles, indexed by
+         * the ids from \ref RoleTable, so role checks are single word tests. It
+         * spans the words from the lowest to the highest role id of the user.
+         *
+         * Copying a KeystoneUserInfo only bumps the reference count.
+         */
+        class KEYSTONE_EXPORT KeystoneUserInfo {
         public:
             KeystoneUserInfo();
 
-            const std::string& getUsername() const;
-            void setUsername(const std::string& username);
+            /**
+             * \throws Error (ERROR_PARSE) if a role can not be interned because the RoleTable is full
+             */
+            KeystoneUserInfo(const std::string& username,
+                const std::string& token,
+                const std::vector<std::string>& roles);
+
+            KeystoneUserInfo(const KeystoneUserInfo& other);
+            KeystoneUserInfo(KeystoneUserInfo&& other) noexcept;
+            KeystoneUserInfo& operator=(const KeystoneUserInfo& other);
+            KeystoneUserInfo& operator=(KeystoneUserInfo&& other) noexcept;
+            ~KeystoneUserInfo();
+
+            /**
+             * Rebuilds a userinfo from a record obtained from \ref getRecord.
+             * \return false (leaving \c info untouched) if the record is malformed, or has a role
+             *         that can not be interned because the RoleTable is full.
+             */
+            static bool fromRecord(const void* record, size_t size, KeystoneUserInfo& info);
+
+            /**
+             * A deep copy with a reference count of its own, so that copies handed out
+             * by one thread do not share a counter (a cache line) with other threads.
+             */
+            KeystoneUserInfo clone() const;
 
-            const std::vector<std::string>& getRoles() const;
+            /**
+             * A copy with \c token in place of the token of this userinfo.
+             */
+            KeystoneUserInfo withToken(const char* token, size_t length) const;
 
-            void setRoles(const std::vector<std::string>& roles);
+            /**
+             * The caches keep userinfos without their tokens.
+             */
+            KeystoneUserInfo withoutToken() const {
+                return withToken("", 0);
+            }
 
-            void setToken(const std::string& token);
+            bool isEmpty() const;
 
-            const std::string& getToken() const;
+            StringRef getUsername() const;
+            StringRef getToken() const;
+            size_t getRoleCount() const;
+            StringRef getRole(size_t index) const;
+
+            bool hasRole(RoleId id) const;
+
+            /**
+             * The role bitset: word \c i holds the role ids from 64 * (getFirstRoleWord() + i).
+             */
+            const uint64_t* getRoleBits() const;
+            size_t getFirstRoleWord() const;
+            size_t getRoleWordCount() const;
+
+            /**
+             * The flat, position independent representation of this userinfo.
+             */
+            const void* getRecord() const;
+            size_t getRecordSize() const;
+
+            /**
+             * The bytes of the allocation holding this userinfo (shared by all copies).
+             */
+            size_t getMemoryBytes() const;
+
+            void swap(KeystoneUserInfo& other) noexcept;
 
         private:
-            std::string username;
-            std::vector<std::string> roles;
-            std::string token;
+            struct Block;
+            explicit KeystoneUserInfo(Block* block);
+
+            Block* block;
         };
     }
 }
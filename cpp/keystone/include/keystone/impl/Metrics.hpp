@@ -0,0 +1,213 @@
+#pragma once
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include "keystone/keystone_export.h"
+#include "keystone/impl/RequestTiming.hpp"
+#include "keystone/impl/Error.hpp"
+
+namespace keystone { namespace impl {
+
+    /**
+     * Lock-free latency histogram with log-linear (HDR style) buckets.
+     *
+     * Values are recorded in microseconds. Every power of two range is split
+     * in 2^SUB_BUCKET_BITS linear sub-buckets, giving a relative error of at
+     * most 12.5% from 1 microsecond up to several days.
+     */
+    class KEYSTONE_EXPORT LatencyHistogram {
+    public:
+        static const unsigned SUB_BUCKET_BITS = 3;
+        static const unsigned SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+        static const unsigned MAX_EXPONENT = 40;
+        static const size_t BUCKET_COUNT = (MAX_EXPONENT - SUB_BUCKET_BITS + 2) * SUB_BUCKETS;
+
+        LatencyHistogram();
+
+        void record(double seconds);
+
+        static size_t bucketIndex(uint64_t micros);
+
+        /**
+         * The smallest value (in microseconds) that does not fit in the bucket.
+         */
+        static uint64_t bucketUpperBound(size_t index);
+
+        /**
+         * A plain copy of the counters.
+         */
+        struct Snapshot {
+            std::vector<uint64_t> counts;
+            uint64_t count;
+            double sumSeconds;
+
+            Snapshot() : count(0), sumSeconds(0) {}
+
+            void add(const Snapshot& other);
+
+            /**
+             * \return an upper bound (in seconds) of the given quantile, 0 if empty.
+             */
+            double quantile(double q) const;
+        };
+
+        void snapshot(Snapshot& snapshot) const;
+
+    private:
+        std::atomic<uint64_t> counts[BUCKET_COUNT];
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> sumMicros;
+    };
+
+    /**
+     * A counter for paths that must scale with the number of cores (cache
+     * hits): each thread adds to one of STRIPES cells of a cache line each,
+     * and load() sums them. Has the subset of the std::atomic interface the
+     * other counters are used with.
+     */
+    class KEYSTONE_EXPORT StripedCounter {
+    public:
+        static const unsigned STRIPES = 16;
+
+        StripedCounter();
+
+        void fetch_add(uint64_t value, std::memory_order order) {
+            cells[stripe()].value.fetch_add(value, order);
+        }
+
+        uint64_t load(std::memory_order order) const;
+
+    private:
+        StripedCounter(const StripedCounter&);
+        StripedCounter& operator=(const StripedCounter&);
+
+        /**
+         * The cell of the calling thread, handed out round-robin.
+         */
+        static unsigned stripe();
+
+        struct Cell {
+            std::atomic<uint64_t> value;
+            char padding[64 - sizeof(std::atomic<uint64_t>)];
+        };
+
+        Cell cells[STRIPES];
+    };
+
+    /**
+     * The counters of one operation on one endpoint.
+     */
+    struct KEYSTONE_EXPORT OperationMetrics {
+        OperationMetrics();
+
+        std::atomic<uint64_t> requests;
+        // Indexed by ErrorCode (ERROR_NONE is never counted).
+        std::atomic<uint64_t> errors[ERROR_CODE_COUNT];
+        std::atomic<uint64_t> bytesSent;
+        std::atomic<uint64_t> bytesReceived;
+        std::atomic<uint64_t> connectionsOpened;
+        std::atomic<uint64_t> connectionsReused;
+        std::atomic<uint64_t> tlsHandshakes;
+        StripedCounter cacheHits;
+        std::atomic<uint64_t> cacheMisses;
+        std::atomic<uint64_t> rejectedLocally;
+        std::atomic<int64_t> inFlight;
+        LatencyHistogram latency;
+
+        struct Snapshot {
+            uint64_t requests;
+            uint64_t errors[ERROR_CODE_COUNT];
+            uint64_t bytesSent;
+            uint64_t bytesReceived;
+            uint64_t connectionsOpened;
+            uint64_t connectionsReused;
+            uint64_t tlsHandshakes;
+            uint64_t cacheHits;
+            uint64_t cacheMisses;
+            uint64_t rejectedLocally;
+            int64_t inFlight;
+            LatencyHistogram::Snapshot latency;
+
+            Snapshot();
+            void add(const Snapshot& other);
+            uint64_t totalErrors() const;
+        };
+
+        void snapshot(Snapshot& snapshot) const;
+    };
+
+    /**
+     * All metrics of one endpoint (keystone service URL).
+     */
+    struct KEYSTONE_EXPORT EndpointMetrics {
+        explicit EndpointMetrics(const std::string& endpoint) : endpoint(endpoint) {}
+
+        const std::string endpoint;
+        OperationMetrics operations[OPERATION_COUNT];
+    };
+
+    /**
+     * A consistent-enough copy of the whole registry (every counter is read
+     * atomically, but not all at the same instant).
+     */
+    struct KEYSTONE_EXPORT MetricsSnapshot {
+        struct Endpoint {
+            std::string endpoint;
+            OperationMetrics::Snapshot operations[OPERATION_COUNT];
+        };
+        std::vector<Endpoint> endpoints;
+
+        /**
+         * The metrics of an operation summed over all endpoints.
+         */
+        OperationMetrics::Snapshot total(Operation operation) const;
+
+        /**
+         * Renders the snapshot in the Prometheus text exposition format.
+         */
+        void renderPrometheus(std::string& output) const;
+    };
+
+    /**
+     * Library-wide registry of metrics, updated lock-free on the request path.
+     * Endpoints are registered once (under a lock) and stay for the lifetime
+     * of the process, so the pointers handed out remain valid.
+     */
+    class KEYSTONE_EXPORT Metrics {
+    public:
+        static Metrics& instance();
+
+        EndpointMetrics* endpoint(const std::string& endpoint);
+
+        void snapshot(MetricsSnapshot& snapshot) const;
+
+    private:
+        Metrics() {}
+        Metrics(const Metrics&);
+        Metrics& operator=(const Metrics&);
+
+        mutable std::mutex mutex;
+        std::deque<EndpointMetrics> endpoints;
+    };
+
+    /**
+     * Keeps the in-flight gauge of an operation up while in scope.
+     */
+    class InFlightScope {
+    public:
+        explicit InFlightScope(OperationMetrics& metrics) : metrics(metrics) {
+            metrics.inFlight.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        ~InFlightScope() {
+            metrics.inFlight.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+    private:
+        OperationMetrics& metrics;
+    };
+}}
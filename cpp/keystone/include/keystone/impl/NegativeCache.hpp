@@ -0,0 +1,82 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include "keystone/keystone_export.h"
+
+namespace keystone { namespace impl {
+
+    /**
+     * Remembers the hashes of recently rejected tokens in a rotating pair of
+     * Bloom filters, so that clients retrying with a stale token are turned
+     * away without a round trip.
+     *
+     * Each generation is a cache line blocked Bloom filter sized for half of
+     * the expected entries at 24 bits per entry. New entries go into the
+     * current generation, lookups check both. The older generation is cleared
+     * and becomes the current one every ttl/2 seconds, or as soon as the current
+     * one is full, so an entry is remembered for between ttl/2 and ttl seconds
+     * and the memory (and false positive rate) stays bounded no matter how many
+     * distinct tokens are rejected.
+     *
+     * A false positive rejects a valid token until its generation is cleared;
+     * the rate is below 1 in 10^4 while the filter is within its capacity.
+     *
+     * All operations are thread safe. Lookups and inserts are lock-free, a
+     * rotation takes a lock that nobody waits for.
+     */
+    class KEYSTONE_EXPORT NegativeCache {
+    public:
+        /**
+         * \param expectedEntries the number of rejected tokens to remember per ttl
+         * \param ttl how long (in seconds) a rejected token is remembered at most
+         */
+        NegativeCache(size_t expectedEntries, double ttl);
+
+        bool contains(uint64_t hash);
+
+        void insert(uint64_t hash);
+
+        /**
+         * Forgets everything.
+         */
+        void clear();
+
+        size_t getExpectedEntries() const { return expectedEntries; }
+        double getTtl() const { return ttl; }
+        size_t getMemoryBytes() const;
+
+    private:
+        NegativeCache(const NegativeCache&);
+        NegativeCache& operator=(const NegativeCache&);
+
+        static const unsigned BLOCK_WORDS = 8;
+        static const unsigned BLOCK_BITS = BLOCK_WORDS * 64;
+        static const unsigned HASH_COUNT = 12;
+        static const unsigned BITS_PER_ENTRY = 24;
+
+        struct Generation {
+            Generation() : inserted(0) {}
+            std::unique_ptr<std::atomic<uint64_t>[]> words;
+            std::atomic<size_t> inserted;
+        };
+
+        void rotateIfDue();
+        size_t blockOf(uint64_t hash) const;
+        bool test(const Generation& generation, uint64_t hash) const;
+        void clear(Generation& generation);
+
+        const size_t expectedEntries;
+        const double ttl;
+        size_t blockCount;
+        size_t generationCapacity;
+        int64_t rotationPeriod;
+
+        Generation generations[2];
+        std::atomic<unsigned> current;
+        std::atomic<int64_t> rotateAt;
+        std::mutex rotationMutex;
+    };
+}}
@@ -0,0 +1,65 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "keystone/keystone_export.h"
+#include "keystone/impl/KeystoneUserInfo.hpp"
+#include "keystone/impl/RoleTable.hpp"
+
+namespace keystone { namespace impl {
+
+    /**
+     * A role policy such as "admin OR (operator AND tenant-x)", compiled once.
+     *
+     * Grammar (keywords are case insensitive, && / || / ! are accepted as well):
+     *
+     *     expression := term ( OR term )*
+     *     term       := factor ( AND factor )*
+     *     factor     := NOT factor | '(' expression ')' | role
+     *     role       := [A-Za-z0-9_.:@-]+ | '"' any characters '"'
+     *
+     * The expression is compiled into a small postfix program. When it refers
+     * to at most \ref MAX_TABLE_ROLES distinct roles, the program is also run
+     * for every combination of those roles up front, so evaluating the policy
+     * is just gathering the user's bits for the referenced roles and looking
+     * the decision up in a table keyed by that role set.
+     */
+    class KEYSTONE_EXPORT Policy {
+    public:
+        static const size_t MAX_TABLE_ROLES = 12;
+        static const size_t MAX_DEPTH = 64;
+
+        /**
+         * \throws Error (ERROR_INVALID_ARGUMENT) if the expression is malformed
+         */
+        explicit Policy(const std::string& expression);
+
+        bool evaluate(const KeystoneUserInfo& info) const;
+
+        const std::string& getExpression() const { return expression; }
+
+        enum OpCode {
+            OP_ROLE,
+            OP_NOT,
+            OP_AND,
+            OP_OR
+        };
+
+        struct Instruction {
+            OpCode op;
+            // Index into referencedRoles for OP_ROLE
+            uint32_t operand;
+        };
+
+    private:
+        bool run(uint64_t roleMask) const;
+        uint64_t gatherRoles(const KeystoneUserInfo& info) const;
+
+        std::string expression;
+        std::vector<Instruction> program;
+        std::vector<RoleId> referencedRoles;
+        std::vector<uint64_t> decisions;
+
+        friend class PolicyCompiler;
+    };
+}}
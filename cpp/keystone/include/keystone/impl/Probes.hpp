@@ -0,0 +1,42 @@
+#pragma once
+
+/**
+ * USDT (SystemTap/DTrace) static probes of the "keystone" provider.
+ *
+ * The probes are compiled in when the build finds <sys/sdt.h> (see
+ * KEYSTONE_WITH_USDT in keystone/CMakeLists.txt) and are a single nop each
+ * until a tracer attaches, eg.
+ *
+ *     bpftrace -e 'usdt:libkeystone.so:keystone:request_end { @[arg0] = hist(arg1); }'
+ *
+ * Probes (operation is the value of impl::Operation):
+ *  - request_begin(operation, request bytes, endpoint)
+ *  - request_end(operation, http status (0 if no reply), bytes sent, bytes received)
+ *  - parse_begin(operation, response bytes)
+ *  - parse_end(operation, success)
+ *  - cache_lookup(operation, hit)
+ */
+#if defined(KEYSTONE_WITH_USDT)
+#include <sys/sdt.h>
+
+#define KEYSTONE_PROBE_REQUEST_BEGIN(operation, bytes, endpoint) \
+    DTRACE_PROBE3(keystone, request_begin, int(operation), (unsigned long)(bytes), (endpoint))
+#define KEYSTONE_PROBE_REQUEST_END(operation, status, bytesSent, bytesReceived) \
+    DTRACE_PROBE4(keystone, request_end, int(operation), long(status), \
+                  (unsigned long)(bytesSent), (unsigned long)(bytesReceived))
+#define KEYSTONE_PROBE_PARSE_BEGIN(operation, bytes) \
+    DTRACE_PROBE2(keystone, parse_begin, int(operation), (unsigned long)(bytes))
+#define KEYSTONE_PROBE_PARSE_END(operation, success) \
+    DTRACE_PROBE2(keystone, parse_end, int(operation), int(success))
+#define KEYSTONE_PROBE_CACHE_LOOKUP(operation, hit) \
+    DTRACE_PROBE2(keystone, cache_lookup, int(operation), int(hit))
+
+#else
+
+#define KEYSTONE_PROBE_REQUEST_BEGIN(operation, bytes, endpoint)
+#define KEYSTONE_PROBE_REQUEST_END(operation, status, bytesSent, bytesReceived)
+#define KEYSTONE_PROBE_PARSE_BEGIN(operation, bytes)
+#define KEYSTONE_PROBE_PARSE_END(operation, success)
+#define KEYSTONE_PROBE_CACHE_LOOKUP(operation, hit)
+
+#endif
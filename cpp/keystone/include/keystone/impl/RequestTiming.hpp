@@ -0,0 +1,75 @@
+#pragma once
+#include <stddef.h>
+#include <chrono>
+
+namespace keystone { namespace impl {
+
+    /**
+     * The SOAP calls made to the authentication manager.
+     * The values match keystone_operation_t in the C-interface.
+     */
+    enum Operation {
+        OPERATION_LOGIN = 0,
+        OPERATION_GET_USERNAME = 1,
+        OPERATION_GET_ROLES = 2,
+        OPERATION_COUNT = 3
+    };
+
+    /**
+     * Where the time of one SOAP call went, all in seconds.
+     *
+     * The curl phases are cumulative from the start of the transfer (as
+     * reported by curl), envelopeBuild and parse are measured by us.
+     */
+    struct RequestTiming {
+        Operation operation;
+        double nameLookup;
+        double connect;
+        double appConnect;
+        double startTransfer;
+        double total;
+        double envelopeBuild;
+        double parse;
+    };
+
+    /**
+     * The timings of the calls made for one userinfo (at most one per operation).
+     * Fixed size, so recording them does not allocate.
+     */
+    struct RequestTimings {
+        static const size_t CAPACITY = 4;
+
+        RequestTiming timings[CAPACITY];
+        size_t count;
+
+        RequestTimings() : count(0) {}
+
+        /**
+         * \return a zeroed record for the operation, or NULL if full.
+         */
+        RequestTiming* add(Operation operation) {
+            if (count == CAPACITY) {
+                return NULL;
+            }
+            RequestTiming& timing = timings[count++];
+            timing = RequestTiming();
+            timing.operation = operation;
+            return &timing;
+        }
+    };
+
+    /**
+     * Measures the time between construction and \ref seconds.
+     */
+    class Stopwatch {
+    public:
+        Stopwatch() : start(std::chrono::steady_clock::now()) {}
+
+        double seconds() const {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+    private:
+        std::chrono::steady_clock::time_point start;
+    };
+}}
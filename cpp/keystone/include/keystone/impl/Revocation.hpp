@@ -0,0 +1,104 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <stdint.h>
+#include "keystone/keystone_export.h"
+#include "keystone/impl/Error.hpp"
+#include "keystone/impl/Hash.hpp"
+#include "keystone/impl/KeystoneUserInfo.hpp"
+
+namespace keystone { namespace impl {
+
+    /**
+     * Session tokens, and users all of whose tokens, that must no longer be
+     * accepted from a cache.
+     */
+    struct KEYSTONE_EXPORT RevocationList {
+        std::unordered_set<std::string> tokens;
+        std::unordered_set<std::string> usernames;
+
+        bool empty() const { return tokens.empty() && usernames.empty(); }
+
+        /**
+         * Whether the token or the user of \c info is revoked.
+         */
+        bool matches(const KeystoneUserInfo& info) const;
+    };
+
+    /**
+     * Matches the entries of the token caches, which keep no tokens, against a
+     * RevocationList: revoked tokens by the token hash of the cache keys (see
+     * CacheKey), revoked users by the username of the userinfo.
+     */
+    class KEYSTONE_EXPORT RevokedEntries {
+    public:
+        /**
+         * \param list must outlive this object
+         * \param key the SipKey the cache keys are made with
+         */
+        RevokedEntries(const RevocationList& list, const SipKey& key);
+
+        bool matches(const CacheKey& key, const KeystoneUserInfo& info) const;
+
+    private:
+        const RevocationList& list;
+        std::unordered_set<uint64_t> tokenHashes;
+    };
+
+    /**
+     * Reads a revocation file: one token per line, or "user " followed by a
+     * username to revoke all tokens of the user. Blank lines and lines starting
+     * with '#' are skipped, as is whitespace at the ends of lines.
+     */
+    KEYSTONE_EXPORT Status readRevocationFile(const std::string& path, RevocationList& list);
+
+    /**
+     * Fetches the revocations from a source every \c interval seconds (the
+     * first time right away) on a thread of its own, and hands them to a
+     * purge function.
+     *
+     * Sources are expected to return every revocation still in effect, not
+     * only new ones: the purge function compares each list with the previous
+     * one (see Keystone::purgeRevoked). A source that fails is tried again at the next interval, and
+     * nothing is purged meanwhile.
+     */
+    class KEYSTONE_EXPORT RevocationPoller {
+    public:
+        typedef std::function<Status(RevocationList& list)> Source;
+        typedef std::function<void(const RevocationList& list)> Purge;
+
+        RevocationPoller(double interval, const Source& source, const Purge& purge);
+
+        /**
+         * Waits for a poll in progress.
+         */
+        ~RevocationPoller();
+
+        double getInterval() const { return interval; }
+
+        /**
+         * The status of the last poll, ERROR_UNKNOWN ("Not polled yet") before the first.
+         */
+        Status getLastStatus() const;
+
+    private:
+        RevocationPoller(const RevocationPoller&);
+        RevocationPoller& operator=(const RevocationPoller&);
+
+        void pollLoop();
+
+        const double interval;
+        const Source source;
+        const Purge purge;
+
+        mutable std::mutex mutex;
+        std::condition_variable wake;
+        bool stopping;
+        Status lastStatus;
+        std::thread poller;
+    };
+}}
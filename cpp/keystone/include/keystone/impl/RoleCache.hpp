@@ -0,0 +1,63 @@
+#pragma once
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include "keystone/keystone_export.h"
+
+namespace keystone { namespace impl {
+
+    /**
+     * Caches the roles of users, keyed by username and tenant name, so that
+     * a login or a token lookup only needs to ask the service who the token
+     * belongs to.
+     *
+     * Entries expire \c ttl seconds after they were inserted; roles change
+     * rarely, so this is typically much longer than the ttl of the token
+     * cache. A full cache drops an arbitrary entry.
+     *
+     * It is only used on the way to the service, so a single mutex is enough.
+     * All operations are thread safe.
+     */
+    class KEYSTONE_EXPORT RoleCache {
+    public:
+        /**
+         * \param capacity the maximum number of users
+         * \param ttl how long (in seconds) the roles of a user are used
+         */
+        RoleCache(size_t capacity, double ttl);
+
+        /**
+         * \return true (and sets \c roles) if fresh roles were found
+         */
+        bool find(const std::string& username, const std::string& tenantName, std::vector<std::string>& roles) const;
+
+        void insert(const std::string& username, const std::string& tenantName, const std::vector<std::string>& roles);
+
+        void clear();
+
+        size_t getCapacity() const { return capacity; }
+        double getTtl() const { return ttl; }
+        size_t size() const;
+
+    private:
+        RoleCache(const RoleCache&);
+        RoleCache& operator=(const RoleCache&);
+
+        struct Entry {
+            int64_t expiresAt;
+            std::vector<std::string> roles;
+        };
+
+        static std::string keyOf(const std::string& username, const std::string& tenantName);
+
+        const size_t capacity;
+        const double ttl;
+        int64_t ttlNanoseconds;
+
+        mutable std::mutex mutex;
+        std::unordered_map<std::string, Entry> entries;
+    };
+}}
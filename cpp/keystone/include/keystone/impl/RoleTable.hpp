@@ -0,0 +1,98 @@
+#pragma once
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include "keystone/keystone_export.h"
+
+namespace keystone { namespace impl {
+
+    typedef uint32_t RoleId;
+
+    /**
+     * A set of interned roles stored as a bitset, one bit per \ref RoleId.
+     */
+    class KEYSTONE_EXPORT RoleSet {
+    public:
+        void add(RoleId id);
+        bool contains(RoleId id) const;
+        bool empty() const;
+
+        const std::vector<uint64_t>& getWords() const { return words; }
+
+        /**
+         * Checks a bitset (as stored in a userinfo) against this set.
+         */
+        bool isSubsetOf(const uint64_t* bits, size_t wordCount) const;
+        bool intersects(const uint64_t* bits, size_t wordCount) const;
+
+    private:
+        std::vector<uint64_t> words;
+    };
+
+    /**
+     * Process-wide table mapping role names to small dense ids.
+     *
+     * Ids are only valid within the process that interned them, they are
+     * never written to records that may be shared with other processes.
+     *
+     * Every userinfo built (also on cache hits) interns its roles, so roles
+     * that are already in the table are found without locking or allocating:
+     * they are looked up in an open addressing index whose slots are only
+     * ever filled, never changed. When the index gets too full, a twice as
+     * large copy is published instead, and the old one is kept for readers
+     * still using it. Only new roles take the mutex.
+     */
+    class KEYSTONE_EXPORT RoleTable {
+    public:
+        /**
+         * Upper bound on the number of distinct roles, so that a misbehaving
+         * server can not make the table (and every userinfo bitset) grow forever.
+         */
+        static const RoleId MAX_ROLES = 65536;
+
+        static RoleTable& instance();
+
+        /**
+         * \return true and the id of the role, interning it if needed.
+         *         false if the table is full.
+         */
+        bool intern(const char* name, size_t length, RoleId& id);
+
+        size_t size() const;
+
+    private:
+        RoleTable();
+        RoleTable(const RoleTable&);
+        RoleTable& operator=(const RoleTable&);
+
+        struct Entry {
+            std::string name;
+            uint64_t hash;
+            RoleId id;
+        };
+
+        struct Index {
+            explicit Index(size_t slotCount);
+
+            size_t mask;
+            std::unique_ptr<std::atomic<const Entry*>[]> slots;
+        };
+
+        static uint64_t hashOf(const char* name, size_t length);
+        static bool find(const Index& index, const char* name, size_t length, uint64_t hash, RoleId& id);
+        static void place(Index& index, const Entry* entry);
+
+        // Taken to add roles.
+        mutable std::mutex mutex;
+        // A deque, so the entries never move.
+        std::deque<Entry> entries;
+        // Every index published so far, the last one is current.
+        std::vector<std::unique_ptr<Index> > indexes;
+        std::atomic<const Index*> current;
+    };
+}}
@@ -0,0 +1,155 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <stddef.h>
+#include <stdint.h>
+#include "keystone/keystone_export.h"
+#include "keystone/impl/Error.hpp"
+#include "keystone/impl/Hash.hpp"
+#include "keystone/impl/KeystoneUserInfo.hpp"
+#include "keystone/impl/RequestTiming.hpp"
+
+namespace keystone { namespace impl {
+
+    /**
+     * Hands out the session of an earlier login for the same username, tenant
+     * and password instead of logging in again, for clients that log the same
+     * account in over and over (batch jobs, service accounts).
+     *
+     * Sessions are keyed by the username, the tenant name and a SipHash of the
+     * password under a key drawn when the cache is created, so the cache holds
+     * nothing that could be checked against a password outside the process. A
+     * different password is a different session. Only successful logins are
+     * kept.
+     *
+     * A session is handed out for \c lifetime seconds after its login. A thread
+     * of the cache logs in again \c refreshAfter seconds after the login, so
+     * that callers of sessions in use never wait, and drops the sessions that
+     * were not used since their last login instead. To log in again it keeps
+     * the password in memory (and wipes it when the session is dropped).
+     *
+     * Concurrent calls for a session that needs a login share one login: the
+     * first caller makes it and the others wait for its result.
+     *
+     * The refresh thread logs in at any time, so whoever changes what the
+     * login function uses must pause() it first.
+     *
+     * All operations are thread safe.
+     */
+    class KEYSTONE_EXPORT SessionCache {
+    public:
+        typedef std::function<Status(const std::string& username, const std::string& password,
+                                     const std::string& tenantName, KeystoneUserInfo& info,
+                                     RequestTimings* timings)> Login;
+
+        /**
+         * \param capacity the maximum number of sessions, the least recently used is dropped
+         * \param lifetime how long (in seconds) a session is handed out after its login
+         * \param refreshAfter when (in seconds after the login) the session is renewed in the background
+         * \param login logs in, called from the calling threads and from the refresh thread
+         */
+        SessionCache(size_t capacity, double lifetime, double refreshAfter, const Login& login);
+
+        /**
+         * Waits for a refresh in progress. Must not be called while other threads use the cache.
+         */
+        ~SessionCache();
+
+        /**
+         * Gets the userinfo of a session, logging in if there is no current one.
+         * \param cached set to true if the userinfo came from an earlier login (also one made
+         *               by another thread meanwhile)
+         * \return the status of the login, \c info is left unchanged if it failed
+         */
+        Status login(const std::string& username, const std::string& password, const std::string& tenantName,
+                     KeystoneUserInfo& info, RequestTimings* timings, bool& cached);
+
+        /**
+         * Drops every session. Logins in progress still hand their result to their waiters.
+         */
+        void clear();
+
+        /**
+         * Drops the sessions whose userinfo \c match returns true for, so their next caller
+         * logs in again.
+         * \return the number of sessions dropped
+         */
+        size_t eraseIf(const std::function<bool(const KeystoneUserInfo& info)>& match);
+
+        /**
+         * Keeps the refresh thread from logging in until as many resume() calls, waiting for
+         * a refresh in progress, so what the login function uses can be changed meanwhile.
+         * Calls to login still log in.
+         */
+        void pause();
+        void resume();
+
+        size_t getCapacity() const { return capacity; }
+        double getLifetime() const { return lifetime; }
+        double getRefreshAfter() const { return refreshAfter; }
+        size_t size() const;
+
+    private:
+        SessionCache(const SessionCache&);
+        SessionCache& operator=(const SessionCache&);
+
+        struct Session {
+            Session() : obtainedAt(0), retryAt(0), lastUsedAt(0), used(false), loggingIn(false), attempts(0) {}
+            ~Session();
+
+            std::string username;
+            std::string password;
+            std::string tenantName;
+            KeystoneUserInfo info;
+            // In monotonicNanoseconds(), obtainedAt is 0 until the first login succeeded.
+            int64_t obtainedAt;
+            int64_t retryAt;
+            int64_t lastUsedAt;
+            // Whether the session was handed out since its last login.
+            bool used;
+            bool loggingIn;
+            // Counts the finished logins, so waiters can tell that theirs is done.
+            uint64_t attempts;
+            Status lastStatus;
+        };
+
+        std::string keyOf(const std::string& username, const std::string& password,
+                          const std::string& tenantName) const;
+
+        bool isFresh(const Session& session, int64_t now) const;
+
+        /**
+         * Drops the least recently used session that is not logging in. Called with the mutex held.
+         */
+        void evictOne();
+
+        void refreshLoop();
+
+        const size_t capacity;
+        const double lifetime;
+        const double refreshAfter;
+        int64_t lifetimeNanoseconds;
+        int64_t refreshAfterNanoseconds;
+        const Login loginFunction;
+        const SipKey passwordKey;
+
+        mutable std::mutex mutex;
+        // Signalled when a login finishes.
+        std::condition_variable loginDone;
+        // Signalled when the refresh thread has something new to do.
+        std::condition_variable wakeRefresher;
+        std::unordered_map<std::string, std::shared_ptr<Session> > sessions;
+        // Signalled when the refresh thread finishes a login.
+        std::condition_variable refreshDone;
+        bool stopping;
+        unsigned pauses;
+        // Whether the refresh thread is logging in.
+        bool refreshing;
+        std::thread refresher;
+    };
+}}
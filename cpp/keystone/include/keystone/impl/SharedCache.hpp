@@ -0,0 +1,129 @@
+#pragma once
+#include <functional>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include "keystone/keystone_export.h"
+#include "keystone/impl/Error.hpp"
+#include "keystone/impl/KeystoneUserInfo.hpp"
+#include "keystone/impl/CachedUserInfo.hpp"
+#include "keystone/impl/Hash.hpp"
+
+namespace keystone { namespace impl {
+
+    /**
+     * A token cache in a POSIX shared memory segment, shared by every process
+     * (and handle) on the host that attaches the same name.
+     *
+     * The segment holds a header and a fixed size open addressing table of
+     * slots, each with a flat userinfo record (see KeystoneUserInfo::getRecord,
+     * without the token, as any process that maps the segment can read it),
+     * the CacheKey and the expiry (CLOCK_MONOTONIC, which all processes on a
+     * host share). A key is looked for in up to PROBE_LIMIT slots from its low
+     * half. The creator of the segment draws the SipKey of the cache keys and
+     * keeps it in the header, so all processes key alike (see getKey).
+     *
+     * Every slot has a sequence lock. Readers take no lock: they copy the slot
+     * and retry if a writer was active meanwhile. Writers claim a slot by moving
+     * its sequence from even to odd, and give up rather than wait if another
+     * writer has it. Nothing in the segment is a pointer, so it can be mapped
+     * at any address.
+     *
+     * The segment outlives the processes (until it is removed, eg. from
+     * /dev/shm, or the host reboots), so restarted workers find it warm.
+     */
+    class KEYSTONE_EXPORT SharedCache {
+    public:
+        static const size_t DEFAULT_SLOT_SIZE = 1024;
+        static const unsigned PROBE_LIMIT = 8;
+
+        SharedCache();
+        ~SharedCache();
+
+        /**
+         * Creates the segment, or attaches to it if it exists. An existing segment keeps
+         * its geometry, \c capacity and \c slotSize only apply when it is created.
+         *
+         * \param name the segment name, "/" followed by up to 250 characters other than "/"
+         * \param capacity the number of slots (rounded up to a power of two)
+         * \param slotSize the bytes per slot, userinfos with larger records are not shared
+         * \param ttl how long (in seconds) entries inserted through this object are used
+         * \return ERROR_INVALID_ARGUMENT if the name or geometry is invalid, or if an existing
+         *         segment has an incompatible layout or is not a regular file owned by the
+         *         effective user with no group or other permissions
+         */
+        Status open(const std::string& name, size_t capacity, size_t slotSize, double ttl);
+
+        bool isOpen() const { return segment != NULL; }
+
+        /**
+         * \param key made with getKey()
+         * \return true (and sets \c info, without its token) if a fresh entry for the key was found
+         */
+        bool find(const CacheKey& key, KeystoneUserInfo& info) const;
+
+        /**
+         * Adds or replaces the entry of the key, with the record of the userinfo without its
+         * token. Does nothing if the record does not fit in a slot or all candidate slots are
+         * being written.
+         * \param key made with getKey()
+         */
+        void insert(const CacheKey& key, const KeystoneUserInfo& info);
+
+        /**
+         * Like insert(), with the expiry given in monotonicNanoseconds().
+         */
+        void insert(const CacheKey& key, const KeystoneUserInfo& info, int64_t expiresAt);
+
+        /**
+         * Appends every entry that has not expired to \c entries.
+         */
+        void collect(std::vector<CachedUserInfo>& entries) const;
+
+        /**
+         * Invalidates every entry, for all processes.
+         */
+        void clear();
+
+        /**
+         * Invalidates the entries \c match returns true for, for all processes, reading
+         * every slot.
+         * \return the number of entries invalidated
+         */
+        size_t eraseIf(const CacheEntryMatch& match);
+
+        /**
+         * The SipKey that the cache keys of this segment must be made with.
+         */
+        const SipKey& getKey() const { return key; }
+
+        const std::string& getName() const { return name; }
+        size_t getCapacity() const;
+        size_t getSlotSize() const;
+        double getTtl() const { return double(ttlNanoseconds) / 1e9; }
+
+    private:
+        SharedCache(const SharedCache&);
+        SharedCache& operator=(const SharedCache&);
+
+        struct Header;
+        struct Slot;
+
+        void close();
+        Slot* slot(size_t index) const;
+
+        /**
+         * Copies a slot with the seqlock protocol.
+         * \return false if the slot is unused, busy or holds no valid record
+         */
+        bool read(Slot* slot, CacheKey& key, int64_t& expiresAt, uint64_t& generation, KeystoneUserInfo& info) const;
+
+        std::string name;
+        SipKey key;
+        int64_t ttlNanoseconds;
+        void* segment;
+        size_t segmentSize;
+        Header* header;
+    };
+}}
@@ -0,0 +1,59 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "keystone/keystone_export.h"
+#include "keystone/impl/Error.hpp"
+#include "keystone/impl/RequestTiming.hpp"
+
+namespace keystone { namespace impl { namespace soap {
+
+    /**
+     * Builds the SOAP envelopes sent to the authentication manager and parses
+     * its responses. Kept apart from the transport so that both impl::Keystone
+     * and the header-only direct API can share it.
+     *
+     * The parse functions parse the response in place, its content is
+     * destroyed in the process.
+     *
+     * The parse functions return an ERROR_PARSE status if a response does not
+     * have the expected structure.
+     */
+
+    KEYSTONE_EXPORT void buildGetSessionTokenRequest(const std::string& username,
+        const std::string& password,
+        const std::string& tenantName,
+        std::string& request);
+
+    KEYSTONE_EXPORT void buildGetUsernameRequest(const std::string& sessionToken, std::string& request);
+
+    KEYSTONE_EXPORT void buildGetRolesRequest(const std::string& sessionToken, std::string& request);
+
+    /**
+     * \return true if the response carries a SOAP Fault (which is how the
+     *         authentication manager rejects credentials and tokens).
+     */
+    KEYSTONE_EXPORT bool isFault(const std::string& response);
+
+    /**
+     * \return true if the response carries a SOAP Fault that rejects the request
+     *         rather than reporting a failure of the service (eg. its database
+     *         being down): a Client (SOAP 1.1) or Sender (SOAP 1.2) fault code, or
+     *         a fault string such as "invalid token" or "bad authorization".
+     */
+    KEYSTONE_EXPORT bool isRejectionFault(const std::string& response);
+
+    /**
+     * Turns an ERROR_HTTP status of a call into ERROR_INVALID_CREDENTIALS
+     * (login) or ERROR_INVALID_TOKEN (the other calls) if the reply shows
+     * that the service rejected the request: 401/403, or a rejecting SOAP Fault
+     * (HTTP 500, see isRejectionFault). Other faults stay ERROR_HTTP, so tokens
+     * are not taken for invalid (and negatively cached) while the service fails.
+     */
+    KEYSTONE_EXPORT Status classifyFailure(Operation operation, const Status& status, const std::string& response);
+
+    KEYSTONE_EXPORT Status parseGetSessionTokenResponse(std::string& response, std::string& sessionToken);
+
+    KEYSTONE_EXPORT Status parseGetUsernameResponse(std::string& response, std::string& username);
+
+    KEYSTONE_EXPORT Status parseGetRolesResponse(std::string& response, std::vector<std::string>& roles);
+}}}
@@ -0,0 +1,45 @@
+#pragma once
+#include <mutex>
+#include <stdint.h>
+#include "keystone/keystone_export.h"
+
+namespace keystone { namespace impl {
+
+    /**
+     * Spaces out requests to at most \c rate per second on average, allowing
+     * bursts of up to \c burst requests after idle periods.
+     *
+     * A caller that finds the bucket empty takes a token anyway (the count goes
+     * negative) and sleeps until it would have been refilled, so waiting callers
+     * are served in the order they arrived and hold no lock while they sleep.
+     *
+     * All operations are thread safe.
+     */
+    class KEYSTONE_EXPORT TokenBucket {
+    public:
+        /**
+         * \param rate the requests per second, 0 for no limit
+         * \param burst the requests allowed at once (at least 1)
+         */
+        TokenBucket(double rate, double burst);
+
+        /**
+         * Takes a token, waiting for it if needed.
+         */
+        void acquire();
+
+        double getRate() const { return rate; }
+
+    private:
+        TokenBucket(const TokenBucket&);
+        TokenBucket& operator=(const TokenBucket&);
+
+        const double rate;
+        const double burst;
+
+        std::mutex mutex;
+        double tokens;
+        // In monotonicNanoseconds().
+        int64_t updatedAt;
+    };
+}}
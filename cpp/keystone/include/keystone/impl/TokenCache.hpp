@@ -0,0 +1,215 @@
+#pragma once
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include "keystone/keystone_export.h"
+#include "keystone/impl/KeystoneUserInfo.hpp"
+#include "keystone/impl/CachedUserInfo.hpp"
+#include "keystone/impl/FrequencySketch.hpp"
+#include "keystone/impl/Hash.hpp"
+
+namespace keystone { namespace impl {
+
+    /**
+     * Caches the userinfo of session tokens, by their CacheKey. The tokens
+     * themselves are not kept.
+     *
+     * The cache is split in shards by the high half of the key. Each
+     * shard is a fixed size table of singly linked buckets. Lookups take no
+     * lock and write nothing shared (except the reference count of the userinfo
+     * they return, and with a memory limit the frequency sketch of their shard
+     * on one in eight lookups of a thread): they pin an epoch (see EpochDomain)
+     * and walk the bucket.
+     * Inserts lock their shard, link in a new entry and retire the entries they
+     * replace or evict, which are freed once no reader can see them.
+     *
+     * Entries expire \c ttl seconds after they were inserted. A full shard
+     * makes room by evicting the next bucket of a rotating cursor.
+     *
+     * With a memory limit (see setMemoryLimit) the shards also count the bytes
+     * of their entries, and evict with W-TinyLFU instead: new entries go into
+     * a small FIFO window (1% of the bytes of the shard), and an entry leaving
+     * the window only stays if a FrequencySketch of the recent inserts and of a
+     * sample of the recent lookups says it is used more often than the least
+     * used of a few sampled older entries.
+     * A burst of one-off tokens thus only churns the window.
+     *
+     * Optionally a small direct mapped table per thread (see setLocalCache)
+     * sits in front of the shards, so that steady state hits touch only memory
+     * of the calling core.
+     */
+    class KEYSTONE_EXPORT TokenCache {
+    public:
+        /**
+         * \param capacity the maximum number of entries (at least one per shard is kept)
+         * \param ttl how long (in seconds) an entry is used
+         * \param shardCount the number of shards (rounded up to a power of two), 0 picks one from
+         *                   the number of cores
+         */
+        TokenCache(size_t capacity, double ttl, size_t shardCount = 0);
+
+        /**
+         * Must not be called while other threads use the cache.
+         */
+        ~TokenCache();
+
+        /**
+         * \return true (and sets \c info, without its token) if a fresh entry for the key was found
+         */
+        bool find(const CacheKey& key, KeystoneUserInfo& info) const;
+
+        /**
+         * Adds or replaces the entry of the key. The userinfo is kept without its token.
+         */
+        void insert(const CacheKey& key, const KeystoneUserInfo& info);
+
+        /**
+         * Like insert(), with the expiry given in monotonicNanoseconds().
+         */
+        void insert(const CacheKey& key, const KeystoneUserInfo& info, int64_t expiresAt);
+
+        /**
+         * Appends every entry that has not expired to \c entries.
+         */
+        void collect(std::vector<CachedUserInfo>& entries) const;
+
+        /**
+         * Removes every entry, including those in the per-thread tables.
+         */
+        void clear();
+
+        /**
+         * Removes the entries \c match returns true for, walking all of them, and drops
+         * the per-thread tables if any was removed.
+         * \return the number of entries removed
+         */
+        size_t eraseIf(const CacheEntryMatch& match);
+
+        /**
+         * Puts a per-thread table of \c entries (rounded up to a power of two) in front of
+         * the shards. Hits in it use no atomics shared with other threads: the table holds
+         * a private copy of each userinfo. An entry is used for at most \c maxStaleness
+         * seconds after it was copied (and never past its expiry), and clear() drops all of
+         * them through an invalidation counter that the threads check on every hit.
+         * 0 entries turns the tables off (the default).
+         * Must not be called while other threads use the cache.
+         */
+        void setLocalCache(size_t entries, double maxStaleness);
+
+        /**
+         * Keeps the bytes of the entries (the entry and its userinfo allocation) below
+         * \c bytes, evicting with W-TinyLFU. The bucket tables and frequency sketches
+         * (about 8 bytes per 128 bytes of the limit) come on top. The entry count limit
+         * still applies. 0 turns the limit off (the default).
+         * Must not be called while other threads use the cache.
+         */
+        void setMemoryLimit(size_t bytes);
+
+        size_t getCapacity() const { return capacity; }
+        double getTtl() const { return ttl; }
+        size_t getShardCount() const { return shardCount; }
+        size_t getLocalCacheEntries() const { return localEntries; }
+        size_t getMemoryLimit() const { return memoryLimit; }
+        size_t size() const;
+
+        /**
+         * The bytes of the entries, as counted against the memory limit.
+         */
+        size_t getMemoryBytes() const;
+
+    private:
+        TokenCache(const TokenCache&);
+        TokenCache& operator=(const TokenCache&);
+
+        struct Entry {
+            Entry(const CacheKey& key, int64_t expiresAt, const KeystoneUserInfo& info)
+                : key(key), expiresAt(expiresAt), info(info), bytes(sizeof(Entry) + info.getMemoryBytes()),
+                  inWindow(false), next(NULL) {}
+
+            const CacheKey key;
+            const int64_t expiresAt;
+            const KeystoneUserInfo info;
+            const size_t bytes;
+            // Only used by writers, under the shard mutex.
+            bool inWindow;
+            std::atomic<Entry*> next;
+        };
+
+        struct Shard {
+            Shard() : size(0), cursor(0), bytes(0), windowBytes(0), random(0) {}
+
+            // Set up in the constructor (and setMemoryLimit), read-only afterwards.
+            std::unique_ptr<std::atomic<Entry*>[]> buckets;
+            std::unique_ptr<FrequencySketch> sketch;
+            // Everything below is only used by writers, under the mutex.
+            std::mutex mutex;
+            size_t size;
+            size_t cursor;
+            size_t bytes;
+            size_t windowBytes;
+            // The keys of the window entries, oldest first.
+            std::deque<CacheKey> window;
+            uint64_t random;
+            // Keeps the writer state of neighbouring shards off each other's cache lines.
+            char padding[64];
+        };
+
+        static void deleteEntry(void* entry);
+
+        static void retireChain(Entry* chain);
+
+        Shard& shardOf(const CacheKey& key) const;
+        std::atomic<Entry*>& bucketOf(Shard& shard, const CacheKey& key) const;
+
+        /**
+         * Unlinks the next non-empty bucket of the shard (which must not be empty).
+         * \return the unlinked entries, to be retired once the shard is unlocked
+         */
+        Entry* evictBucket(Shard& shard);
+
+        /**
+         * Evicts with W-TinyLFU until the shard is within its limits.
+         * \param evicted receives the unlinked entries, to be retired once the shard is unlocked
+         */
+        void makeRoom(Shard& shard, std::vector<Entry*>& evicted);
+
+        /**
+         * Moves the oldest window entry to the main part of the shard.
+         * \return the entry, NULL if the window is empty
+         */
+        Entry* popWindow(Shard& shard);
+
+        /**
+         * The least frequently used (or an expired) one of a few main entries from a
+         * random bucket on, other than \c exclude. NULL if there is none.
+         */
+        Entry* sampleVictim(Shard& shard, int64_t now, const Entry* exclude);
+
+        void unlink(Shard& shard, Entry* entry);
+
+        const size_t capacity;
+        const double ttl;
+        int64_t ttlNanoseconds;
+        size_t shardCount;
+        size_t shardCapacity;
+        size_t bucketCount;
+        std::unique_ptr<Shard[]> shards;
+
+        size_t memoryLimit;
+        size_t shardByteBudget;
+        size_t shardWindowBudget;
+
+        // Identifies the per-thread tables of this cache (and of its current local cache size).
+        uint64_t localId;
+        size_t localEntries;
+        int64_t localStalenessNanoseconds;
+        // Bumped by clear(), which invalidates every per-thread entry.
+        std::atomic<uint64_t> invalidations;
+    };
+}}
@@ -0,0 +1,89 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "keystone/keystone_export.h"
+
+namespace keystone { namespace impl {
+
+    /**
+     * Checks the syntax of a session token before it is sent anywhere, so that
+     * junk is rejected without a round trip to the service.
+     *
+     * The charset check runs 16 bytes at a time with SSE2 where available and
+     * falls back to a lookup table otherwise.
+     */
+    class KEYSTONE_EXPORT TokenFormat {
+    public:
+        /**
+         * The values match keystone_token_charset_t in the C-interface.
+         */
+        enum Charset {
+            /**
+             * Printable ASCII except the XML special characters <>&'"
+             * (the token is put verbatim in the SOAP envelope).
+             */
+            CHARSET_ANY = 0,
+
+            /**
+             * 0-9, a-f and A-F.
+             */
+            CHARSET_HEX = 1,
+
+            /**
+             * 32 hex digits, or 36 characters in the canonical 8-4-4-4-12 form.
+             */
+            CHARSET_UUID = 2,
+
+            /**
+             * The URL-safe base64 alphabet (A-Z, a-z, 0-9, - and _) with = padding, as used by Fernet tokens.
+             */
+            CHARSET_BASE64URL = 3,
+
+            CHARSET_COUNT = 4
+        };
+
+        static const size_t DEFAULT_MAX_LENGTH = 16384;
+
+        /**
+         * Accepts 1 to DEFAULT_MAX_LENGTH characters of CHARSET_ANY.
+         */
+        TokenFormat();
+
+        /**
+         * \param minLength the shortest accepted token, at least 1
+         * \param maxLength the longest accepted token
+         */
+        TokenFormat(Charset charset, size_t minLength, size_t maxLength);
+
+        bool isValid(const char* token, size_t length) const;
+
+        Charset getCharset() const { return charset; }
+        size_t getMinLength() const { return minLength; }
+        size_t getMaxLength() const { return maxLength; }
+
+    private:
+        /**
+         * A charset as up to MAX_RANGES inclusive byte ranges, less up to
+         * MAX_EXCLUDED single bytes.
+         */
+        static const size_t MAX_RANGES = 6;
+        static const size_t MAX_EXCLUDED = 5;
+
+        struct Ranges {
+            size_t rangeCount;
+            uint8_t low[MAX_RANGES];
+            uint8_t high[MAX_RANGES];
+            size_t excludedCount;
+            uint8_t excluded[MAX_EXCLUDED];
+        };
+
+        void setup();
+        bool allInCharset(const uint8_t* data, size_t length) const;
+
+        Charset charset;
+        size_t minLength;
+        size_t maxLength;
+        Ranges ranges;
+        bool table[256];
+    };
+}}
@@ -43,6 +43,223 @@ struct keystone_userinfo_struct;
  */
 typedef struct keystone_userinfo_struct keystone_userinfo_t;
 
+/**
+ * A compiled role policy, see \ref keystone_policy_compile.
+ * \note We do not expose the structure of this struct, all data must be obtained from the getter methods.
+ */
+struct keystone_policy_struct;
+
+/**
+ * A compiled role policy, see \ref keystone_policy_compile.
+ * \note We do not expose the structure of this struct, all data must be obtained from the getter methods.
+ */
+typedef struct keystone_policy_struct keystone_policy_t;
+
+/**
+ * Identifies a role interned with \ref keystone_role_intern.
+ * \note Role ids are only valid within the process that interned them.
+ */
+typedef unsigned int keystone_role_id_t;
+
+/**
+ * The calls made to the keystone service. \ref keystone_login makes a \ref KEYSTONE_OPERATION_LOGIN and a
+ * \ref KEYSTONE_OPERATION_GET_ROLES call, \ref keystone_get_userinfo_from_token makes a
+ * \ref KEYSTONE_OPERATION_GET_USERNAME and a \ref KEYSTONE_OPERATION_GET_ROLES call.
+ */
+typedef enum {
+    /**
+     * Getting a session token from username and password
+     */
+    KEYSTONE_OPERATION_LOGIN = 0,
+
+    /**
+     * Getting the username of a session token
+     */
+    KEYSTONE_OPERATION_GET_USERNAME = 1,
+
+    /**
+     * Getting the roles of a session token
+     */
+    KEYSTONE_OPERATION_GET_ROLES = 2
+} keystone_operation_t;
+
+/**
+ * Where the time of one call to the keystone service went, see \ref keystone_userinfo_get_timings.
+ * All times are in seconds.
+ */
+typedef struct {
+    /**
+     * The call this record is about
+     */
+    keystone_operation_t operation;
+
+    /**
+     * From the start until the name was resolved (CURLINFO_NAMELOOKUP_TIME)
+     */
+    double name_lookup;
+
+    /**
+     * From the start until the connection to the server was established (CURLINFO_CONNECT_TIME)
+     */
+    double connect;
+
+    /**
+     * From the start until the TLS handshake was done (CURLINFO_APPCONNECT_TIME), 0 for plain http
+     */
+    double app_connect;
+
+    /**
+     * From the start until the first byte of the reply was received (CURLINFO_STARTTRANSFER_TIME)
+     */
+    double start_transfer;
+
+    /**
+     * The total time of the transfer (CURLINFO_TOTAL_TIME)
+     */
+    double total;
+
+    /**
+     * The time spent building the request envelope
+     */
+    double envelope_build;
+
+    /**
+     * The time spent parsing the reply
+     */
+    double parse;
+} keystone_timing_t;
+
+/**
+ * A snapshot of the library-wide metrics, see \ref keystone_get_stats.
+ * \note We do not expose the structure of this struct, all data must be obtained from the getter methods.
+ */
+struct keystone_stats_struct;
+
+/**
+ * A snapshot of the library-wide metrics, see \ref keystone_get_stats.
+ * \note We do not expose the structure of this struct, all data must be obtained from the getter methods.
+ */
+typedef struct keystone_stats_struct keystone_stats_t;
+
+/**
+ * Revoked tokens and users, filled by a \ref keystone_revocation_source_t.
+ * \note We do not expose the structure of this struct, it is filled with \ref keystone_revocation_list_add_token
+ *       and \ref keystone_revocation_list_add_user.
+ */
+struct keystone_revocation_list_struct;
+
+/**
+ * Revoked tokens and users, filled by a \ref keystone_revocation_source_t.
+ * \note We do not expose the structure of this struct, it is filled with \ref keystone_revocation_list_add_token
+ *       and \ref keystone_revocation_list_add_user.
+ */
+typedef struct keystone_revocation_list_struct keystone_revocation_list_t;
+
+/**
+ * The counters kept per operation, see \ref keystone_stats_get_counter.
+ */
+typedef enum {
+    /**
+     * Calls made to the keystone service
+     */
+    KEYSTONE_COUNTER_REQUESTS = 0,
+
+    /**
+     * Calls that failed (for any reason)
+     */
+    KEYSTONE_COUNTER_ERRORS = 1,
+
+    /**
+     * Bytes sent, headers included
+     */
+    KEYSTONE_COUNTER_BYTES_SENT = 2,
+
+    /**
+     * Bytes received, headers included
+     */
+    KEYSTONE_COUNTER_BYTES_RECEIVED = 3,
+
+    /**
+     * New connections opened to the server
+     */
+    KEYSTONE_COUNTER_CONNECTIONS_OPENED = 4,
+
+    /**
+     * Calls made over an already open connection
+     */
+    KEYSTONE_COUNTER_CONNECTIONS_REUSED = 5,
+
+    /**
+     * TLS handshakes performed
+     */
+    KEYSTONE_COUNTER_TLS_HANDSHAKES = 6,
+
+    /**
+     * Calls answered from a cache instead of the server
+     */
+    KEYSTONE_COUNTER_CACHE_HITS = 7,
+
+    /**
+     * Cache lookups that had to go to the server
+     */
+    KEYSTONE_COUNTER_CACHE_MISSES = 8,
+
+    /**
+     * Calls in progress when the snapshot was taken
+     */
+    KEYSTONE_COUNTER_IN_FLIGHT = 9,
+
+    /**
+     * Calls refused without contacting the service (eg. malformed tokens, see \ref keystone_set_token_format)
+     */
+    KEYSTONE_COUNTER_REJECTED_LOCALLY = 10
+} keystone_counter_t;
+
+/**
+ * The characters a session token may consist of, see \ref keystone_set_token_format.
+ */
+typedef enum {
+    /**
+     * Printable ASCII except the XML special characters <>&'" (the default)
+     */
+    KEYSTONE_TOKEN_CHARSET_ANY = 0,
+
+    /**
+     * Hex digits (0-9, a-f, A-F)
+     */
+    KEYSTONE_TOKEN_CHARSET_HEX = 1,
+
+    /**
+     * A UUID: 32 hex digits, or 36 characters in the canonical 8-4-4-4-12 form
+     */
+    KEYSTONE_TOKEN_CHARSET_UUID = 2,
+
+    /**
+     * The URL-safe base64 alphabet (A-Z, a-z, 0-9, - and _) with = padding, as used by Fernet tokens
+     */
+    KEYSTONE_TOKEN_CHARSET_BASE64URL = 3
+} keystone_token_charset_t;
+
+/**
+ * Whether a handle uses HTTP/2, see \ref keystone_set_http2.
+ */
+typedef enum {
+    /**
+     * Each call runs its own transfer, with the HTTP version libcurl picks (the default)
+     */
+    KEYSTONE_HTTP2_OFF = 0,
+
+    /**
+     * HTTP/2 if the server picks it during the TLS handshake (ALPN), HTTP/1.1 otherwise and over cleartext
+     */
+    KEYSTONE_HTTP2_NEGOTIATE = 1,
+
+    /**
+     * HTTP/2 without negotiation, also over cleartext (h2c), for servers known to speak it
+     */
+    KEYSTONE_HTTP2_PRIOR_KNOWLEDGE = 2
+} keystone_http2_t;
+
 /**
  *! \public
  * The error values returned by keystone functions
@@ -56,8 +273,136 @@ typedef enum {
     /**
      * Returned when cause of error is unknown
      */
-    KEYSTONE_UNKNOWN_ERROR  
+    KEYSTONE_UNKNOWN_ERROR = 1,
+
+    /**
+     * The service rejected the username, password or tenant of a login
+     */
+    KEYSTONE_INVALID_CREDENTIALS = 2,
+
+    /**
+     * The service rejected the session token (unknown, expired or malformed)
+     */
+    KEYSTONE_INVALID_TOKEN = 3,
+
+    /**
+     * The service replied with an unexpected HTTP status, see \ref keystone_error_detail_t::http_status
+     */
+    KEYSTONE_HTTP_ERROR = 4,
+
+    /**
+     * The call to the service timed out
+     */
+    KEYSTONE_TIMEOUT = 5,
+
+    /**
+     * The service could not be reached (name resolution, connect, TLS or a dropped connection)
+     */
+    KEYSTONE_CONNECTION_ERROR = 6,
+
+    /**
+     * The reply of the service could not be understood
+     */
+    KEYSTONE_PARSE_ERROR = 7,
+
+    /**
+     * The service is overloaded (HTTP 429 or 503), or the library refused to call it; retry later
+     */
+    KEYSTONE_OVERLOADED = 8,
+
+    /**
+     * An argument was invalid (eg. a buffer too small, an index out of range or a malformed policy)
+     */
+    KEYSTONE_INVALID_ARGUMENT = 9
 } keystone_error_t;
+
+/**
+ * Details of the last failed call, see \ref keystone_last_error_detail.
+ */
+typedef struct {
+    /**
+     * The error the call returned
+     */
+    keystone_error_t code;
+
+    /**
+     * The HTTP status of the reply, 0 if there was none
+     */
+    long http_status;
+
+    /**
+     * The libcurl error code (CURLcode) of the transfer, 0 if there was none
+     */
+    int transport_code;
+
+    /**
+     * A null terminated, human readable description. Owned by the library and valid
+     * until the next failing call on the same thread.
+     */
+    const char* message;
+} keystone_error_detail_t;
+
+/**
+ * What a hook is told about a call, see \ref keystone_hooks_t.
+ */
+typedef struct {
+    /**
+     * The call the event is about
+     */
+    keystone_operation_t operation;
+
+    /**
+     * The duration of the call (or cache lookup) in seconds, 0 for \ref keystone_hooks_t::on_request_start
+     */
+    double duration;
+
+    /**
+     * \ref KEYSTONE_SUCCESS, or the error the call failed with
+     */
+    keystone_error_t outcome;
+} keystone_event_t;
+
+/**
+ * A hook, see \ref keystone_hooks_t.
+ */
+typedef void (*keystone_hook_t)(void* user_data, const keystone_event_t* event);
+
+/**
+ * A source of revocations, see \ref keystone_set_revocation_callback. It adds every revocation still in effect
+ * to list and returns \ref KEYSTONE_SUCCESS, or another error if it could not get them.
+ */
+typedef keystone_error_t (*keystone_revocation_source_t)(void* user_data, keystone_revocation_list_t* list);
+
+/**
+ * Callbacks fired around the calls made to the keystone service, set with \ref keystone_set_hooks.
+ * Any of the callbacks may be NULL. The callbacks are called on the thread making the call and must not call back into the library.
+ */
+typedef struct {
+    /**
+     * Passed unchanged to every callback
+     */
+    void* user_data;
+
+    /**
+     * Fired before a call is made
+     */
+    keystone_hook_t on_request_start;
+
+    /**
+     * Fired when a call is done, successful or not
+     */
+    keystone_hook_t on_request_end;
+
+    /**
+     * Fired when a call was answered from a cache
+     */
+    keystone_hook_t on_cache_hit;
+
+    /**
+     * Fired when a cache lookup had to go to the server
+     */
+    keystone_hook_t on_cache_miss;
+} keystone_hooks_t;
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -166,6 +511,47 @@ extern "C" {
      */
     KEYSTONE_EXPORT keystone_error_t keystone_login(keystone_data_t* handle, const char* username, const char* password, const char* tenant_name, keystone_userinfo_t** userinfo);
 
+    /**
+     * \example keystone_session_login_example
+     * \code{.c}
+     * // assume keystone_handle is initialized, keep sessions for an hour and renew them after 45 minutes:
+     * keystone_set_session_cache(keystone_handle, 16, 3600.0, 2700.0);
+     *
+     * // before every job:
+     * keystone_userinfo_t* userinfo_handle;
+     * if (keystone_session_login(keystone_handle, "service", "password", "tenant_name", &userinfo_handle) != KEYSTONE_SUCCESS) {
+     *     // Something went wrong
+     * }
+     * // use the token of userinfo_handle, then free it as usual:
+     * keystone_userinfo_free(userinfo_handle);
+     * \endcode
+     */
+
+    /**
+     * \ingroup keystone
+     *
+     * Like \ref keystone_login, but hands out the session (the token and roles) of an earlier call with the same
+     * username, password and tenant name while it lasts, see \ref keystone_set_session_cache. Concurrent calls
+     * for the same account share one login. Without a session cache this is \ref keystone_login.
+     *
+     * The session token is shared by all callers of the account, so it must not be logged out by any of them.
+     *
+     * \param[in] handle a handle initialized with \ref keystone_init
+     *
+     * \param[in] username the username
+     *
+     * \param[in] password the password
+     *
+     * \param[in] tenant_name the tenant name
+     *
+     * \param[out] userinfo a pointer to a pointer to a userinfo. At the end of a successful run, this will contain
+     *                      a userinfo handle that must be freed with \ref keystone_userinfo_free.
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, \ref KEYSTONE_INVALID_CREDENTIALS if the login was rejected,
+     *         something else otherwise.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_session_login(keystone_data_t* handle, const char* username, const char* password, const char* tenant_name, keystone_userinfo_t** userinfo);
+
 
 
     /**
@@ -182,6 +568,23 @@ extern "C" {
     KEYSTONE_EXPORT keystone_error_t keystone_userinfo_free(keystone_userinfo_t* handle);
 
 
+    /**
+     * \ingroup keystone
+     *
+     * Makes a copy of a userinfo handle. The user information itself is immutable and shared
+     * (reference counted) between the copies, so this does not copy any strings.
+     *
+     * \param[in] handle a pointer to a valid userinfo handle obtained from either \ref keystone_login or \ref keystone_get_userinfo_from_token.
+     *
+     * \param[out] copy at end of execution, will contain a new userinfo handle with the same content.
+     *
+     * \return \ref KEYSTONE_SUCCESS if everything went OK, something else otherwise.
+     *
+     * \note The copy must be freed with \ref keystone_userinfo_free, independently of the original.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_userinfo_copy(const keystone_userinfo_t* handle, keystone_userinfo_t** copy);
+
+
     /**
     * \example get_userinfo_from_token_example
     * \code{.c}
@@ -208,43 +611,640 @@ extern "C" {
 
     /**
      * \ingroup keystone
-     * Gets the userinfo from a token. This is typically used to authenticate a user. 
-     * From the userinfo one can get the [username](\ref keystone_userinfo_get_username) and 
-     * [roles](\ref keystone_userinfo_get_role).
-     * 
-     * \sa keystone_userinfo_free
-     * \sa keystone_userinfo_get_username
-     * \sa keystone_userinfo_get_token
-     * \sa keystone_userinfo_get_role_count
-     * \sa keystone_userinfo_get_role
-     * 
-     * \param[in] handle a valid handle to keystone (obtained by \ref keystone_init).
-     * 
-     * \param[in] tenant_name a null terminated string containing the tenant_name
+     * Gets the userinfo from a token. This is typically used to authenticate a user. 
+     * From the userinfo one can get the [username](\ref keystone_userinfo_get_username) and 
+     * [roles](\ref keystone_userinfo_get_role).
+     * 
+     * \sa keystone_userinfo_free
+     * \sa keystone_userinfo_get_username
+     * \sa keystone_userinfo_get_token
+     * \sa keystone_userinfo_get_role_count
+     * \sa keystone_userinfo_get_role
+     * 
+     * \param[in] handle a valid handle to keystone (obtained by \ref keystone_init).
+     * 
+     * \param[in] tenant_name a null terminated string containing the tenant_name
+     *
+     * \param[in] session_token a null terminated string containing the session_token
+     *
+     * \param[out] userinfo at end of execution, will contain a valid handle to a userinfo object. 
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise. 
+     *
+     * \note All userinfo_objects must be freed with \ref keystone_userinfo_free
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_get_userinfo_from_token(keystone_data_t* handle, const char* tenant_name, const char* session_token, keystone_userinfo_t** userinfo);
+
+
+    /**
+     * \ingroup keystone
+     * Set the path to the file containing the certificates from the Certificate Authorities (CA). This might be required for accessing
+     * keystone servers behind https protocols.
+     *
+     * \param[in] handle a valid handle to keystone (obtained by \ref keystone_init).
+     *
+     * \param[in] cert_file_name a null terminated string containing the path and file name of the CA bundle.
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise.
+     *
+     * \note Must not be called while other threads are using the handle.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_set_ca_certificate_filename(keystone_data_t* handle, const char* cert_file_name);
+
+    /**
+     * \example keystone_set_http2_example
+     * \code{.c}
+     * // Many threads validate tokens with this handle:
+     * if (keystone_set_http2(handle, KEYSTONE_HTTP2_NEGOTIATE, 100) != KEYSTONE_SUCCESS) {
+     *     // Something went wrong (eg. libcurl has no HTTP/2 support), HTTP/1.1 is used
+     * }
+     * \endcode
+     */
+
+    /**
+     * \ingroup keystone
+     *
+     * Makes the handle multiplex its concurrent calls to the keystone service as HTTP/2 streams of one
+     * connection, instead of opening a connection per call in flight. The calls of all threads are then
+     * driven by one thread of the handle. If the server turns HTTP/2 down, the calls fall back to
+     * HTTP/1.1 connections.
+     *
+     * \param[in] handle a handle initialized with \ref keystone_init
+     *
+     * \param[in] mode how HTTP/2 is used, \ref KEYSTONE_HTTP2_OFF to go back to a transfer per call
+     *
+     * \param[in] max_streams the most streams in flight on a connection, 0 to leave it to the server. Calls beyond
+     *                        it wait for a stream, or open another connection if the server allows fewer streams.
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, \ref KEYSTONE_INVALID_ARGUMENT if libcurl was built without
+     *         HTTP/2 support (or is older than 7.68, or is 7.88 and \c mode is
+     *         \ref KEYSTONE_HTTP2_PRIOR_KNOWLEDGE), something else otherwise.
+     *
+     * \note Must not be called while other threads are using the handle.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_set_http2(keystone_data_t* handle, keystone_http2_t mode, unsigned max_streams);
+
+    /**
+     * \example keystone_set_hooks_example
+     * \code{.c}
+     * void on_request_end(void* user_data, const keystone_event_t* event) {
+     *     if (event->outcome != KEYSTONE_SUCCESS) {
+     *         fprintf(stderr, "call %d failed after %f s\n", event->operation, event->duration);
+     *     }
+     * }
+     *
+     * // assume handle is initialized.
+     * keystone_hooks_t hooks;
+     * memset(&hooks, 0, sizeof(hooks));
+     * hooks.on_request_end = on_request_end;
+     * if (keystone_set_hooks(handle, &hooks) != KEYSTONE_SUCCESS) {
+     *     // Something went wrong
+     * }
+     * \endcode
+     */
+
+    /**
+     * \ingroup keystone
+     *
+     * Sets the callbacks fired around the calls made through the handle, replacing any previous ones.
+     * Callbacks that are NULL cost nothing but a null check.
+     *
+     * \param[in] handle a handle initialized with \ref keystone_init
+     *
+     * \param[in] hooks the callbacks to use (copied), or NULL to remove all callbacks.
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise.
+     *
+     * \note Must not be called while other threads are using the handle.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_set_hooks(keystone_data_t* handle, const keystone_hooks_t* hooks);
+
+    /**
+     * \example keystone_last_error_detail_example
+     * \code{.c}
+     * // assume handle is initialized.
+     * keystone_userinfo_t* userinfo_handle;
+     * keystone_error_t error = keystone_get_userinfo_from_token(handle, "tenant", token, &userinfo_handle);
+     * if (error == KEYSTONE_INVALID_TOKEN) {
+     *     // Reject the request, no point in retrying
+     * }
+     * else if (error != KEYSTONE_SUCCESS) {
+     *     keystone_error_detail_t detail;
+     *     keystone_last_error_detail(&detail);
+     *     fprintf(stderr, "keystone error %d (http status %ld): %s\n", detail.code, detail.http_status, detail.message);
+     * }
+     * \endcode
+     */
+
+    /**
+     * \ingroup keystone
+     *
+     * Gets the details of the last call that failed on the calling thread. Calls that succeed do not change it.
+     *
+     * \param[out] detail will at the end of execution contain the details. If no call has failed on
+     *             this thread, the code is \ref KEYSTONE_SUCCESS and the message is empty.
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_last_error_detail(keystone_error_detail_t* detail);
+
+    /**
+     * \example keystone_set_token_format_example
+     * \code{.c}
+     * // assume handle is initialized. Our tokens are Fernet tokens:
+     * if (keystone_set_token_format(handle, KEYSTONE_TOKEN_CHARSET_BASE64URL, 180, 255) != KEYSTONE_SUCCESS) {
+     *     // Something went wrong
+     * }
+     * \endcode
+     */
+
+    /**
+     * \ingroup keystone
+     *
+     * Sets the syntax session tokens must have. \ref keystone_get_userinfo_from_token checks the token against it
+     * before any I/O and returns \ref KEYSTONE_INVALID_TOKEN if it does not match.
+     *
+     * By default tokens of 1 to 16384 characters of \ref KEYSTONE_TOKEN_CHARSET_ANY are accepted.
+     *
+     * \param[in] handle a handle initialized with \ref keystone_init
+     *
+     * \param[in] charset the characters the token may consist of
+     *
+     * \param[in] min_length the shortest accepted token (0 is treated as 1)
+     *
+     * \param[in] max_length the longest accepted token
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise.
+     *
+     * \note Must not be called while other threads are using the handle.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_set_token_format(keystone_data_t* handle, keystone_token_charset_t charset, size_t min_length, size_t max_length);
+
+    /**
+     * \example keystone_set_negative_cache_example
+     * \code{.c}
+     * // assume handle is initialized. Turn away tokens rejected within the last 5 minutes,
+     * // expecting no more than 100000 of them (about 300 kB):
+     * if (keystone_set_negative_cache(handle, 100000, 300.0) != KEYSTONE_SUCCESS) {
+     *     // Something went wrong
+     * }
+     * \endcode
+     */
+
+    /**
+     * \ingroup keystone
+     *
+     * Makes the handle remember the session tokens the service rejected, so that
+     * \ref keystone_get_userinfo_from_token returns \ref KEYSTONE_INVALID_TOKEN for them without any I/O
+     * (counted as \ref KEYSTONE_COUNTER_CACHE_HITS).
+     *
+     * The tokens are kept in a pair of Bloom filters of 24 bits per expected entry in total, which are
+     * rotated every ttl/2 seconds (or sooner if more tokens are rejected than expected). A token is therefore
+     * remembered for between ttl/2 and ttl seconds, and memory stays bounded however many tokens are rejected.
+     * Fewer than 1 in 10000 valid tokens may be rejected as a false positive while the cache holds tokens.
+     *
+     * The cache is off by default.
+     *
+     * \param[in] handle a handle initialized with \ref keystone_init
+     *
+     * \param[in] expected_entries the number of rejected tokens expected per ttl, 0 turns the cache off
+     *
+     * \param[in] ttl how long (in seconds) a rejected token is remembered at most
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise.
+     *
+     * \note Must not be called while other threads are using the handle.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_set_negative_cache(keystone_data_t* handle, size_t expected_entries, double ttl);
+
+    /**
+     * \example keystone_set_token_cache_example
+     * \code{.c}
+     * // assume handle is initialized. Keep up to 100000 tokens for a minute:
+     * if (keystone_set_token_cache(handle, 100000, 60.0) != KEYSTONE_SUCCESS) {
+     *     // Something went wrong
+     * }
+     * \endcode
+     */
+
+    /**
+     * \ingroup keystone
+     *
+     * Makes the handle cache the userinfo of session tokens. \ref keystone_get_userinfo_from_token answers from the
+     * cache without any I/O (counted as \ref KEYSTONE_COUNTER_CACHE_HITS); \ref keystone_login and
+     * \ref keystone_get_userinfo_from_token fill it. The cache is keyed by a 128 bit SipHash of the tenant name
+     * and the token, under a key that is random per handle, so a token is only found again for the same tenant
+     * and the index of the cache holds no tokens.
+     *
+     * The cache is sharded by token hash and lookups take no locks, so cache hits scale with the number of
+     * threads sharing the handle. When the cache is full, some older entries are evicted to make room.
+     *
+     * The cache is off by default.
+     *
+     * \param[in] handle a handle initialized with \ref keystone_init
+     *
+     * \param[in] max_entries the maximum number of tokens cached, 0 turns the cache off
+     *
+     * \param[in] ttl how long (in seconds) an entry is used after it was fetched
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise.
+     *
+     * \note Must not be called while other threads are using the handle.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_set_token_cache(keystone_data_t* handle, size_t max_entries, double ttl);
+
+    /**
+     * \example keystone_set_token_cache_l1_example
+     * \code{.c}
+     * // assume handle is initialized. Give every thread 256 entries of its own, at most a second stale:
+     * if (keystone_set_token_cache(handle, 100000, 60.0) != KEYSTONE_SUCCESS ||
+     *     keystone_set_token_cache_l1(handle, 256, 1.0) != KEYSTONE_SUCCESS) {
+     *     // Something went wrong
+     * }
+     * \endcode
+     */
+
+    /**
+     * \ingroup keystone
+     *
+     * Puts a small per-thread cache (L1) in front of the token cache of \ref keystone_set_token_cache. Each thread
+     * calling \ref keystone_get_userinfo_from_token gets a table of its own holding private copies of the
+     * userinfos it looked up, so hits in it touch no memory shared with other threads. Meant for servers with
+     * a worker thread per core.
+     *
+     * An L1 entry is used for at most max_staleness seconds after it was copied from the token cache (and never
+     * after the token cache entry expires), so a token removed from the token cache may still be accepted by a
+     * thread for that long.
+     *
+     * The setting is kept if the token cache is set up again. The L1 is off by default.
+     *
+     * \param[in] handle a handle initialized with \ref keystone_init
+     *
+     * \param[in] entries the number of entries per thread (rounded up to a power of two), 0 turns the L1 off
+     *
+     * \param[in] max_staleness how long (in seconds) an entry is used at most
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise.
+     *
+     * \note Must not be called while other threads are using the handle.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_set_token_cache_l1(keystone_data_t* handle, size_t entries, double max_staleness);
+
+    /**
+     * \example keystone_set_token_cache_memory_limit_example
+     * \code{.c}
+     * // assume handle is initialized. Cache up to a million tokens, but in no more than 64 MB:
+     * if (keystone_set_token_cache(handle, 1000000, 300.0) != KEYSTONE_SUCCESS ||
+     *     keystone_set_token_cache_memory_limit(handle, 64 * 1024 * 1024) != KEYSTONE_SUCCESS) {
+     *     // Something went wrong
+     * }
+     * \endcode
+     */
+
+    /**
+     * \ingroup keystone
+     *
+     * Bounds the memory of the token cache of \ref keystone_set_token_cache by the bytes its entries actually use
+     * (the userinfo with its token, username and roles, plus the bookkeeping of each entry), on top of its limit on
+     * the number of entries.
+     *
+     * When the limit is set, the cache evicts with W-TinyLFU: new tokens first go into a small window, and only
+     * stay when they are looked up more often than the entries they would displace. A burst of tokens that are
+     * used only once (eg. a scan with made-up tokens) thus does not push out the sessions in active use. The
+     * lookup frequencies are tracked in a sketch of about 8 bytes per 128 bytes of the limit, which comes on top
+     * of the limit, as do the fixed hash tables of the cache.
+     *
+     * The setting is kept if the token cache is set up again. There is no limit by default.
+     *
+     * \param[in] handle a handle initialized with \ref keystone_init
+     *
+     * \param[in] max_bytes the bytes the entries may use, 0 removes the limit
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise.
+     *
+     * \note Must not be called while other threads are using the handle.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_set_token_cache_memory_limit(keystone_data_t* handle, size_t max_bytes);
+
+    /**
+     * \example keystone_set_shared_cache_example
+     * \code{.c}
+     * // assume handle is initialized. Every worker process of the host runs this:
+     * if (keystone_set_shared_cache(handle, "/keystone-tokens", 65536, 0, 300.0) != KEYSTONE_SUCCESS) {
+     *     // Something went wrong, carry on without it
+     * }
+     * \endcode
+     */
+
+    /**
+     * \ingroup keystone
+     *
+     * Attaches the handle to a token cache in POSIX shared memory, creating it if it does not exist yet. All
+     * handles (in any process of the same user on the host) attached to the same name share the cache, so a
+     * token validated by one worker process is a hit in all of them. It is looked up after the token cache of
+     * \ref keystone_set_token_cache, and filled by \ref keystone_login and \ref keystone_get_userinfo_from_token.
+     *
+     * The cache is a fixed size table of entries of entry_size bytes each, read without locks. Userinfos that do
+     * not fit in an entry (eg. with very many roles) are not shared. The entries hold no tokens. The segment
+     * stays when the processes exit, so restarted workers find it warm; remove it from /dev/shm to start over.
+     * Not available on Windows.
+     *
+     * The segment is created readable and writable by its owner only, and an existing segment is only attached
+     * if it is owned by the effective user and has no group or other permissions: anyone who can write it could
+     * make the handles accept any userinfo.
+     *
+     * The creator of the segment draws the key of its hashes, and attached handles use it for their token
+     * cache as well, which empties the token cache of a handle that had filled it before attaching.
+     *
+     * \param[in] handle a handle initialized with \ref keystone_init
+     *
+     * \param[in] name the name of the segment, "/" followed by up to 250 characters other than "/", or NULL to detach
+     *
+     * \param[in] max_entries the number of entries (rounded up to a power of two), used if the segment is created
+     *
+     * \param[in] entry_size the bytes per entry, 0 for the default of 1024, used if the segment is created
+     *
+     * \param[in] ttl how long (in seconds) the entries stored through this handle are used
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, \ref KEYSTONE_INVALID_ARGUMENT if the name or geometry is invalid
+     *         (or an existing segment has an incompatible layout or is not private to the user), something else
+     *         otherwise.
+     *
+     * \note Must not be called while other threads are using the handle.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_set_shared_cache(keystone_data_t* handle, const char* name, size_t max_entries, size_t entry_size, double ttl);
+
+    /**
+     * \example keystone_set_role_cache_example
+     * \code{.c}
+     * // assume handle is initialized. Remember the roles of 10000 users for an hour:
+     * if (keystone_set_role_cache(handle, 10000, 3600.0) != KEYSTONE_SUCCESS) {
+     *     // Something went wrong
+     * }
+     * \endcode
+     */
+
+    /**
+     * \ingroup keystone
+     *
+     * Caches the roles of users, keyed by username and tenant name. \ref keystone_login and
+     * \ref keystone_get_userinfo_from_token then only ask the service for the roles of a user when they are not
+     * cached, so a login or a token cache miss takes one call to the service instead of two.
+     *
+     * Roles granted or revoked in keystone are only seen once the cached ones expire, so the ttl bounds how long
+     * a revoked role is still accepted.
+     *
+     * Enabling the cache changes the meaning of the tenant_name argument of \ref keystone_get_userinfo_from_token.
+     * Without the cache it is not used; with it, it becomes part of the key as is, and must be the tenant the
+     * token was issued for: tokens of one user looked up with the same tenant name share one set of roles, even
+     * if they are scoped to different projects. Lookups with an empty tenant name bypass the cache and always ask
+     * the service for the roles.
+     *
+     * \param[in] handle a handle initialized with \ref keystone_init
+     *
+     * \param[in] max_entries the number of users (per tenant) to remember, 0 turns the cache off (the default)
+     *
+     * \param[in] ttl how long (in seconds) the roles of a user are used
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise.
+     *
+     * \note Must not be called while other threads are using the handle.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_set_role_cache(keystone_data_t* handle, size_t max_entries, double ttl);
+
+    /**
+     * \ingroup keystone
+     *
+     * Sets up the session cache of \ref keystone_session_login. It keeps the sessions of up to max_sessions
+     * accounts (username, tenant name and password), each handed out for lifetime seconds after its login. A
+     * background thread of the handle logs the accounts in again refresh_after seconds after their login, so
+     * callers never wait for a login of an account in use; sessions not used since their last login are dropped
+     * at that point instead. Should a renewal fail, the old session is handed out until its lifetime is over.
+     *
+     * The cache keeps the passwords in memory for the renewals (wiped when a session is dropped). Sessions are
+     * looked up by a keyed hash of the password, whose key is random per cache.
+     *
+     * Setting up the cache again drops all sessions. The hooks of \ref keystone_set_hooks are also called from
+     * the background thread.
+     *
+     * \param[in] handle a handle initialized with \ref keystone_init
+     *
+     * \param[in] max_sessions the number of accounts to keep sessions for, 0 turns the cache off (the default)
+     *
+     * \param[in] lifetime how long (in seconds) a session is handed out after its login, less than the lifetime
+     *                     of the tokens of the service
+     *
+     * \param[in] refresh_after when (in seconds after the login) a session is renewed, less than lifetime, or 0
+     *                          for three quarters of the lifetime
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise.
+     *
+     * \note Must not be called while other threads are using the handle.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_set_session_cache(keystone_data_t* handle, size_t max_sessions, double lifetime, double refresh_after);
+
+    /**
+     * \example keystone_cache_save_example
+     * \code{.c}
+     * // assume handle is initialized with a token cache. On shutdown:
+     * if (keystone_cache_save(handle, "/var/cache/myservice/tokens.cache") != KEYSTONE_SUCCESS) {
+     *     // Something went wrong
+     * }
+     * // and after the restart, once the caches are set up again:
+     * if (keystone_cache_load(handle, "/var/cache/myservice/tokens.cache") != KEYSTONE_SUCCESS) {
+     *     // Start cold
+     * }
+     * \endcode
+     */
+
+    /**
+     * \ingroup keystone
+     *
+     * Writes the entries of the token cache of \ref keystone_set_token_cache (or, if there is none, of the shared
+     * cache of \ref keystone_set_shared_cache) that have not expired yet to a file, with their expiry times. The
+     * file is written next to file_name and renamed over it when complete, so readers never see a partial file.
+     *
+     * The file holds no tokens, but the key of the cache hashes and the userinfos, and must be kept private: on
+     * POSIX systems it is created under a unique temporary name, readable and writable by its owner only. It is in the byte order of the host, and
+     * is only meant to be read back by the same version of the library on the same kind of host.
+     *
+     * \param[in] handle a handle initialized with \ref keystone_init
+     *
+     * \param[in] file_name the file to write
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, \ref KEYSTONE_INVALID_ARGUMENT if the handle has no token cache,
+     *         something else otherwise.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_cache_save(keystone_data_t* handle, const char* file_name);
+
+    /**
+     * \ingroup keystone
+     *
+     * Fills the token cache and the shared cache of the handle from a file written by \ref keystone_cache_save,
+     * so a restarted service answers its first requests without calling the keystone service. The entries keep
+     * the expiry times they had when saved, but no later than the ttl of each cache from now (expired ones are
+     * skipped), and the file is checked in full before any
+     * entry is added. The handle takes over the hash key of the file, unless it is attached to a shared cache
+     * with another key, which fails with \ref KEYSTONE_INVALID_ARGUMENT.
+     *
+     * Whoever can write the file can make the handle accept any token, so on POSIX systems it must be a regular
+     * file owned by the effective user, without group or other permissions (as \ref keystone_cache_save creates
+     * it). Other files fail with \ref KEYSTONE_INVALID_ARGUMENT.
+     *
+     * \param[in] handle a handle initialized with \ref keystone_init
+     *
+     * \param[in] file_name the file to read
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, \ref KEYSTONE_INVALID_ARGUMENT if the handle has no token cache,
+     *         \ref KEYSTONE_PARSE_ERROR if the file is corrupt or not a cache file, something else otherwise.
+     *
+     * \note Must not be called while other threads are using the handle.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_cache_load(keystone_data_t* handle, const char* file_name);
+
+    /**
+     * \example keystone_cache_prewarm_example
+     * \code{.c}
+     * // assume handle is initialized with a token cache, and tokens holds the
+     * // token_count active sessions of the tenant, eg. from the session store.
+     * size_t cached = 0;
+     * if (keystone_cache_prewarm(handle, "tenant_name", tokens, token_count, 8, 200.0, &cached) != KEYSTONE_SUCCESS) {
+     *     // Something went wrong, the first cached tokens are still in the cache
+     * }
+     * \endcode
+     */
+
+    /**
+     * \ingroup keystone
+     *
+     * Looks up a list of session tokens (as \ref keystone_get_userinfo_from_token would) so that the token
+     * cache and the shared cache hold them before traffic arrives, eg. before a region fails over to this
+     * service. The lookups are made from concurrency threads, at most max_rate per second, so the keystone
+     * service is not flooded. Tokens the service rejects are skipped; any other error stops the lookups.
+     *
+     * Other threads may look tokens up with the handle meanwhile.
+     *
+     * \param[in] handle a handle initialized with \ref keystone_init
+     *
+     * \param[in] tenant_name the tenant name the tokens are looked up with
+     *
+     * \param[in] session_tokens an array of count null terminated session tokens
+     *
+     * \param[in] count the number of tokens
+     *
+     * \param[in] concurrency the number of lookups in flight at once (at least 1, at most 4 per core)
+     *
+     * \param[in] max_rate the lookups per second at most, 0 for no limit
+     *
+     * \param[out] cached if not NULL, set to the number of tokens that are in the cache now (also when the
+     *                    lookups stopped on an error)
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, \ref KEYSTONE_INVALID_ARGUMENT if the handle has no token cache,
+     *         the error that stopped the lookups otherwise.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_cache_prewarm(keystone_data_t* handle, const char* tenant_name, const char* const* session_tokens, size_t count, unsigned concurrency, double max_rate, size_t* cached);
+
+    /**
+     * \example keystone_set_revocation_file_example
+     * \code{.c}
+     * // The file lists a revoked token per line, or "user <username>" to revoke all
+     * // tokens of a user, and is rewritten by some other process.
+     * keystone_set_token_cache(handle, 100000, 600.0);
+     * if (keystone_set_revocation_file(handle, "/var/lib/myservice/revoked.txt", 10.0) != KEYSTONE_SUCCESS) {
+     *     // Something went wrong
+     * }
+     * \endcode
+     */
+
+    /**
+     * \ingroup keystone
+     *
+     * Makes a thread of the handle read a revocation file every interval seconds (the first time right away),
+     * and remove the entries of the revoked tokens and users from the token cache (with its per-thread
+     * tables), the shared cache and the session cache. Tokens revoked at the service are then only accepted
+     * from the caches until the next poll, so the caches can keep entries for minutes instead of seconds.
+     *
+     * The file lists one revoked token per line, or "user " followed by a username to revoke all tokens of the
+     * user. Blank lines and lines starting with '#' are skipped. It must list every revocation still in effect
+     * (typically those younger than the ttl of the caches): each poll removes the entries of the revocations
+     * that were not in the previous list, and the whole list keeps revoked entries out of files loaded with
+     * \ref keystone_cache_load and shared caches attached later. Lookups that were in flight during a poll do
+     * not cache their results. If the file cannot be read, the poll is skipped.
+     *
+     * This replaces the source of \ref keystone_set_revocation_callback.
+     *
+     * \param[in] handle a handle initialized with \ref keystone_init
+     *
+     * \param[in] file_name the revocation file, or NULL to stop polling
+     *
+     * \param[in] interval the seconds between polls
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise.
+     *
+     * \note Must not be called while other threads are using the handle.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_set_revocation_file(keystone_data_t* handle, const char* file_name, double interval);
+
+    /**
+     * \example keystone_set_revocation_callback_example
+     * \code{.c}
+     * keystone_error_t fetch_revocations(void* user_data, keystone_revocation_list_t* list) {
+     *     // eg. from the revocation events of the identity service
+     *     keystone_revocation_list_add_token(list, "revoked-token");
+     *     keystone_revocation_list_add_user(list, "disabled-user");
+     *     return KEYSTONE_SUCCESS;
+     * }
+     * ...
+     * keystone_set_revocation_callback(handle, fetch_revocations, NULL, 10.0);
+     * \endcode
+     */
+
+    /**
+     * \ingroup keystone
      *
-     * \param[in] session_token a null terminated string containing the session_token
+     * Like \ref keystone_set_revocation_file, with the revocations coming from a callback instead of a file.
+     * The callback is called from the thread of the handle, and must not call the handle; a poll for which
+     * it does not return \ref KEYSTONE_SUCCESS removes nothing.
      *
-     * \param[out] userinfo at end of execution, will contain a valid handle to a userinfo object. 
+     * \param[in] handle a handle initialized with \ref keystone_init
      *
-     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise. 
+     * \param[in] source the callback, or NULL to stop polling
      *
-     * \note All userinfo_objects must be freed with \ref keystone_userinfo_free
+     * \param[in] user_data passed unchanged to the callback
+     *
+     * \param[in] interval the seconds between polls
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise.
+     *
+     * \note Must not be called while other threads are using the handle.
      */
-    KEYSTONE_EXPORT keystone_error_t keystone_get_userinfo_from_token(keystone_data_t* handle, const char* tenant_name, const char* session_token, keystone_userinfo_t** userinfo);
+    KEYSTONE_EXPORT keystone_error_t keystone_set_revocation_callback(keystone_data_t* handle, keystone_revocation_source_t source, void* user_data, double interval);
 
+    /**
+     * \ingroup keystone
+     *
+     * Adds a revoked session token to a list, from a \ref keystone_revocation_source_t.
+     *
+     * \param[in] list the list given to the source
+     *
+     * \param[in] session_token a null terminated session token
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_revocation_list_add_token(keystone_revocation_list_t* list, const char* session_token);
 
     /**
      * \ingroup keystone
-     * Set the path to the file containing the certificates from the Certificate Authorities (CA). This might be required for accessing
-     * keystone servers behind https protocols.
      *
-     * \param[in] handle a valid handle to keystone (obtained by \ref keystone_init).
+     * Adds a user all of whose tokens are revoked to a list, from a \ref keystone_revocation_source_t.
      *
-     * \param[in] cert_file_name a null terminated string containing the path and file name of the CA bundle.
+     * \param[in] list the list given to the source
+     *
+     * \param[in] username a null terminated username
      *
      * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise.
      */
-    KEYSTONE_EXPORT keystone_error_t keystone_set_ca_certificate_filename(keystone_data_t* handle, const char* cert_file_name);
+    KEYSTONE_EXPORT keystone_error_t keystone_revocation_list_add_user(keystone_revocation_list_t* list, const char* username);
 
 
     /**
@@ -545,6 +1545,341 @@ extern "C" {
      */  
     KEYSTONE_EXPORT keystone_error_t keystone_userinfo_get_token_buffer_size(const keystone_userinfo_t* userinfo_handle, size_t* size);
 
+
+    /**
+     * \example keystone_userinfo_get_timings_example
+     * \code{.c}
+     * // assume userinfo_handle is initialized.
+     * keystone_timing_t timings[4];
+     * size_t timing_count = 0;
+     * size_t i;
+     * if (keystone_userinfo_get_timings(userinfo_handle, timings, 4, &timing_count) != KEYSTONE_SUCCESS) {
+     *     // Something went wrong
+     * }
+     * for (i = 0; i < timing_count; i++) {
+     *     printf("operation %d: connect %f s, server %f s, total %f s, parse %f s\n", timings[i].operation,
+     *            timings[i].connect, timings[i].start_transfer - timings[i].connect, timings[i].total, timings[i].parse);
+     * }
+     * \endcode
+     */
+
+    /**
+     * \ingroup keystone
+     *
+     * Gets the number of timing records associated to the userinfo (one per call made to the keystone service).
+     *
+     * \sa keystone_userinfo_get_timings
+     *
+     * \param[in] userinfo_handle a valid handle to a userinfo object, acquired from eg. \ref keystone_login or \ref keystone_get_userinfo_from_token
+     *
+     * \param[out] timing_count will at the end of execution contain the number of timing records.
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_userinfo_get_timing_count(const keystone_userinfo_t* userinfo_handle, size_t* timing_count);
+
+    /**
+     * \ingroup keystone
+     *
+     * Gets the timing records of the calls made to the keystone service to obtain the userinfo, in the order they were made.
+     *
+     * \sa keystone_userinfo_get_timing_count
+     *
+     * \param[in] userinfo_handle a valid handle to a userinfo object, acquired from eg. \ref keystone_login or \ref keystone_get_userinfo_from_token
+     *
+     * \param[out] timings an array of at least the size returned from \ref keystone_userinfo_get_timing_count.
+     *
+     * \param[in] timings_length the number of elements in \c timings
+     *
+     * \param[out] timings_written at the end of the execution, will contain the number of records written to \c timings.
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_userinfo_get_timings(const keystone_userinfo_t* userinfo_handle, keystone_timing_t* timings, size_t timings_length, size_t* timings_written);
+
+    /**
+     * \example keystone_userinfo_has_role_example
+     * \code{.c}
+     * // Intern the role once (eg. at startup):
+     * keystone_role_id_t admin_role;
+     * if (keystone_role_intern("admin", &admin_role) != KEYSTONE_SUCCESS) {
+     *     // Something went wrong
+     * }
+     *
+     * // assume userinfo_handle is initialized.
+     * int is_admin = 0;
+     * if (keystone_userinfo_has_role(userinfo_handle, admin_role, &is_admin) != KEYSTONE_SUCCESS) {
+     *     // Something went wrong
+     * }
+     * \endcode
+     */
+
+    /**
+     * \ingroup keystone
+     *
+     * Interns a role name in the process-wide role table and gives back its id.
+     * Interning the same name twice gives the same id.
+     *
+     * \sa keystone_userinfo_has_role
+     *
+     * \param[in] role_name a null terminated string containing the role name
+     *
+     * \param[out] role_id will at the end of execution contain the id of the role.
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise (eg. if the role table is full).
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_role_intern(const char* role_name, keystone_role_id_t* role_id);
+
+    /**
+     * \ingroup keystone
+     *
+     * Checks whether the userinfo has the given role. This is a single bit test, no strings are compared.
+     *
+     * \sa keystone_role_intern
+     *
+     * \param[in] userinfo_handle a valid handle to a userinfo object, acquired from eg. \ref keystone_login or \ref keystone_get_userinfo_from_token
+     *
+     * \param[in] role_id a role id obtained from \ref keystone_role_intern
+     *
+     * \param[out] has_role will at the end of execution be 1 if the user has the role, 0 otherwise.
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_userinfo_has_role(const keystone_userinfo_t* userinfo_handle, keystone_role_id_t role_id, int* has_role);
+
+    /**
+     * \ingroup keystone
+     *
+     * Checks whether the userinfo has at least one of the given roles.
+     *
+     * \param[in] userinfo_handle a valid handle to a userinfo object, acquired from eg. \ref keystone_login or \ref keystone_get_userinfo_from_token
+     *
+     * \param[in] role_ids an array of role ids obtained from \ref keystone_role_intern
+     *
+     * \param[in] role_id_count the number of elements in \c role_ids
+     *
+     * \param[out] has_role will at the end of execution be 1 if the user has any of the roles, 0 otherwise.
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_userinfo_has_any_role(const keystone_userinfo_t* userinfo_handle, const keystone_role_id_t* role_ids, size_t role_id_count, int* has_role);
+
+    /**
+     * \ingroup keystone
+     *
+     * Checks whether the userinfo has all of the given roles.
+     *
+     * \param[in] userinfo_handle a valid handle to a userinfo object, acquired from eg. \ref keystone_login or \ref keystone_get_userinfo_from_token
+     *
+     * \param[in] role_ids an array of role ids obtained from \ref keystone_role_intern
+     *
+     * \param[in] role_id_count the number of elements in \c role_ids
+     *
+     * \param[out] has_roles will at the end of execution be 1 if the user has all of the roles, 0 otherwise.
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_userinfo_has_all_roles(const keystone_userinfo_t* userinfo_handle, const keystone_role_id_t* role_ids, size_t role_id_count, int* has_roles);
+
+
+    /**
+     * \example keystone_policy_example
+     * \code{.c}
+     * // Compile the policy once (eg. at startup):
+     * keystone_policy_t* policy_handle;
+     * if (keystone_policy_compile("admin OR (operator AND tenant-x)", &policy_handle) != KEYSTONE_SUCCESS) {
+     *     // The policy is malformed
+     * }
+     *
+     * // assume userinfo_handle is initialized.
+     * int allowed = 0;
+     * if (keystone_policy_eval(policy_handle, userinfo_handle, &allowed) != KEYSTONE_SUCCESS) {
+     *     // Something went wrong
+     * }
+     *
+     * // remember to free it at the end:
+     * keystone_policy_free(policy_handle);
+     * \endcode
+     */
+
+    /**
+     * \ingroup keystone
+     *
+     * Compiles a role policy. A policy combines role names with \c AND, \c OR, \c NOT
+     * (or \c &&, \c ||, \c !) and parentheses, eg. "admin OR (operator AND tenant-x)".
+     * Role names containing other characters than letters, digits and <tt>_ . : @ -</tt> must be put in double quotes.
+     *
+     * \sa keystone_policy_eval
+     * \sa keystone_policy_free
+     *
+     * \param[in] expression a null terminated string containing the policy
+     *
+     * \param[out] policy at end of execution, will contain a valid handle to the compiled policy.
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise (eg. if the expression is malformed).
+     *
+     * \note All policy objects must be freed with \ref keystone_policy_free
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_policy_compile(const char* expression, keystone_policy_t** policy);
+
+    /**
+     * \ingroup keystone
+     *
+     * Frees up all resources associated to the policy handle.
+     *
+     * \param[in] policy a valid policy handle obtained from \ref keystone_policy_compile
+     *
+     * \return \ref KEYSTONE_SUCCESS if everything went OK, something else otherwise.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_policy_free(keystone_policy_t* policy);
+
+    /**
+     * \ingroup keystone
+     *
+     * Evaluates a compiled policy against the roles of a userinfo. The policy may be evaluated from several threads at once.
+     *
+     * \param[in] policy a valid policy handle obtained from \ref keystone_policy_compile
+     *
+     * \param[in] userinfo_handle a valid handle to a userinfo object, acquired from eg. \ref keystone_login or \ref keystone_get_userinfo_from_token
+     *
+     * \param[out] allowed will at the end of execution be 1 if the roles of the user satisfy the policy, 0 otherwise.
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_policy_eval(const keystone_policy_t* policy, const keystone_userinfo_t* userinfo_handle, int* allowed);
+
+
+    /**
+     * \example keystone_get_stats_example
+     * \code{.c}
+     * keystone_stats_t* stats;
+     * if (keystone_get_stats(&stats) != KEYSTONE_SUCCESS) {
+     *     // Something went wrong
+     * }
+     *
+     * unsigned long long requests = 0;
+     * double p99 = 0;
+     * keystone_stats_get_counter(stats, KEYSTONE_OPERATION_GET_USERNAME, KEYSTONE_COUNTER_REQUESTS, &requests);
+     * keystone_stats_get_latency_quantile(stats, KEYSTONE_OPERATION_GET_USERNAME, 0.99, &p99);
+     *
+     * // Expose it to Prometheus (eg. through the node exporter textfile collector):
+     * keystone_stats_write_prometheus(stats, "/var/lib/node_exporter/keystone.prom");
+     *
+     * // remember to free it at the end:
+     * keystone_stats_free(stats);
+     * \endcode
+     */
+
+    /**
+     * \ingroup keystone
+     *
+     * Takes a snapshot of the metrics kept by the library. The metrics are library-wide, kept per
+     * endpoint (service URL) and operation, and are updated lock-free by every call to the keystone service.
+     *
+     * \sa keystone_stats_get_counter
+     * \sa keystone_stats_get_latency_quantile
+     * \sa keystone_stats_write_prometheus
+     *
+     * \param[out] stats at end of execution, will contain a valid handle to the snapshot.
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise.
+     *
+     * \note All stats objects must be freed with \ref keystone_stats_free
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_get_stats(keystone_stats_t** stats);
+
+    /**
+     * \ingroup keystone
+     *
+     * Frees up all resources associated to the stats handle.
+     *
+     * \param[in] stats a valid stats handle obtained from \ref keystone_get_stats
+     *
+     * \return \ref KEYSTONE_SUCCESS if everything went OK, something else otherwise.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_stats_free(keystone_stats_t* stats);
+
+    /**
+     * \ingroup keystone
+     *
+     * Gets a counter of an operation, summed over all endpoints.
+     *
+     * \param[in] stats a valid stats handle obtained from \ref keystone_get_stats
+     *
+     * \param[in] operation the operation to get the counter of
+     *
+     * \param[in] counter the counter to get
+     *
+     * \param[out] value will at the end of execution contain the value of the counter.
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_stats_get_counter(const keystone_stats_t* stats, keystone_operation_t operation, keystone_counter_t counter, unsigned long long* value);
+
+    /**
+     * \ingroup keystone
+     *
+     * Gets a latency quantile of an operation over all endpoints. The latency of a call covers building
+     * the request, the transfer and parsing the reply. The value is the upper bound of the histogram
+     * bucket the quantile falls in, which is at most 12.5% above the exact value.
+     *
+     * \param[in] stats a valid stats handle obtained from \ref keystone_get_stats
+     *
+     * \param[in] operation the operation to get the latency of
+     *
+     * \param[in] quantile the quantile to get, between 0 and 1 (eg. 0.99)
+     *
+     * \param[out] seconds will at the end of execution contain the latency in seconds, 0 if no calls were made.
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_stats_get_latency_quantile(const keystone_stats_t* stats, keystone_operation_t operation, double quantile, double* seconds);
+
+    /**
+     * \ingroup keystone
+     *
+     * Gets the buffer size needed for \ref keystone_stats_get_prometheus.
+     *
+     * \param[in] stats a valid stats handle obtained from \ref keystone_get_stats
+     *
+     * \param[out] size will at the end of execution contain the needed buffer size (including the null terminator).
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_stats_get_prometheus_buffer_size(const keystone_stats_t* stats, size_t* size);
+
+    /**
+     * \ingroup keystone
+     *
+     * Renders the snapshot in the Prometheus text exposition format.
+     *
+     * \param[in] stats a valid stats handle obtained from \ref keystone_get_stats
+     *
+     * \param[out] buffer a char array of size at least the size returned from \ref keystone_stats_get_prometheus_buffer_size
+     *
+     * \param[in] buffer_length the size of \c buffer
+     *
+     * \param[out] data_written at the end of the execution, will contain the number of bytes written to \c buffer (including the null terminator).
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_stats_get_prometheus(const keystone_stats_t* stats, char* buffer, size_t buffer_length, size_t* data_written);
+
+    /**
+     * \ingroup keystone
+     *
+     * Writes the snapshot in the Prometheus text exposition format to a file. The file is written next
+     * to the target and renamed in place, so a collector never reads a half-written file. On POSIX systems
+     * it is created under a unique temporary name, writable by its owner and readable by everyone.
+     *
+     * \param[in] stats a valid stats handle obtained from \ref keystone_get_stats
+     *
+     * \param[in] file_name a null terminated string containing the file name
+     *
+     * \return \ref KEYSTONE_SUCCESS if all went OK, something else otherwise.
+     */
+    KEYSTONE_EXPORT keystone_error_t keystone_stats_write_prometheus(const keystone_stats_t* stats, const char* file_name);
+
 #ifdef __cplusplus
 }
 #endif
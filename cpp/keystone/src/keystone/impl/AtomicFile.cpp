@@ -0,0 +1,58 @@
+#include "keystone/impl/AtomicFile.hpp"
+
+#include <cstdio>
+
+#if !defined(_WIN32)
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace keystone { namespace impl {
+
+    Status replaceFile(const std::string& path, const char* data, size_t size, unsigned mode) {
+#if defined(_WIN32)
+        (void)mode;
+        std::string temporary = path + ".tmp";
+        FILE* file = fopen(temporary.c_str(), "wb");
+        if (file == NULL) {
+            return Status(ERROR_UNKNOWN, "Could not open the file");
+        }
+        size_t written = fwrite(data, 1, size, file);
+        int closed = fclose(file);
+        if (written != size || closed != 0) {
+            remove(temporary.c_str());
+            return Status(ERROR_UNKNOWN, "Could not write the file");
+        }
+        // rename does not replace existing files on Windows.
+        remove(path.c_str());
+#else
+        std::string temporary = path + ".XXXXXX";
+        int fd = mkstemp(&temporary[0]);
+        if (fd < 0) {
+            return Status(ERROR_UNKNOWN, "Could not open the file");
+        }
+        // mkstemp creates the file with mode 0600.
+        bool failed = (mode & 07777) != 0600 && fchmod(fd, mode_t(mode & 07777)) != 0;
+        for (size_t done = 0; done < size && !failed;) {
+            ssize_t written = ::write(fd, data + done, size - done);
+            if (written > 0) {
+                done += static_cast<size_t>(written);
+            } else if (written == 0 || errno != EINTR) {
+                failed = true;
+            }
+        }
+        if (::close(fd) != 0 || failed) {
+            unlink(temporary.c_str());
+            return Status(ERROR_UNKNOWN, "Could not write the file");
+        }
+#endif
+        if (rename(temporary.c_str(), path.c_str()) != 0) {
+            remove(temporary.c_str());
+            return Status(ERROR_UNKNOWN, "Could not rename the file");
+        }
+        return Status();
+    }
+}}
@@ -0,0 +1,215 @@
+#include "keystone/impl/CacheFile.hpp"
+#include "keystone/impl/AtomicFile.hpp"
+#include "keystone/impl/Clock.hpp"
+#include "keystone/impl/Hash.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace {
+    const char FILE_MAGIC[8] = { 'K', 'S', 'C', 'A', 'C', 'H', 'E', '1' };
+    const uint32_t FILE_VERSION = 3;
+
+    struct FileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t headerSize;
+        uint64_t entryCount;
+        uint64_t dataSize;
+        // checksumBytes() of the dataSize bytes after the header.
+        uint64_t checksum;
+        // Wall clock, nanoseconds since the Unix epoch.
+        int64_t savedAt;
+        // The SipKey the entry keys were made with.
+        uint64_t hashKey[2];
+    };
+
+    struct EntryHeader {
+        // Wall clock, nanoseconds since the Unix epoch.
+        int64_t expiresAt;
+        uint64_t keyLow;
+        uint64_t keyHigh;
+        uint32_t recordSize;
+        uint32_t reserved;
+    };
+
+    size_t padded(size_t size) {
+        return (size + 7) & ~size_t(7);
+    }
+
+    int64_t wallNanoseconds() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    const keystone::impl::Status corrupt(keystone::impl::ERROR_PARSE, "The cache file is corrupt");
+
+    /**
+     * Checks the header and the checksum, and appends the entries that have not expired.
+     */
+    keystone::impl::Status parse(const char* data, size_t size, keystone::impl::SipKey& key,
+                                 std::vector<keystone::impl::CachedUserInfo>& entries) {
+        using namespace keystone::impl;
+        FileHeader header;
+        if (size < sizeof(header)) {
+            return corrupt;
+        }
+        std::memcpy(&header, data, sizeof(header));
+        if (std::memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 || header.version != FILE_VERSION
+            || header.headerSize != sizeof(header) || header.dataSize != size - sizeof(header)) {
+            return corrupt;
+        }
+        const char* position = data + sizeof(header);
+        const char* end = position + header.dataSize;
+        if (checksumBytes(position, header.dataSize) != header.checksum) {
+            return corrupt;
+        }
+
+        // The expiries move from the wall clock back to the monotonic one.
+        int64_t offset = monotonicNanoseconds() - wallNanoseconds();
+        int64_t now = monotonicNanoseconds();
+        std::vector<CachedUserInfo> loaded;
+        loaded.reserve(static_cast<size_t>(std::min<uint64_t>(header.entryCount, header.dataSize / sizeof(EntryHeader))));
+        for (uint64_t i = 0; i < header.entryCount; i++) {
+            EntryHeader entry;
+            if (static_cast<size_t>(end - position) < sizeof(entry)) {
+                return corrupt;
+            }
+            std::memcpy(&entry, position, sizeof(entry));
+            position += sizeof(entry);
+            if (static_cast<size_t>(end - position) < padded(entry.recordSize)) {
+                return corrupt;
+            }
+            int64_t expiresAt = entry.expiresAt + offset;
+            if (expiresAt > now) {
+                CachedUserInfo cached;
+                if (!KeystoneUserInfo::fromRecord(position, entry.recordSize, cached.info)) {
+                    return corrupt;
+                }
+                cached.key.low = entry.keyLow;
+                cached.key.high = entry.keyHigh;
+                cached.expiresAt = expiresAt;
+                loaded.push_back(cached);
+            }
+            position += padded(entry.recordSize);
+        }
+        if (position != end) {
+            return corrupt;
+        }
+        key.k0 = header.hashKey[0];
+        key.k1 = header.hashKey[1];
+        entries.insert(entries.end(), loaded.begin(), loaded.end());
+        return keystone::impl::Status();
+    }
+}
+
+
+namespace keystone { namespace impl { namespace cachefile {
+
+    Status save(const std::string& path, const SipKey& key, const std::vector<CachedUserInfo>& entries) {
+        int64_t now = monotonicNanoseconds();
+        int64_t offset = wallNanoseconds() - now;
+
+        // Built in memory, so the checksum can go in the header.
+        std::vector<char> buffer(sizeof(FileHeader));
+        uint64_t entryCount = 0;
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (entries[i].expiresAt <= now) {
+                continue;
+            }
+            EntryHeader entry;
+            entry.expiresAt = entries[i].expiresAt + offset;
+            entry.keyLow = entries[i].key.low;
+            entry.keyHigh = entries[i].key.high;
+            entry.recordSize = static_cast<uint32_t>(entries[i].info.getRecordSize());
+            entry.reserved = 0;
+            const char* record = static_cast<const char*>(entries[i].info.getRecord());
+            buffer.insert(buffer.end(), reinterpret_cast<const char*>(&entry),
+                          reinterpret_cast<const char*>(&entry) + sizeof(entry));
+            buffer.insert(buffer.end(), record, record + entry.recordSize);
+            buffer.resize(padded(buffer.size()), 0);
+            entryCount++;
+        }
+
+        FileHeader header;
+        std::memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+        header.version = FILE_VERSION;
+        header.headerSize = sizeof(FileHeader);
+        header.entryCount = entryCount;
+        header.dataSize = buffer.size() - sizeof(FileHeader);
+        header.checksum = checksumBytes(&buffer[sizeof(FileHeader)], header.dataSize);
+        header.savedAt = now + offset;
+        header.hashKey[0] = key.k0;
+        header.hashKey[1] = key.k1;
+        std::memcpy(&buffer[0], &header, sizeof(header));
+
+        // The file holds the cache key: only the owner may read it.
+        Status status = replaceFile(path, &buffer[0], buffer.size(), 0600);
+        if (!status.isOk()) {
+            return Status(ERROR_UNKNOWN, "Could not write the cache file");
+        }
+        return Status();
+    }
+
+    Status load(const std::string& path, SipKey& key, std::vector<CachedUserInfo>& entries) {
+#if defined(_WIN32)
+        FILE* file = fopen(path.c_str(), "rb");
+        if (file == NULL) {
+            return Status(ERROR_UNKNOWN, "Could not open the cache file");
+        }
+        std::vector<char> buffer;
+        char chunk[65536];
+        size_t read;
+        while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+            buffer.insert(buffer.end(), chunk, chunk + read);
+        }
+        bool failed = ferror(file) != 0;
+        fclose(file);
+        if (failed) {
+            return Status(ERROR_UNKNOWN, "Could not read the cache file");
+        }
+        return parse(buffer.empty() ? NULL : &buffer[0], buffer.size(), key, entries);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return Status(ERROR_UNKNOWN, "Could not open the cache file");
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            ::close(fd);
+            return Status(ERROR_UNKNOWN, "Could not read the cache file");
+        }
+        // The checksum does not stop anyone who can write the file from forging entries (and the
+        // cache key), so only files that nobody but this user can have written are trusted.
+        if (!S_ISREG(info.st_mode) || info.st_uid != geteuid() || (info.st_mode & (S_IRWXG | S_IRWXO)) != 0) {
+            ::close(fd);
+            return Status(ERROR_INVALID_ARGUMENT, "The cache file is not private to this user");
+        }
+        size_t size = static_cast<size_t>(info.st_size);
+        if (size < sizeof(FileHeader)) {
+            ::close(fd);
+            return corrupt;
+        }
+        void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            return Status(ERROR_UNKNOWN, "Could not map the cache file");
+        }
+        // The whole file is read once, front to back.
+        madvise(mapping, size, MADV_SEQUENTIAL);
+        Status status = parse(static_cast<const char*>(mapping), size, key, entries);
+        munmap(mapping, size);
+        return status;
+#endif
+    }
+}}}
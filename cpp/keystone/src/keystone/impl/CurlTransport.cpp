@@ -0,0 +1,442 @@
+#include "keystone/impl/CurlTransport.hpp"
+#include "keystone/impl/Error.hpp"
+#include <curl/curl.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+
+
+namespace {
+    keystone::impl::ErrorCode classifyCurlError(CURLcode code) {
+        switch (code) {
+        case CURLE_OPERATION_TIMEDOUT:
+            return keystone::impl::ERROR_TIMEOUT;
+        case CURLE_COULDNT_RESOLVE_PROXY:
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_SSL_CONNECT_ERROR:
+        case CURLE_PEER_FAILED_VERIFICATION:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+        case CURLE_GOT_NOTHING:
+        case CURLE_PARTIAL_FILE:
+            return keystone::impl::ERROR_CONNECTION;
+        case CURLE_URL_MALFORMAT:
+        case CURLE_UNSUPPORTED_PROTOCOL:
+            return keystone::impl::ERROR_INVALID_ARGUMENT;
+        default:
+            return keystone::impl::ERROR_UNKNOWN;
+        }
+    }
+
+    keystone::impl::ErrorCode classifyHttpStatus(long status) {
+        switch (status) {
+        case 429:
+        case 503:
+            return keystone::impl::ERROR_OVERLOADED;
+        default:
+            return keystone::impl::ERROR_HTTP;
+        }
+    }
+
+    std::once_flag curlInitialized;
+
+    size_t writeToString(char* dataPointer, size_t size, size_t nmemb, void* stringAsVoid) {
+
+        std::string* output = static_cast<std::string*>(stringAsVoid);
+
+        output->append(dataPointer, size * nmemb);
+        return size * nmemb;
+    }
+
+    void getTransferInfo(CURL* curl, keystone::impl::TransferInfo& info) {
+        curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME, &info.nameLookup);
+        curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &info.connect);
+        curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME, &info.appConnect);
+        curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME, &info.startTransfer);
+        curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &info.total);
+        curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &info.newConnections);
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &info.httpStatus);
+
+        // Headers are counted separately from the bodies by curl.
+        long requestSize = 0;
+        long headerSize = 0;
+        curl_easy_getinfo(curl, CURLINFO_REQUEST_SIZE, &requestSize);
+        curl_easy_getinfo(curl, CURLINFO_HEADER_SIZE, &headerSize);
+#if LIBCURL_VERSION_NUM >= 0x073700
+        curl_off_t uploaded = 0;
+        curl_off_t downloaded = 0;
+        curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD_T, &uploaded);
+        curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &downloaded);
+#else
+        double uploaded = 0;
+        double downloaded = 0;
+        curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD, &uploaded);
+        curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD, &downloaded);
+#endif
+        info.bytesSent = uint64_t(requestSize) + uint64_t(uploaded);
+        info.bytesReceived = uint64_t(headerSize) + uint64_t(downloaded);
+    }
+
+    // More handles than this are only left idle after bursts, they are closed instead.
+    const size_t MAX_IDLE_HANDLES = 64;
+
+#if LIBCURL_VERSION_NUM >= 0x074400
+#define KEYSTONE_HAS_MULTIPLEXER 1
+
+    /**
+     * Drives the transfers of many threads with one multi handle on a thread
+     * of its own, so that curl can multiplex them over HTTP/2 connections.
+     * Needs curl_multi_poll and curl_multi_wakeup (curl 7.68).
+     */
+    class Multiplexer {
+    public:
+        explicit Multiplexer(unsigned maxStreams) : stopping(false) {
+            multi = curl_multi_init();
+            if (multi == NULL) {
+                throw keystone::impl::Error(keystone::impl::ERROR_UNKNOWN, "Could not initialize curl");
+            }
+            curl_multi_setopt(multi, CURLMOPT_PIPELINING, long(CURLPIPE_MULTIPLEX));
+            if (maxStreams > 0) {
+                curl_multi_setopt(multi, CURLMOPT_MAX_CONCURRENT_STREAMS, long(maxStreams));
+            }
+            thread = std::thread(&Multiplexer::run, this);
+        }
+
+        /**
+         * Must not be called while transfers are in progress.
+         */
+        ~Multiplexer() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            curl_multi_wakeup(multi);
+            thread.join();
+            curl_multi_cleanup(multi);
+        }
+
+        /**
+         * Runs the transfer of \c curl (which must not be in use elsewhere) and waits for it.
+         */
+        CURLcode perform(CURL* curl) {
+            Transfer transfer(curl);
+            curl_easy_setopt(curl, CURLOPT_PRIVATE, &transfer);
+            std::unique_lock<std::mutex> lock(mutex);
+            pending.push_back(&transfer);
+            lock.unlock();
+            curl_multi_wakeup(multi);
+            lock.lock();
+            while (!transfer.done) {
+                transfer.finished.wait(lock);
+            }
+            return transfer.result;
+        }
+
+    private:
+        struct Transfer {
+            explicit Transfer(CURL* curl) : curl(curl), result(CURLE_OK), done(false) {}
+
+            CURL* curl;
+            CURLcode result;
+            bool done;
+            std::condition_variable finished;
+        };
+
+        void complete(Transfer* transfer, CURLcode result) {
+            std::lock_guard<std::mutex> lock(mutex);
+            transfer->result = result;
+            transfer->done = true;
+            // Under the lock, as the waiter destroys the transfer as soon as it sees it done.
+            transfer->finished.notify_one();
+        }
+
+        void run() {
+            std::vector<Transfer*> adding;
+            int running = 0;
+            while (true) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (stopping && running == 0 && pending.empty()) {
+                        return;
+                    }
+                    adding.swap(pending);
+                }
+                for (size_t i = 0; i < adding.size(); i++) {
+                    if (curl_multi_add_handle(multi, adding[i]->curl) != CURLM_OK) {
+                        complete(adding[i], CURLE_FAILED_INIT);
+                    }
+                }
+                adding.clear();
+
+                curl_multi_perform(multi, &running);
+                CURLMsg* message;
+                int queued;
+                while ((message = curl_multi_info_read(multi, &queued)) != NULL) {
+                    if (message->msg != CURLMSG_DONE) {
+                        continue;
+                    }
+                    CURL* curl = message->easy_handle;
+                    CURLcode result = message->data.result;
+                    char* transfer = NULL;
+                    curl_easy_getinfo(curl, CURLINFO_PRIVATE, &transfer);
+                    curl_multi_remove_handle(multi, curl);
+                    complete(reinterpret_cast<Transfer*>(transfer), result);
+                }
+                curl_multi_poll(multi, NULL, 0, 1000, NULL);
+            }
+        }
+
+        CURLM* multi;
+        std::mutex mutex;
+        std::vector<Transfer*> pending;
+        bool stopping;
+        std::thread thread;
+    };
+#endif
+
+    // In lack of unique-pointers:
+    struct CurlListHolder {
+        struct curl_slist* list;
+        CurlListHolder() {
+            list = NULL;
+        }
+        ~CurlListHolder() {
+            if(list != NULL) {
+                curl_slist_free_all(list);
+            }
+        }
+    };
+
+}
+
+namespace keystone { namespace impl {
+
+    struct CurlTransport::Shared {
+        Shared(Http2Mode mode, unsigned maxStreams) : mode(mode), share(NULL) {
+#if defined(KEYSTONE_HAS_MULTIPLEXER)
+            if (mode != HTTP2_OFF) {
+                // The multi handle has its own connection pool, DNS and TLS session caches.
+                multiplexer.reset(new Multiplexer(maxStreams));
+                return;
+            }
+#endif
+            share = curl_share_init();
+            if (share != NULL) {
+                curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lock);
+                curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlock);
+                curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+                curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+                curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+                curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+            }
+        }
+
+        ~Shared() {
+#if defined(KEYSTONE_HAS_MULTIPLEXER)
+            multiplexer.reset();
+#endif
+            // The handles use the share handle, so they go first.
+            for (size_t i = 0; i < idle.size(); i++) {
+                curl_easy_cleanup(idle[i]);
+            }
+            if (share != NULL) {
+                curl_share_cleanup(share);
+            }
+        }
+
+        /**
+         * An idle handle, or a new one attached to the share handle. NULL if curl fails.
+         */
+        CURL* acquire() {
+            {
+                std::lock_guard<std::mutex> guard(poolMutex);
+                if (!idle.empty()) {
+                    CURL* curl = idle.back();
+                    idle.pop_back();
+                    return curl;
+                }
+            }
+            CURL* curl = curl_easy_init();
+            if (curl != NULL) {
+                // Timeouts must not use signals (SIGALRM) in a multithreaded process.
+                curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+                if (share != NULL) {
+                    curl_easy_setopt(curl, CURLOPT_SHARE, share);
+                }
+            }
+            return curl;
+        }
+
+        void release(CURL* curl) {
+            {
+                std::lock_guard<std::mutex> guard(poolMutex);
+                if (idle.size() < MAX_IDLE_HANDLES) {
+                    idle.push_back(curl);
+                    return;
+                }
+            }
+            curl_easy_cleanup(curl);
+        }
+
+        // Hands the handle back to the pool when the transfer is done.
+        struct Lease {
+            Lease(Shared& shared) : shared(shared), curl(shared.acquire()) {}
+            ~Lease() {
+                if (curl != NULL) {
+                    shared.release(curl);
+                }
+            }
+
+            Shared& shared;
+            CURL* curl;
+        };
+
+        static void lock(CURL*, curl_lock_data data, curl_lock_access, void* shared) {
+            static_cast<Shared*>(shared)->locks[data].lock();
+        }
+
+        static void unlock(CURL*, curl_lock_data data, void* shared) {
+            static_cast<Shared*>(shared)->locks[data].unlock();
+        }
+
+        /**
+         * Runs the transfer, on the thread of the multiplexer if there is one.
+         */
+        CURLcode perform(CURL* curl) {
+#if defined(KEYSTONE_HAS_MULTIPLEXER)
+            if (multiplexer) {
+                return multiplexer->perform(curl);
+            }
+#endif
+            return curl_easy_perform(curl);
+        }
+
+        const Http2Mode mode;
+        CURLSH* share;
+#if defined(KEYSTONE_HAS_MULTIPLEXER)
+        std::unique_ptr<Multiplexer> multiplexer;
+#endif
+        std::mutex locks[CURL_LOCK_DATA_LAST];
+        std::mutex poolMutex;
+        std::vector<CURL*> idle;
+    };
+
+    CurlTransport::CurlTransport()
+        : userDefinedCaCertFile(false), http2Mode(HTTP2_OFF), maxStreams(0) {
+        // Otherwise the first curl_easy_init calls it, on whichever thread gets there first.
+        std::call_once(curlInitialized, []() {
+            if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+                throw Error(ERROR_UNKNOWN, "Could not initialize curl");
+            }
+        });
+        shared = std::make_shared<Shared>(HTTP2_OFF, 0);
+    }
+
+    void CurlTransport::setCaCertFileName(const std::string &caCertFileName) {
+        this->caCertFileName = caCertFileName;
+        userDefinedCaCertFile = true;
+        // The pooled handles (and copies of this transport) keep the old CA file.
+        shared = std::make_shared<Shared>(http2Mode, maxStreams);
+    }
+
+    Status CurlTransport::setHttp2(Http2Mode mode, unsigned maxStreams) {
+        if (mode != HTTP2_OFF) {
+#if defined(KEYSTONE_HAS_MULTIPLEXER)
+            if ((curl_version_info(CURLVERSION_NOW)->features & CURL_VERSION_HTTP2) == 0) {
+                return Status(ERROR_INVALID_ARGUMENT, "curl was built without HTTP/2 support");
+            }
+            // curl 7.88 fails every stream but the first on a reused h2c connection.
+            int version = curl_version_info(CURLVERSION_NOW)->version_num;
+            if (mode == HTTP2_PRIOR_KNOWLEDGE && version >= 0x075800 && version < 0x080000) {
+                return Status(ERROR_INVALID_ARGUMENT, "HTTP/2 prior knowledge does not work with curl 7.88");
+            }
+#else
+            return Status(ERROR_INVALID_ARGUMENT, "HTTP/2 needs curl 7.68 or later");
+#endif
+        }
+        http2Mode = mode;
+        this->maxStreams = maxStreams;
+        shared = std::make_shared<Shared>(http2Mode, maxStreams);
+        return Status();
+    }
+
+    Status CurlTransport::post(const std::string& endpoint,
+                             const std::string& request, std::string& response,
+                             TransferInfo* info) {
+        Shared::Lease curl(*shared);
+        if (!curl.curl) {
+            return Status(ERROR_UNKNOWN, "Could not initialize curl");
+        }
+
+        response.clear();
+
+        curl_easy_setopt(curl.curl, CURLOPT_URL, endpoint.c_str());
+
+        curl_easy_setopt(curl.curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl.curl, CURLOPT_POST, 1L);
+        curl_easy_setopt(curl.curl, CURLOPT_WRITEFUNCTION, writeToString);
+        curl_easy_setopt(curl.curl, CURLOPT_WRITEDATA, &response);
+
+        // The request outlives the transfer, so curl can send it without copying.
+        curl_easy_setopt(curl.curl, CURLOPT_POSTFIELDS, request.data());
+        curl_easy_setopt(curl.curl, CURLOPT_POSTFIELDSIZE, long(request.size()));
+
+        // Check environmental variable or if the user has provided certification
+        // file name:
+        char* envCaCertFileName;
+        envCaCertFileName = getenv("KEYSTONE_SET_CA_CERTIFICATE_FILENAME");
+        if (this->userDefinedCaCertFile) {
+            curl_easy_setopt(curl.curl, CURLOPT_CAINFO, this->caCertFileName.c_str());
+        }
+        else if ( envCaCertFileName != NULL ) {
+            curl_easy_setopt(curl.curl, CURLOPT_CAINFO, envCaCertFileName);
+        }
+
+
+        // Set headers:
+        CurlListHolder headers;
+
+        headers.list = curl_slist_append(headers.list, "Accept: text/xml");
+        headers.list = curl_slist_append(headers.list, "Content-Type: text/xml");
+
+        curl_easy_setopt(curl.curl, CURLOPT_HTTPHEADER, headers.list);
+
+        switch (shared->mode) {
+        case HTTP2_NEGOTIATE:
+            curl_easy_setopt(curl.curl, CURLOPT_HTTP_VERSION, long(CURL_HTTP_VERSION_2TLS));
+            break;
+        case HTTP2_PRIOR_KNOWLEDGE:
+            curl_easy_setopt(curl.curl, CURLOPT_HTTP_VERSION, long(CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE));
+            break;
+        default:
+            break;
+        }
+        if (shared->mode != HTTP2_OFF) {
+            // Wait for a stream on a connection in progress rather than opening another one.
+            curl_easy_setopt(curl.curl, CURLOPT_PIPEWAIT, 1L);
+        }
+        CURLcode performResult = shared->perform(curl.curl);
+
+        if (info != NULL) {
+            getTransferInfo(curl.curl, *info);
+        }
+        if (performResult != CURLE_OK) {
+            // curl_easy_strerror gives static strings.
+            return Status(classifyCurlError(performResult), curl_easy_strerror(performResult), 0, performResult);
+        }
+
+        long returnCode = 0;
+        curl_easy_getinfo(curl.curl, CURLINFO_RESPONSE_CODE, &returnCode);
+
+        if (returnCode != 200 && returnCode != 203) {
+            return Status(classifyHttpStatus(returnCode), "Unexpected HTTP status", returnCode);
+        }
+        return Status();
+    }
+}}
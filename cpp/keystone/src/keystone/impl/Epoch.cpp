@@ -0,0 +1,94 @@
+#include "keystone/impl/Epoch.hpp"
+
+
+namespace {
+    using keystone::impl::EpochDomain;
+
+    /**
+     * Hands the slot of a thread back to the domain when the thread exits.
+     */
+    struct SlotOwner {
+        SlotOwner() : slot(NULL) {}
+
+        ~SlotOwner() {
+            if (slot != NULL) {
+                slot->epoch.store(0, std::memory_order_release);
+                slot->inUse.store(false, std::memory_order_release);
+            }
+        }
+
+        EpochDomain::Slot* slot;
+    };
+
+    thread_local SlotOwner slotOwner;
+}
+
+
+namespace keystone { namespace impl {
+
+    EpochDomain& EpochDomain::instance() {
+        // Never destroyed, so that threads exiting after main() can still hand back their slots.
+        static EpochDomain* domain = new EpochDomain();
+        return *domain;
+    }
+
+    EpochDomain::EpochDomain() : epoch(1) {}
+
+    EpochDomain::Slot* EpochDomain::localSlot() {
+        if (slotOwner.slot == NULL) {
+            slotOwner.slot = acquireSlot();
+        }
+        return slotOwner.slot;
+    }
+
+    EpochDomain::Slot* EpochDomain::acquireSlot() {
+        std::lock_guard<std::mutex> lock(slotMutex);
+        for (size_t i = 0; i < slots.size(); i++) {
+            bool expected = false;
+            if (slots[i].inUse.compare_exchange_strong(expected, true)) {
+                return &slots[i];
+            }
+        }
+        slots.emplace_back();
+        slots.back().inUse.store(true);
+        return &slots.back();
+    }
+
+    void EpochDomain::retire(void* node, Deleter deleter) {
+        std::vector<Retired> expired;
+        {
+            std::lock_guard<std::mutex> lock(retireMutex);
+            Retired retired = { node, deleter };
+            limbo[epoch.load(std::memory_order_relaxed) % 3].push_back(retired);
+            if (tryAdvance()) {
+                // The bucket of the new epoch holds what was retired three epochs ago.
+                expired.swap(limbo[epoch.load(std::memory_order_relaxed) % 3]);
+            }
+        }
+        // Free outside the lock, the deleters may be slow.
+        for (size_t i = 0; i < expired.size(); i++) {
+            expired[i].deleter(expired[i].node);
+        }
+    }
+
+    size_t EpochDomain::getPendingCount() const {
+        std::lock_guard<std::mutex> lock(retireMutex);
+        return limbo[0].size() + limbo[1].size() + limbo[2].size();
+    }
+
+    bool EpochDomain::tryAdvance() {
+        uint64_t current = epoch.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        {
+            std::lock_guard<std::mutex> lock(slotMutex);
+            for (size_t i = 0; i < slots.size(); i++) {
+                uint64_t pinned = slots[i].epoch.load(std::memory_order_acquire);
+                if (pinned != 0 && pinned != current) {
+                    return false;
+                }
+            }
+        }
+        epoch.store(current + 1, std::memory_order_release);
+        return true;
+    }
+}}
@@ -0,0 +1,20 @@
+#include "keystone/impl/Error.hpp"
+
+namespace keystone { namespace impl {
+
+    const char* errorName(ErrorCode code) {
+        switch (code) {
+        case ERROR_NONE:                return "none";
+        case ERROR_UNKNOWN:             return "unknown";
+        case ERROR_INVALID_CREDENTIALS: return "invalid_credentials";
+        case ERROR_INVALID_TOKEN:       return "invalid_token";
+        case ERROR_HTTP:                return "http";
+        case ERROR_TIMEOUT:             return "timeout";
+        case ERROR_CONNECTION:          return "connection";
+        case ERROR_PARSE:               return "parse";
+        case ERROR_OVERLOADED:          return "overloaded";
+        case ERROR_INVALID_ARGUMENT:    return "invalid_argument";
+        default:                        return "unknown";
+        }
+    }
+}}
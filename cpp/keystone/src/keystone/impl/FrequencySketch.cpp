@@ -0,0 +1,82 @@
+#include "keystone/impl/FrequencySketch.hpp"
+#include "keystone/impl/Hash.hpp"
+
+
+namespace {
+    // Sixteen bits of the mixed hash pick the word of each of the four counters.
+    const size_t MAX_WIDTH = size_t(1) << 16;
+
+    size_t roundUpToPowerOfTwo(size_t value) {
+        size_t result = 1;
+        while (result < value) {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    /**
+     * Counter i of a hash is in word (mixed >> 16i) and in the i-th group of
+     * four counters of that word, so the four never share a nibble.
+     */
+    unsigned shiftOf(uint64_t hash, unsigned i) {
+        return (i * 4 + static_cast<unsigned>((hash >> (2 * i)) & 3)) * 4;
+    }
+}
+
+
+namespace keystone { namespace impl {
+
+    FrequencySketch::FrequencySketch(size_t expectedEntries) : additions(0) {
+        width = roundUpToPowerOfTwo(expectedEntries > 0 ? expectedEntries : 1);
+        if (width > MAX_WIDTH) {
+            width = MAX_WIDTH;
+        }
+        sampleSize = 10 * uint64_t(expectedEntries > 0 ? expectedEntries : 1);
+        table.reset(new std::atomic<uint64_t>[width]);
+        for (size_t i = 0; i < width; i++) {
+            table[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void FrequencySketch::increment(uint64_t hash) {
+        uint64_t mixed = mix64(hash);
+        bool added = false;
+        for (unsigned i = 0; i < 4; i++) {
+            std::atomic<uint64_t>& word = table[(mixed >> (16 * i)) & (width - 1)];
+            unsigned shift = shiftOf(hash, i);
+            uint64_t value = word.load(std::memory_order_relaxed);
+            if (((value >> shift) & 15) != 15) {
+                word.store(value + (uint64_t(1) << shift), std::memory_order_relaxed);
+                added = true;
+            }
+        }
+        if (added) {
+            uint64_t count = additions.load(std::memory_order_relaxed) + 1;
+            additions.store(count, std::memory_order_relaxed);
+            if (count >= sampleSize) {
+                halve();
+            }
+        }
+    }
+
+    unsigned FrequencySketch::frequency(uint64_t hash) const {
+        uint64_t mixed = mix64(hash);
+        unsigned result = 15;
+        for (unsigned i = 0; i < 4; i++) {
+            uint64_t value = table[(mixed >> (16 * i)) & (width - 1)].load(std::memory_order_relaxed);
+            unsigned count = static_cast<unsigned>((value >> shiftOf(hash, i)) & 15);
+            if (count < result) {
+                result = count;
+            }
+        }
+        return result;
+    }
+
+    void FrequencySketch::halve() {
+        additions.store(sampleSize / 2, std::memory_order_relaxed);
+        for (size_t i = 0; i < width; i++) {
+            uint64_t value = table[i].load(std::memory_order_relaxed);
+            table[i].store((value >> 1) & UINT64_C(0x7777777777777777), std::memory_order_relaxed);
+        }
+    }
+}}
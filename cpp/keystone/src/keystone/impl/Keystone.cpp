@@ -1,77 +1,87 @@
-#define NOMINMAX
 #include "keystone/impl/Keystone.hpp"
-#include "pugi4lunch/pugixml.hpp"
-#include <curl/curl.h>
+#include "keystone/impl/Soap.hpp"
+#include "keystone/impl/Probes.hpp"
+#include "keystone/impl/Hash.hpp"
+#include "keystone/impl/CacheFile.hpp"
+#include "keystone/impl/Clock.hpp"
+#include "keystone/impl/TokenBucket.hpp"
 
-#include <stdlib.h>
-#include <stdexcept>
-#include <sstream>
-#include <numeric>
-#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
 
 
-#define THROW(msg) { \
-    std::stringstream ss; \
-    ss<< "At " << __FILE__ << "(" << __LINE__ << "): \"" << msg << "\""; \
-    throw std::runtime_error(ss.str()); \
-} 
-
-
-#define KEYSTONE_CURL_SAFE_CALL(x) {\
-    CURLcode result = x; \
-    if ( result != CURLE_OK) { \
-    THROW("Curl error code: " << result); \
-    } \
-} 
-
 namespace {
-    size_t writeToSS(char* dataPointer, size_t size, size_t nmemb, void* stringStreamAsVoid) {
-
-        std::stringstream* ss = static_cast<std::stringstream*>(stringStreamAsVoid);
+    // Prewarm lookups mostly wait on keystone, but more threads than this only add contention.
+    const unsigned PREWARM_THREADS_PER_CORE = 4;
 
-        ss->write(dataPointer, size * nmemb);
-        return size * nmemb;
+    keystone::impl::RequestTiming* addTiming(keystone::impl::RequestTimings* timings,
+                                             keystone::impl::Operation operation) {
+        return timings != NULL ? timings->add(operation) : NULL;
     }
 
-    size_t readFromSS(void *ptr, size_t size, size_t nmemb, void *stringStreamAsVoid) {
-        std::stringstream* ss = static_cast<std::stringstream*>(stringStreamAsVoid);
-        size_t beginIndex = ss->tellg();
-        ss->seekg(0, ss->end);
-        size_t currentSize = (size_t)ss->tellg() - beginIndex;
-        ss->seekg(beginIndex);
-
-        size_t sizeToRead = std::min(currentSize, size * nmemb);
+    void recordTransfer(keystone::impl::OperationMetrics& metrics,
+                        const keystone::impl::TransferInfo& transfer) {
+        metrics.bytesSent.fetch_add(transfer.bytesSent, std::memory_order_relaxed);
+        metrics.bytesReceived.fetch_add(transfer.bytesReceived, std::memory_order_relaxed);
+        if (transfer.newConnections > 0) {
+            metrics.connectionsOpened.fetch_add(transfer.newConnections, std::memory_order_relaxed);
+            if (transfer.appConnect > 0) {
+                metrics.tlsHandshakes.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        else if (transfer.httpStatus != 0) {
+            metrics.connectionsReused.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
 
-        ss->read((char*) ptr, sizeToRead);
-        return sizeToRead;
+    void recordError(keystone::impl::OperationMetrics& metrics, const keystone::impl::Hooks& hooks,
+                     keystone::impl::Operation operation, keystone::impl::ErrorCode code,
+                     double seconds) {
+        metrics.errors[code].fetch_add(1, std::memory_order_relaxed);
+        metrics.latency.record(seconds);
+        keystone::impl::fireHook(hooks.requestEnd, hooks.userData, operation, seconds, code);
     }
 
-    // In lack of unique-pointers:
-    struct CurlHolder {
-        CURL* curl;
-        CurlHolder(CURL* curl_) {
-            curl = curl_;
+    void recordCacheLookup(keystone::impl::OperationMetrics& metrics, const keystone::impl::Hooks& hooks,
+                           keystone::impl::Operation operation, bool hit) {
+        KEYSTONE_PROBE_CACHE_LOOKUP(operation, hit);
+        if (hit) {
+            metrics.cacheHits.fetch_add(1, std::memory_order_relaxed);
+            keystone::impl::fireHook(hooks.cacheHit, hooks.userData, operation);
         }
-        ~CurlHolder() {
-            if(curl != NULL) {
-                curl_easy_cleanup(curl);
-            }
+        else {
+            metrics.cacheMisses.fetch_add(1, std::memory_order_relaxed);
+            keystone::impl::fireHook(hooks.cacheMiss, hooks.userData, operation);
         }
-    };
+    }
 
-    // In lack of unique-pointers:
-    struct CurlListHolder {
-        struct curl_slist* list;
-        CurlListHolder() {
-            list = NULL;
+    /**
+     * Keeps the refresh thread of a session cache from logging in (with the transport, the hooks
+     * and the caches) while a setter changes them.
+     */
+    class RefreshPause {
+    public:
+        explicit RefreshPause(keystone::impl::SessionCache* cache) : cache(cache) {
+            if (cache != NULL) {
+                cache->pause();
+            }
         }
-        ~CurlListHolder() {
-            if(list != NULL) {
-                curl_slist_free_all(list);
+
+        ~RefreshPause() {
+            if (cache != NULL) {
+                cache->resume();
             }
         }
-    };
 
+    private:
+        RefreshPause(const RefreshPause&);
+        RefreshPause& operator=(const RefreshPause&);
+
+        keystone::impl::SessionCache* cache;
+    };
 }
 
 
@@ -81,303 +91,529 @@ namespace keystone { namespace impl {
     *            this is typically on the form "http://something.com/keystone"
     *            (note we omit the "v2.0" part here)
     */
-    Keystone::Keystone(const std::string& url) {
+    Keystone::Keystone(const std::string& url)
+        : cacheKey(randomSipKey()), tokenCacheL1Entries(0), tokenCacheL1Staleness(0), tokenCacheMemoryLimit(0),
+          revocations(0) {
         if(url.size() == 0) {
-            THROW("Illegal length of URL");
+            throw Error(ERROR_INVALID_ARGUMENT, "Illegal length of URL");
         }
         this->url = url;
-        
+        metrics = Metrics::instance().endpoint(url);
+
         // TODO: Check that url is correct. Should end with "?wsdl"
+    }
 
-        userDefinedCaCertFile = false;
 
+    template<class Parse>
+    Status Keystone::call(Operation operation, const std::string& request, double envelopeBuild,
+                          RequestTimings* timings, Parse parse) {
+        OperationMetrics& operationMetrics = metrics->operations[operation];
+        InFlightScope inFlight(operationMetrics);
+        operationMetrics.requests.fetch_add(1, std::memory_order_relaxed);
+        fireHook(hooks.requestStart, hooks.userData, operation);
+        Stopwatch callTime;
+
+        TransferInfo transfer;
+        std::string response;
+        KEYSTONE_PROBE_REQUEST_BEGIN(operation, request.size(), url.c_str());
+        Status status = transport.post(url, request, response, &transfer);
+        KEYSTONE_PROBE_REQUEST_END(operation, transfer.httpStatus, transfer.bytesSent, transfer.bytesReceived);
+        recordTransfer(operationMetrics, transfer);
+        if (!status.isOk()) {
+            status = soap::classifyFailure(operation, status, response);
+            recordError(operationMetrics, hooks, operation, status.code, envelopeBuild + callTime.seconds());
+            return status;
+        }
+
+        Stopwatch parseTime;
+        KEYSTONE_PROBE_PARSE_BEGIN(operation, response.size());
+        status = parse(response);
+        KEYSTONE_PROBE_PARSE_END(operation, status.isOk());
+        if (!status.isOk()) {
+            recordError(operationMetrics, hooks, operation, status.code, envelopeBuild + callTime.seconds());
+            return status;
+        }
+        double parseSeconds = parseTime.seconds();
+        double callSeconds = envelopeBuild + callTime.seconds();
+        operationMetrics.latency.record(callSeconds);
+        fireHook(hooks.requestEnd, hooks.userData, operation, callSeconds);
+
+        RequestTiming* timing = addTiming(timings, operation);
+        if (timing != NULL) {
+            timing->nameLookup = transfer.nameLookup;
+            timing->connect = transfer.connect;
+            timing->appConnect = transfer.appConnect;
+            timing->startTransfer = transfer.startTransfer;
+            timing->total = transfer.total;
+            timing->envelopeBuild = envelopeBuild;
+            timing->parse = parseSeconds;
+        }
+        return status;
     }
 
 
     /**
     * Logs the user in and returns a sessionToken
     */
-    void  Keystone::login(const std::string& username, 
+    Status Keystone::login(const std::string& username,
         const std::string& password,
         const std::string& tenantName,
-        KeystoneUserInfo& info) {
-
-            std::stringstream inputXML;
-
-            inputXML << "<?xml version='1.0' encoding='UTF-8'?>\n"
-                     << "<S:Envelope xmlns:S='http://schemas.xmlsoap.org/soap/envelope/' xmlns:SOAP-ENV='http://schemas.xmlsoap.org/soap/envelope/'>\n"
-                     << "<SOAP-ENV:Header/>\n"
-                     << "<S:Body>\n"
-                     << "<ns2:getSessionToken xmlns:ns2='http://authmanager.sintef.no/'>\n"
-                     << "<ns2:username>" << username << "</ns2:username>\n"
-                     << "<ns2:password>"<< password << "</ns2:password>\n"
-                     << "<ns2:project>" << tenantName << "</ns2:project>\n"
-                     << "</ns2:getSessionToken>\n"
-                     <<"</S:Body>\n"
-                     << "</S:Envelope>\n";
-
-            std::stringstream output;
-            write(url, info, inputXML, output);
-
-            pugi4lunch::pugi::xml_document document;
-            if (!document.load(output)) {
-                THROW("Could not parse xml document returned from server");
+        KeystoneUserInfo& info,
+        RequestTimings* timings) {
+
+            uint64_t revocationsBefore = revocations.load(std::memory_order_acquire);
+            Stopwatch buildTime;
+            std::string request;
+            soap::buildGetSessionTokenRequest(username, password, tenantName, request);
+
+            std::string sessionToken;
+            Status status = call(OPERATION_LOGIN, request, buildTime.seconds(), timings,
+                 [&sessionToken](std::string& response) {
+                     return soap::parseGetSessionTokenResponse(response, sessionToken);
+                 });
+            if (!status.isOk()) {
+                return status;
             }
 
-            //printXML(document.root(), 0);
-
-            pugi4lunch::pugi::xml_node envelopeNode = document.child("S:Envelope");
+            std::vector<std::string> roles;
+            status = getUserRoles(username, tenantName, sessionToken, roles, timings);
+            if (!status.isOk()) {
+                return status;
+            }
 
-            if(!envelopeNode) {
-                THROW("Unexpected XML document structure");
+            info = KeystoneUserInfo(username, sessionToken, roles);
+            if (tokenCache || sharedCache) {
+                storeInCaches(keyOf(tenantName, sessionToken), info, revocationsBefore);
             }
+            return status;
+    }
 
-            pugi4lunch::pugi::xml_node bodyNode = envelopeNode.child("S:Body");
 
-            if(!bodyNode) {
-                THROW("Unexpected XML document structure");
+    Status Keystone::sessionLogin(const std::string& username,
+        const std::string& password,
+        const std::string& tenantName,
+        KeystoneUserInfo& info,
+        RequestTimings* timings) {
+
+            if (!sessionCache) {
+                return login(username, password, tenantName, info, timings);
             }
+            bool cached = false;
+            Status status = sessionCache->login(username, password, tenantName, info, timings, cached);
+            recordCacheLookup(metrics->operations[OPERATION_LOGIN], hooks, OPERATION_LOGIN, cached);
+            return status;
+    }
 
-            pugi4lunch::pugi::xml_node responseNode= bodyNode.child("ns2:getSessionTokenResponse");
 
-            if(!responseNode) {
-                THROW("Unexpected XML document structure");
+    /**
+    * Gets the username of a sessionToken.
+    */
+    Status Keystone::getUserInfo(const std::string& tenantName,
+        const std::string& sessionToken, KeystoneUserInfo& info,
+        RequestTimings* timings) {
+
+            if (!tokenFormat.isValid(sessionToken.data(), sessionToken.size())) {
+                metrics->operations[OPERATION_GET_USERNAME].rejectedLocally.fetch_add(1, std::memory_order_relaxed);
+                return Status(ERROR_INVALID_TOKEN, "The session token is malformed");
             }
 
-            pugi4lunch::pugi::xml_node returnNode = responseNode.child("return");
-            if (!returnNode) {
-                THROW("Unexpected XML document structure");
+            uint64_t revocationsBefore = revocations.load(std::memory_order_acquire);
+            CacheKey key = { 0, 0 };
+            if (tokenCache || sharedCache || negativeCache) {
+                OperationMetrics& operationMetrics = metrics->operations[OPERATION_GET_USERNAME];
+                key = keyOf(tenantName, sessionToken);
+                // The caches keep no tokens, and neither do the userinfos handed out here.
+                KeystoneUserInfo cached;
+                if (tokenCache && tokenCache->find(key, cached)) {
+                    info.swap(cached);
+                    recordCacheLookup(operationMetrics, hooks, OPERATION_GET_USERNAME, true);
+                    return Status();
+                }
+                if (sharedCache && sharedCache->find(key, cached)) {
+                    if (tokenCache) {
+                        // Under purgeMutex, so that no purge runs between the check and the insert.
+                        // A hit does not wait for a purge: the refill is skipped instead.
+                        std::unique_lock<std::mutex> lock(purgeMutex, std::try_to_lock);
+                        if (lock.owns_lock() && revocations.load(std::memory_order_acquire) == revocationsBefore) {
+                            tokenCache->insert(key, cached);
+                        }
+                    }
+                    info.swap(cached);
+                    recordCacheLookup(operationMetrics, hooks, OPERATION_GET_USERNAME, true);
+                    return Status();
+                }
+                if (negativeCache && negativeCache->contains(key.low)) {
+                    recordCacheLookup(operationMetrics, hooks, OPERATION_GET_USERNAME, true);
+                    return Status(ERROR_INVALID_TOKEN, "The session token was recently rejected");
+                }
+                recordCacheLookup(operationMetrics, hooks, OPERATION_GET_USERNAME, false);
             }
 
-            pugi4lunch::pugi::xml_node tokenNode = returnNode.first_child();
-            if (!tokenNode) {
-                THROW("Unexpected XML document structure");
+            Stopwatch buildTime;
+            std::string request;
+            soap::buildGetUsernameRequest(sessionToken, request);
+
+            std::string username;
+            Status status = call(OPERATION_GET_USERNAME, request, buildTime.seconds(), timings,
+                 [&username](std::string& response) {
+                     return soap::parseGetUsernameResponse(response, username);
+                 });
+            std::vector<std::string> roles;
+            if (status.isOk()) {
+                status = getUserRoles(username, tenantName, sessionToken, roles, timings);
+            }
+            if (!status.isOk()) {
+                if (status.code == ERROR_INVALID_TOKEN && negativeCache) {
+                    negativeCache->insert(key.low);
+                }
+                return status;
             }
 
-            std::string sessionToken = tokenNode.value();
-            if(sessionToken.size() == 0) {
-                THROW("UnexpectedXML document structure");
+            info = KeystoneUserInfo(username, std::string(), roles);
+            if (tokenCache || sharedCache) {
+                storeInCaches(key, info, revocationsBefore);
             }
-            info.setToken(sessionToken);
+            return status;
+    }
 
-            info.setUsername(username);
+    Status Keystone::getRoles(const std::string &sessionToken, std::vector<std::string> &roles,
+                              RequestTimings* timings) {
+        Stopwatch buildTime;
+        std::string request;
+        soap::buildGetRolesRequest(sessionToken, request);
 
-            getRoles(url,  sessionToken, info);
+        return call(OPERATION_GET_ROLES, request, buildTime.seconds(), timings,
+             [&roles](std::string& response) {
+                 return soap::parseGetRolesResponse(response, roles);
+             });
     }
 
 
-    void Keystone::printXML(pugi4lunch::pugi::xml_node node, int intendation) {
-        std::string space = "";
-        for (int i = 0; i < intendation; i++) {
-            space = space + "  ";
+    Status Keystone::getUserRoles(const std::string& username, const std::string& tenantName,
+                                  const std::string& sessionToken, std::vector<std::string>& roles,
+                                  RequestTimings* timings) {
+        if (!roleCache || tenantName.empty()) {
+            // Without a tenant name, tokens scoped to different projects would share their roles.
+            return getRoles(sessionToken, roles, timings);
         }
-        std::cout << space << "NODE" << std::endl;
-        std::cout << space << "name: " << node.name() << " - value: " << node.value() << std::endl;
-        space = space + "  ";
-        std::cout << space << "ATTRIBUTES" << std::endl;
-        for (pugi4lunch::pugi::xml_attribute a = node.first_attribute(); a; a = a.next_attribute()) {
-            std::cout << space << "name: " << a.name() << " - value: " << a.as_string() << std::endl;
+        OperationMetrics& operationMetrics = metrics->operations[OPERATION_GET_ROLES];
+        if (roleCache->find(username, tenantName, roles)) {
+            recordCacheLookup(operationMetrics, hooks, OPERATION_GET_ROLES, true);
+            return Status();
         }
-        for (pugi4lunch::pugi::xml_node n = node.first_child(); n; n = n.next_sibling()) {
-            printXML(n, intendation +1);
+        recordCacheLookup(operationMetrics, hooks, OPERATION_GET_ROLES, false);
+        Status status = getRoles(sessionToken, roles, timings);
+        if (status.isOk()) {
+            roleCache->insert(username, tenantName, roles);
         }
+        return status;
     }
 
 
-    /**
-    * Gets the username of a sessionToken.
-    * \throws runtime_error if the username could not be acquired (typically invalid sessiontoken)
-    */
-    void Keystone::getUserInfo(const std::string& tenantName, 
-        const std::string& sessionToken, KeystoneUserInfo& info) {
-
-            std::stringstream inputXML;
-
-            inputXML << "<?xml version='1.0' encoding='UTF-8'?>\n"
-                     << "<S:Envelope xmlns:S='http://schemas.xmlsoap.org/soap/envelope/' xmlns:SOAP-ENV='http://schemas.xmlsoap.org/soap/envelope/'>\n"
-                     << "<SOAP-ENV:Header/>\n"
-                     << "<S:Body>\n"
-                     << "<ns2:getUsername xmlns:ns2='http://authmanager.sintef.no/'>\n"
-                     << "<ns2:sessionToken>" << sessionToken << "</ns2:sessionToken>\n"
-                     << "</ns2:getUsername>\n"
-                     <<"</S:Body>\n"
-                     << "</S:Envelope>\n";
-
-
-            std::stringstream output;
-
-            std::string tokenUrl = url;
-            write(tokenUrl, info, inputXML, output);
-
-            pugi4lunch::pugi::xml_document document;
-            if (!document.load(output)) {
-                THROW("Could not parse xml document returned from server");
-            }
-
-            //printXML(document.root(), 0);
-
-            pugi4lunch::pugi::xml_node envelopeNode = document.child("S:Envelope");
-
-            if(!envelopeNode) {
-                THROW("Unexpected XML document structure");
-            }
-
-            pugi4lunch::pugi::xml_node bodyNode = envelopeNode.child("S:Body");
-
-            if(!bodyNode) {
-                THROW("Unexpected XML document structure");
-            }
-
-            pugi4lunch::pugi::xml_node responseNode= bodyNode.child("ns2:getUsernameResponse");
+    CacheKey Keystone::keyOf(const std::string& tenantName, const std::string& sessionToken) const {
+        return makeCacheKey(cacheKey, tenantName.data(), tenantName.size(), sessionToken.data(), sessionToken.size());
+    }
 
-            if(!responseNode) {
-                THROW("Unexpected XML document structure");
-            }
 
-            pugi4lunch::pugi::xml_node returnNode = responseNode.child("return");
-            if (!returnNode) {
-                THROW("Unexpected XML document structure");
-            }
-
-            pugi4lunch::pugi::xml_node usernameNode = returnNode.first_child();
-            if (!usernameNode) {
-                THROW("Unexpected XML document structure");
-            }
+    void Keystone::storeInCaches(const CacheKey& key, const KeystoneUserInfo& info, uint64_t revocationsBefore) {
+        // Stripped once here rather than by each cache (userinfos of lookups have no token).
+        KeystoneUserInfo stored = info.getToken().size != 0 ? info.withoutToken() : info;
+        // Under purgeMutex, so that no purge runs between the check and the inserts.
+        std::lock_guard<std::mutex> lock(purgeMutex);
+        if (revocations.load(std::memory_order_acquire) != revocationsBefore) {
+            // The token may have been revoked after the service vouched for it.
+            return;
+        }
+        if (tokenCache) {
+            tokenCache->insert(key, stored);
+        }
+        if (sharedCache) {
+            sharedCache->insert(key, stored);
+        }
+    }
 
-            std::string username = usernameNode.value();
-            if(username.size() == 0) {
-                THROW("UnexpectedXML document structure");
-            }
-            info.setToken(sessionToken);
 
-            info.setUsername(username);
+    void Keystone::rekey(const SipKey& key) {
+        if (key.k0 == cacheKey.k0 && key.k1 == cacheKey.k1) {
+            return;
+        }
+        cacheKey = key;
+        // Entries made with the old key can no longer be found.
+        if (tokenCache) {
+            tokenCache->clear();
+        }
+        if (negativeCache) {
+            negativeCache->clear();
+        }
+    }
 
-            getRoles(url,  sessionToken, info);
 
+    void Keystone::setCaCertFileName(const std::string &caCertFileName) {
+        RefreshPause pause(sessionCache.get());
+        transport.setCaCertFileName(caCertFileName);
+    }
 
+    Status Keystone::setHttp2(Http2Mode mode, unsigned maxStreams) {
+        RefreshPause pause(sessionCache.get());
+        return transport.setHttp2(mode, maxStreams);
     }
 
-    void Keystone::getRoles(const std::string &url, const std::string &sessionToken,
-                                                KeystoneUserInfo &info) {
-        std::vector<std::string> roles;
-        std::stringstream inputXML;
+    void Keystone::setHooks(const Hooks& hooks) {
+        RefreshPause pause(sessionCache.get());
+        this->hooks = hooks;
+    }
 
-        inputXML << "<?xml version='1.0' encoding='UTF-8'?>\n"
-                 << "<S:Envelope xmlns:S='http://schemas.xmlsoap.org/soap/envelope/' xmlns:SOAP-ENV='http://schemas.xmlsoap.org/soap/envelope/'>\n"
-                 << "<SOAP-ENV:Header/>\n"
-                 << "<S:Body>\n"
-                 << "<ns2:getRoles xmlns:ns2='http://authmanager.sintef.no/'>\n"
-                 << "<ns2:sessionToken>" << sessionToken << "</ns2:sessionToken>\n"
-                 << "</ns2:getRoles>\n"
-                 <<"</S:Body>\n"
-                 << "</S:Envelope>\n";
+    void Keystone::setTokenFormat(const TokenFormat& tokenFormat) {
+        this->tokenFormat = tokenFormat;
+    }
 
-        std::stringstream output;
-        write(url, info, inputXML, output);
+    void Keystone::setNegativeCache(size_t expectedEntries, double ttl) {
+        negativeCache.reset(expectedEntries > 0 ? new NegativeCache(expectedEntries, ttl) : NULL);
+    }
 
-        pugi4lunch::pugi::xml_document document;
-        if (!document.load(output)) {
-            THROW("Could not parse xml document returned from server");
+    void Keystone::setTokenCache(size_t capacity, double ttl) {
+        RefreshPause pause(sessionCache.get());
+        std::lock_guard<std::mutex> lock(purgeMutex);
+        tokenCache.reset(capacity > 0 ? new TokenCache(capacity, ttl) : NULL);
+        if (tokenCache) {
+            tokenCache->setLocalCache(tokenCacheL1Entries, tokenCacheL1Staleness);
+            tokenCache->setMemoryLimit(tokenCacheMemoryLimit);
         }
+    }
 
-        //printXML(document.root(), 0);
-
-        pugi4lunch::pugi::xml_node envelopeNode = document.child("S:Envelope");
-
-        if(!envelopeNode) {
-            THROW("Unexpected XML document structure");
+    Status Keystone::setSharedCache(const std::string& name, size_t capacity, size_t slotSize, double ttl) {
+        RefreshPause pause(sessionCache.get());
+        std::lock_guard<std::mutex> lock(purgeMutex);
+        if (name.empty()) {
+            sharedCache.reset();
+            return Status();
+        }
+        std::unique_ptr<SharedCache> cache(new SharedCache());
+        Status status = cache->open(name, capacity, slotSize, ttl);
+        if (status.isOk()) {
+            rekey(cache->getKey());
+            sharedCache = std::move(cache);
+            // The segment may hold entries revoked before this handle attached.
+            purgeLocked(lastRevoked);
         }
+        return status;
+    }
 
-        pugi4lunch::pugi::xml_node bodyNode = envelopeNode.child("S:Body");
+    void Keystone::setRoleCache(size_t capacity, double ttl) {
+        RefreshPause pause(sessionCache.get());
+        roleCache.reset(capacity > 0 ? new RoleCache(capacity, ttl) : NULL);
+    }
 
-        if(!bodyNode) {
-            THROW("Unexpected XML document structure");
+    void Keystone::setSessionCache(size_t capacity, double lifetime, double refreshAfter) {
+        // Destroyed after the lock is released: its refresh thread may be waiting for the lock
+        // to store a login, and is joined by the destructor.
+        std::unique_ptr<SessionCache> previous;
+        std::lock_guard<std::mutex> lock(purgeMutex);
+        previous = std::move(sessionCache);
+        if (capacity > 0) {
+            sessionCache.reset(new SessionCache(capacity, lifetime, refreshAfter,
+                [this](const std::string& username, const std::string& password, const std::string& tenantName,
+                       KeystoneUserInfo& info, RequestTimings* timings) {
+                    return login(username, password, tenantName, info, timings);
+                }));
         }
+    }
 
-        pugi4lunch::pugi::xml_node responseNode= bodyNode.child("ns2:getRolesResponse");
-
-        if(!responseNode) {
-            THROW("Unexpected XML document structure");
+    Status Keystone::saveCache(const std::string& path) const {
+        std::vector<CachedUserInfo> entries;
+        if (tokenCache) {
+            tokenCache->collect(entries);
+        } else if (sharedCache) {
+            sharedCache->collect(entries);
+        } else {
+            return Status(ERROR_INVALID_ARGUMENT, "No token cache is set up");
         }
+        return cachefile::save(path, cacheKey, entries);
+    }
 
-        // LOOP!
-        for (pugi4lunch::pugi::xml_node returnNode = responseNode.first_child(); returnNode; returnNode = returnNode.next_sibling()) {
-            if (!returnNode) {
-                std::cout << "We shouldn't even be here...";
-                THROW("Unexpected XML document structure");
+    Status Keystone::loadCache(const std::string& path) {
+        if (!tokenCache && !sharedCache) {
+            return Status(ERROR_INVALID_ARGUMENT, "No token cache is set up");
+        }
+        std::vector<CachedUserInfo> entries;
+        SipKey fileKey;
+        Status status = cachefile::load(path, fileKey, entries);
+        if (!status.isOk()) {
+            return status;
+        }
+        RefreshPause pause(sessionCache.get());
+        std::lock_guard<std::mutex> lock(purgeMutex);
+        if (fileKey.k0 != cacheKey.k0 || fileKey.k1 != cacheKey.k1) {
+            // The entries cannot be rekeyed, the tenant names are not in the file.
+            if (sharedCache) {
+                return Status(ERROR_INVALID_ARGUMENT, "The cache file was written with another cache key");
+            }
+            rekey(fileKey);
+        }
+        RevokedEntries revoked(lastRevoked, cacheKey);
+        // Entries are used no longer than the ttl of the cache they go into, the file may have
+        // been written by a handle with a longer one.
+        int64_t now = monotonicNanoseconds();
+        int64_t tokenCacheExpiry = tokenCache ? now + static_cast<int64_t>(tokenCache->getTtl() * 1e9) : 0;
+        int64_t sharedCacheExpiry = sharedCache ? now + static_cast<int64_t>(sharedCache->getTtl() * 1e9) : 0;
+        for (size_t i = 0; i < entries.size(); i++) {
+            // The file may be older than the last revocations.
+            if (revoked.matches(entries[i].key, entries[i].info)) {
+                continue;
             }
-            pugi4lunch::pugi::xml_node roleNode = returnNode.first_child();
-            if (!roleNode) {
-                THROW("Unexpected XML document structure");
+            if (tokenCache) {
+                tokenCache->insert(entries[i].key, entries[i].info, std::min(entries[i].expiresAt, tokenCacheExpiry));
             }
-            std::string role = roleNode.value();
-            if (role.size() == 0) {
-                THROW("Unexpected XML document structure");
+            if (sharedCache) {
+                sharedCache->insert(entries[i].key, entries[i].info, std::min(entries[i].expiresAt, sharedCacheExpiry));
             }
-            roles.push_back(role);
         }
-
-        info.setRoles(roles);
+        return Status();
     }
 
-
-    void Keystone::setCaCertFileName(const std::string &caCertFileName) {
-        this->caCertFileName = caCertFileName;
-        userDefinedCaCertFile = true;
+    Status Keystone::prewarmCache(const std::string& tenantName, const std::vector<std::string>& tokens,
+                                  unsigned concurrency, double maxRate, size_t& cached) {
+        cached = 0;
+        if (!tokenCache && !sharedCache) {
+            return Status(ERROR_INVALID_ARGUMENT, "No token cache is set up");
+        }
+        size_t maxThreads = std::max(1u, std::thread::hardware_concurrency()) * PREWARM_THREADS_PER_CORE;
+        size_t threadCount = std::min<size_t>(std::min<size_t>(concurrency > 0 ? concurrency : 1, maxThreads),
+                                              tokens.size());
+        TokenBucket bucket(maxRate, threadCount);
+        std::atomic<size_t> next(0);
+        std::atomic<size_t> found(0);
+        std::atomic<bool> stop(false);
+        std::mutex errorMutex;
+        Status error;
+
+        std::function<void(const Status&)> fail = [&](const Status& status) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (error.isOk()) {
+                error = status;
+            }
+            stop.store(true, std::memory_order_relaxed);
+        };
+        std::function<void()> work = [&]() {
+            try {
+                KeystoneUserInfo info;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    size_t i = next.fetch_add(1, std::memory_order_relaxed);
+                    if (i >= tokens.size()) {
+                        break;
+                    }
+                    bucket.acquire();
+                    Status status = getUserInfo(tenantName, tokens[i], info);
+                    if (status.isOk()) {
+                        found.fetch_add(1, std::memory_order_relaxed);
+                    } else if (status.code != ERROR_INVALID_TOKEN) {
+                        fail(status);
+                    }
+                }
+            }
+            catch (const Error& e) {
+                fail(Status(e.getCode(), "A prewarm lookup failed", e.getHttpStatus(), e.getTransportCode()));
+            }
+            catch (...) {
+                fail(Status(ERROR_UNKNOWN, "A prewarm lookup failed"));
+            }
+        };
+
+        // Reserved up front, so that no started thread is lost (and destroyed unjoined) to a
+        // failed reallocation. If a thread cannot be started, the started ones do the lookups.
+        std::vector<std::thread> workers;
+        workers.reserve(threadCount);
+        try {
+            for (size_t t = 0; t < threadCount; t++) {
+                workers.push_back(std::thread(work));
+            }
+        }
+        catch (const std::exception&) {
+            if (workers.empty()) {
+                return Status(ERROR_UNKNOWN, "Could not start the prewarm threads");
+            }
+        }
+        for (size_t t = 0; t < workers.size(); t++) {
+            workers[t].join();
+        }
+        cached = found.load();
+        return error;
     }
 
-    void Keystone::write(const std::string& endpoint, const KeystoneUserInfo& info,
-                         std::stringstream& input, std::stringstream& output) {
-        CurlHolder curl(curl_easy_init());
-        if (!curl.curl) {
-            THROW("Could not initialize curl");
+    void Keystone::setRevocationSource(const RevocationPoller::Source& source, double interval) {
+        revocationPoller.reset();
+        if (source) {
+            revocationPoller.reset(new RevocationPoller(interval, source,
+                [this](const RevocationList& revoked) {
+                    purgeRevoked(revoked);
+                }));
         }
+    }
 
-        curl_easy_setopt(curl.curl, CURLOPT_URL, endpoint.c_str());
-
-        curl_easy_setopt(curl.curl, CURLOPT_FOLLOWLOCATION, 1L);
-        curl_easy_setopt(curl.curl, CURLOPT_POST, 1L);
-        curl_easy_setopt(curl.curl, CURLOPT_WRITEFUNCTION, writeToSS);
-        curl_easy_setopt(curl.curl, CURLOPT_WRITEDATA, &output);
-
-        // Get size:
-        input.seekg(0, input.end);
-        size_t inputSize = input.tellg();
-        input.seekg(0, input.beg);
-        curl_easy_setopt(curl.curl, CURLOPT_POSTFIELDSIZE, inputSize);
-
-        curl_easy_setopt(curl.curl, CURLOPT_READFUNCTION, readFromSS);
-        curl_easy_setopt(curl.curl, CURLOPT_READDATA, &input);
-
-        // Check environmental variable or if the user has provided certification
-        // file name:
-        char* envCaCertFileName;
-        envCaCertFileName = getenv("KEYSTONE_SET_CA_CERTIFICATE_FILENAME");
-        if (this->userDefinedCaCertFile) {
-            curl_easy_setopt(curl.curl, CURLOPT_CAINFO, this->caCertFileName.c_str());
+    size_t Keystone::purgeRevoked(const RevocationList& revoked) {
+        std::lock_guard<std::mutex> lock(purgeMutex);
+        // The revocations of earlier lists are purged already, and stores check for new
+        // ones under the lock, so only those added since the last list are looked for.
+        RevocationList added;
+        for (std::unordered_set<std::string>::const_iterator it = revoked.tokens.begin(); it != revoked.tokens.end(); ++it) {
+            if (lastRevoked.tokens.count(*it) == 0) {
+                added.tokens.insert(*it);
+            }
         }
-        else if ( envCaCertFileName != NULL ) {
-            curl_easy_setopt(curl.curl, CURLOPT_CAINFO, envCaCertFileName);
+        for (std::unordered_set<std::string>::const_iterator it = revoked.usernames.begin(); it != revoked.usernames.end(); ++it) {
+            if (lastRevoked.usernames.count(*it) == 0) {
+                added.usernames.insert(*it);
+            }
         }
+        if (added.empty() && revoked.tokens.size() == lastRevoked.tokens.size()
+            && revoked.usernames.size() == lastRevoked.usernames.size()) {
+            return 0;
+        }
+        lastRevoked = revoked;
+        return purgeLocked(added);
+    }
 
+    size_t Keystone::purgeLocked(const RevocationList& revoked) {
+        if (revoked.empty()) {
+            return 0;
+        }
+        revocations.fetch_add(1, std::memory_order_acq_rel);
+        RevokedEntries revokedEntries(revoked, cacheKey);
+        CacheEntryMatch match = [&revokedEntries](const CacheKey& key, const KeystoneUserInfo& info) {
+            return revokedEntries.matches(key, info);
+        };
+        size_t erased = 0;
+        if (tokenCache) {
+            erased += tokenCache->eraseIf(match);
+        }
+        if (sharedCache) {
+            erased += sharedCache->eraseIf(match);
+        }
+        if (sessionCache) {
+            // Sessions keep their tokens.
+            erased += sessionCache->eraseIf([&revoked](const KeystoneUserInfo& info) {
+                return revoked.matches(info);
+            });
+        }
+        return erased;
+    }
 
-        // Set headers:
-        CurlListHolder headers;
-
-        headers.list = curl_slist_append(headers.list, "Accept: text/xml");
-        headers.list = curl_slist_append(headers.list, "Content-Type: text/xml");
-
-        curl_easy_setopt(curl.curl, CURLOPT_HTTPHEADER, headers.list);
-        KEYSTONE_CURL_SAFE_CALL(curl_easy_perform(curl.curl));
-
-
-        long returnCode;
-        KEYSTONE_CURL_SAFE_CALL(curl_easy_getinfo(curl.curl, CURLINFO_RESPONSE_CODE, &returnCode));
-
-        if (returnCode != 200 && returnCode != 203) {
-            std::stringstream ss;
+    void Keystone::setTokenCacheL1(size_t entries, double maxStaleness) {
+        RefreshPause pause(sessionCache.get());
+        std::lock_guard<std::mutex> lock(purgeMutex);
+        tokenCacheL1Entries = entries;
+        tokenCacheL1Staleness = maxStaleness;
+        if (tokenCache) {
+            tokenCache->setLocalCache(entries, maxStaleness);
+        }
+    }
 
-            THROW("Unexpected returncode: " << + returnCode);
+    void Keystone::setTokenCacheMemoryLimit(size_t bytes) {
+        RefreshPause pause(sessionCache.get());
+        std::lock_guard<std::mutex> lock(purgeMutex);
+        tokenCacheMemoryLimit = bytes;
+        if (tokenCache) {
+            tokenCache->setMemoryLimit(bytes);
         }
     }
 }
@@ -1,42 +1,454 @@
 #include "keystone/impl/KeystoneUserInfo.hpp"
+#include "keystone/impl/RoleTable.hpp"
+#include "keystone/impl/Error.hpp"
+
+#include <atomic>
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+    // "KSUI" in little endian, also guards against records from other layouts.
+    const uint32_t RECORD_MAGIC = 0x4955534b;
+
+    struct StringEntry {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    struct RecordHeader {
+        uint32_t magic;
+        uint32_t size;
+        uint32_t roleCount;
+        uint32_t reserved;
+        StringEntry username;
+        StringEntry token;
+        // Followed by StringEntry roles[roleCount] and the string bytes.
+    };
+
+    const char EMPTY_STRING[1] = { '\0' };
+
+    size_t alignTo8(size_t size) {
+        return (size + 7) & ~size_t(7);
+    }
+
+    const RecordHeader* header(const void* record) {
+        return static_cast<const RecordHeader*>(record);
+    }
+
+    const StringEntry* roleTable(const void* record) {
+        return reinterpret_cast<const StringEntry*>(header(record) + 1);
+    }
+
+    keystone::impl::StringRef toRef(const void* record, const StringEntry& entry) {
+        keystone::impl::StringRef ref;
+        ref.data = static_cast<const char*>(record) + entry.offset;
+        ref.size = entry.length;
+        return ref;
+    }
+
+    keystone::impl::StringRef emptyRef() {
+        keystone::impl::StringRef ref;
+        ref.data = EMPTY_STRING;
+        ref.size = 0;
+        return ref;
+    }
+
+    // The memory is zeroed beforehand, so the null terminator is already in place.
+    void writeString(char* record, size_t& position, const char* data, size_t length, StringEntry& entry) {
+        entry.offset = uint32_t(position);
+        entry.length = uint32_t(length);
+        memcpy(record + position, data, length);
+        position += length + 1;
+    }
+
+    void writeString(char* record, size_t& position, const std::string& value, StringEntry& entry) {
+        writeString(record, position, value.data(), value.size(), entry);
+    }
+
+    // Reads from a record that might not be suitably aligned (file or shared memory).
+    template<class T>
+    T readAt(const char* record, size_t offset) {
+        T value;
+        memcpy(&value, record + offset, sizeof(T));
+        return value;
+    }
+
+    bool validEntry(const char* record, size_t size, size_t stringsBegin, const StringEntry& entry) {
+        if (entry.offset < stringsBegin || entry.offset > size) {
+            return false;
+        }
+        if (size - entry.offset < size_t(entry.length) + 1) {
+            return false;
+        }
+        return record[entry.offset + entry.length] == '\0';
+    }
+}
 
 namespace keystone { namespace impl {
 
+    /**
+     * Layout of the single allocation: this header, the role bitset
+     * (process local role ids, see RoleTable) and then the flat record.
+     * The bitset only spans the words from the lowest to the highest role
+     * of the user, so its size does not grow with the number of roles
+     * interned by the process.
+     */
+    struct KeystoneUserInfo::Block {
+        std::atomic<uint32_t> references;
+        uint32_t recordSize;
+        uint32_t firstRoleWord;
+        uint32_t roleWordCount;
+
+        static size_t bitsOffset() {
+            return alignTo8(sizeof(Block));
+        }
 
+        uint64_t* roleBits() {
+            return reinterpret_cast<uint64_t*>(reinterpret_cast<char*>(this) + bitsOffset());
+        }
 
-    KeystoneUserInfo::KeystoneUserInfo()
+        void* record() {
+            return roleBits() + roleWordCount;
+        }
+
+        /**
+         * A block with an empty role bitset of \c roleWordCount words, starting at the word of
+         * role id 64 * \c firstRoleWord, and room for the record.
+         */
+        static Block* allocate(size_t recordSize, size_t firstRoleWord, size_t roleWordCount) {
+            void* memory = malloc(bitsOffset() + roleWordCount * sizeof(uint64_t) + recordSize);
+            if (memory == NULL) {
+                throw std::bad_alloc();
+            }
+            Block* block = new (memory) Block();
+            block->references.store(1, std::memory_order_relaxed);
+            block->recordSize = uint32_t(recordSize);
+            block->firstRoleWord = uint32_t(firstRoleWord);
+            block->roleWordCount = uint32_t(roleWordCount);
+            memset(block->roleBits(), 0, roleWordCount * sizeof(uint64_t));
+            return block;
+        }
+
+        static Block* allocate(size_t recordSize, const std::vector<RoleId>& roleIds) {
+            size_t firstRoleWord = 0;
+            size_t endRoleWord = 0;
+            for (size_t i = 0; i < roleIds.size(); ++i) {
+                size_t word = roleIds[i] / 64;
+                if (i == 0 || word < firstRoleWord) {
+                    firstRoleWord = word;
+                }
+                if (word + 1 > endRoleWord) {
+                    endRoleWord = word + 1;
+                }
+            }
+
+            Block* block = allocate(recordSize, firstRoleWord, endRoleWord - firstRoleWord);
+            uint64_t* bits = block->roleBits();
+            for (size_t i = 0; i < roleIds.size(); ++i) {
+                bits[roleIds[i] / 64 - firstRoleWord] |= uint64_t(1) << (roleIds[i] % 64);
+            }
+            return block;
+        }
+
+        size_t allocationSize() const {
+            return bitsOffset() + roleWordCount * sizeof(uint64_t) + recordSize;
+        }
+
+        Block* clone() const {
+            void* memory = malloc(allocationSize());
+            if (memory == NULL) {
+                throw std::bad_alloc();
+            }
+            Block* block = new (memory) Block();
+            block->references.store(1, std::memory_order_relaxed);
+            block->recordSize = recordSize;
+            block->firstRoleWord = firstRoleWord;
+            block->roleWordCount = roleWordCount;
+            memcpy(static_cast<char*>(memory) + bitsOffset(), reinterpret_cast<const char*>(this) + bitsOffset(),
+                   allocationSize() - bitsOffset());
+            return block;
+        }
+
+        void retain() {
+            references.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void release() {
+            if (references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                this->~Block();
+                free(this);
+            }
+        }
+    };
+
+    KeystoneUserInfo::KeystoneUserInfo() : block(NULL)
+    {
+    }
+
+    KeystoneUserInfo::KeystoneUserInfo(Block* block) : block(block)
+    {
+    }
+
+    KeystoneUserInfo::KeystoneUserInfo(const std::string& username,
+        const std::string& token,
+        const std::vector<std::string>& roles) : block(NULL)
+    {
+        size_t stringsBegin = sizeof(RecordHeader) + roles.size() * sizeof(StringEntry);
+        size_t size = stringsBegin + username.size() + 1 + token.size() + 1;
+        for (size_t i = 0; i < roles.size(); ++i) {
+            size += roles[i].size() + 1;
+        }
+        size = alignTo8(size);
+
+        std::vector<RoleId> roleIds;
+        for (size_t i = 0; i < roles.size(); ++i) {
+            RoleId id;
+            if (!RoleTable::instance().intern(roles[i].data(), roles[i].size(), id)) {
+                // Leaving the role out would make role checks and policies wrong.
+                throw Error(ERROR_PARSE, "Too many distinct roles");
+            }
+            roleIds.push_back(id);
+        }
+
+        block = Block::allocate(size, roleIds);
+        char* record = static_cast<char*>(block->record());
+        memset(record, 0, size);
+
+        RecordHeader* recordHeader = reinterpret_cast<RecordHeader*>(record);
+        recordHeader->magic = RECORD_MAGIC;
+        recordHeader->size = uint32_t(size);
+        recordHeader->roleCount = uint32_t(roles.size());
+
+        size_t position = stringsBegin;
+        writeString(record, position, username, recordHeader->username);
+        writeString(record, position, token, recordHeader->token);
+        StringEntry* table = reinterpret_cast<StringEntry*>(recordHeader + 1);
+        for (size_t i = 0; i < roles.size(); ++i) {
+            writeString(record, position, roles[i], table[i]);
+        }
+    }
+
+    KeystoneUserInfo::KeystoneUserInfo(const KeystoneUserInfo& other) : block(other.block)
     {
+        if (block != NULL) {
+            block->retain();
+        }
     }
 
-    const std::string& KeystoneUserInfo::getUsername() const
+    KeystoneUserInfo::KeystoneUserInfo(KeystoneUserInfo&& other) noexcept : block(other.block)
     {
-        return username;
+        other.block = NULL;
     }
 
-    void KeystoneUserInfo::setUsername( const std::string& username )
+    KeystoneUserInfo& KeystoneUserInfo::operator=(const KeystoneUserInfo& other)
     {
-        this->username = username;
+        KeystoneUserInfo copy(other);
+        swap(copy);
+        return *this;
     }
 
-    const std::vector<std::string>& KeystoneUserInfo::getRoles() const
+    KeystoneUserInfo& KeystoneUserInfo::operator=(KeystoneUserInfo&& other) noexcept
     {
-        return roles;
+        KeystoneUserInfo moved(std::move(other));
+        swap(moved);
+        return *this;
     }
 
-    void KeystoneUserInfo::setRoles( const std::vector<std::string>& roles )
+    KeystoneUserInfo::~KeystoneUserInfo()
     {
-        this->roles = roles;
+        if (block != NULL) {
+            block->release();
+        }
     }
 
-    void KeystoneUserInfo::setToken( const std::string& token )
+    void KeystoneUserInfo::swap(KeystoneUserInfo& other) noexcept
     {
-        this->token = token;
+        Block* temporary = block;
+        block = other.block;
+        other.block = temporary;
     }
 
-    const std::string& KeystoneUserInfo::getToken() const
+    KeystoneUserInfo KeystoneUserInfo::clone() const
     {
-        return token;
+        return KeystoneUserInfo(block != NULL ? block->clone() : NULL);
     }
-}}
 
+    KeystoneUserInfo KeystoneUserInfo::withToken(const char* token, size_t length) const
+    {
+        if (block == NULL) {
+            return KeystoneUserInfo();
+        }
+        const char* source = static_cast<const char*>(block->record());
+        const RecordHeader* sourceHeader = header(source);
+        const StringEntry* sourceRoles = roleTable(source);
+        size_t stringsBegin = sizeof(RecordHeader) + sourceHeader->roleCount * sizeof(StringEntry);
+        size_t size = stringsBegin + sourceHeader->username.length + 1 + length + 1;
+        for (uint32_t i = 0; i < sourceHeader->roleCount; ++i) {
+            size += sourceRoles[i].length + 1;
+        }
+        size = alignTo8(size);
+
+        // The roles stay the same, so their bits are copied rather than interned again.
+        Block* copy = Block::allocate(size, block->firstRoleWord, block->roleWordCount);
+        memcpy(copy->roleBits(), block->roleBits(), block->roleWordCount * sizeof(uint64_t));
+        char* record = static_cast<char*>(copy->record());
+        memset(record, 0, size);
 
+        RecordHeader* recordHeader = reinterpret_cast<RecordHeader*>(record);
+        recordHeader->magic = RECORD_MAGIC;
+        recordHeader->size = uint32_t(size);
+        recordHeader->roleCount = sourceHeader->roleCount;
+
+        size_t position = stringsBegin;
+        writeString(record, position, source + sourceHeader->username.offset, sourceHeader->username.length,
+                    recordHeader->username);
+        writeString(record, position, token, length, recordHeader->token);
+        StringEntry* table = reinterpret_cast<StringEntry*>(recordHeader + 1);
+        for (uint32_t i = 0; i < sourceHeader->roleCount; ++i) {
+            writeString(record, position, source + sourceRoles[i].offset, sourceRoles[i].length, table[i]);
+        }
+        return KeystoneUserInfo(copy);
+    }
+
+    bool KeystoneUserInfo::fromRecord(const void* record, size_t size, KeystoneUserInfo& info)
+    {
+        if (record == NULL || size < sizeof(RecordHeader) || size > UINT32_MAX) {
+            return false;
+        }
+
+        const char* source = static_cast<const char*>(record);
+        RecordHeader recordHeader = readAt<RecordHeader>(source, 0);
+        if (recordHeader.magic != RECORD_MAGIC || recordHeader.size != size) {
+            return false;
+        }
+
+        if (recordHeader.roleCount > (size - sizeof(RecordHeader)) / sizeof(StringEntry)) {
+            return false;
+        }
+        size_t stringsBegin = sizeof(RecordHeader) + recordHeader.roleCount * sizeof(StringEntry);
+
+        if (!validEntry(source, size, stringsBegin, recordHeader.username) ||
+            !validEntry(source, size, stringsBegin, recordHeader.token)) {
+            return false;
+        }
+
+        // Role ids are local to this process, so they are interned again here.
+        std::vector<RoleId> roleIds;
+        for (uint32_t i = 0; i < recordHeader.roleCount; ++i) {
+            StringEntry entry = readAt<StringEntry>(source, sizeof(RecordHeader) + i * sizeof(StringEntry));
+            if (!validEntry(source, size, stringsBegin, entry)) {
+                return false;
+            }
+            RoleId id;
+            if (!RoleTable::instance().intern(source + entry.offset, entry.length, id)) {
+                return false;
+            }
+            roleIds.push_back(id);
+        }
+
+        // Copy into our own (aligned) block, the source may be anywhere (file, shared memory).
+        Block* block = Block::allocate(size, roleIds);
+        memcpy(block->record(), record, size);
+        KeystoneUserInfo candidate(block);
+
+        info.swap(candidate);
+        return true;
+    }
+
+    bool KeystoneUserInfo::isEmpty() const
+    {
+        return block == NULL;
+    }
+
+    StringRef KeystoneUserInfo::getUsername() const
+    {
+        if (block == NULL) {
+            return emptyRef();
+        }
+        return toRef(block->record(), header(block->record())->username);
+    }
+
+    StringRef KeystoneUserInfo::getToken() const
+    {
+        if (block == NULL) {
+            return emptyRef();
+        }
+        return toRef(block->record(), header(block->record())->token);
+    }
+
+    size_t KeystoneUserInfo::getRoleCount() const
+    {
+        if (block == NULL) {
+            return 0;
+        }
+        return header(block->record())->roleCount;
+    }
+
+    StringRef KeystoneUserInfo::getRole(size_t index) const
+    {
+        if (index >= getRoleCount()) {
+            return emptyRef();
+        }
+        return toRef(block->record(), roleTable(block->record())[index]);
+    }
+
+    bool KeystoneUserInfo::hasRole(RoleId id) const
+    {
+        // Words below the first one wrap around to large offsets.
+        size_t word = id / 64 - size_t(block != NULL ? block->firstRoleWord : 0);
+        if (block == NULL || word >= block->roleWordCount) {
+            return false;
+        }
+        return (block->roleBits()[word] & (uint64_t(1) << (id % 64))) != 0;
+    }
+
+    const uint64_t* KeystoneUserInfo::getRoleBits() const
+    {
+        if (block == NULL) {
+            return NULL;
+        }
+        return block->roleBits();
+    }
+
+    size_t KeystoneUserInfo::getFirstRoleWord() const
+    {
+        if (block == NULL) {
+            return 0;
+        }
+        return block->firstRoleWord;
+    }
+
+    size_t KeystoneUserInfo::getRoleWordCount() const
+    {
+        if (block == NULL) {
+            return 0;
+        }
+        return block->roleWordCount;
+    }
+
+    const void* KeystoneUserInfo::getRecord() const
+    {
+        if (block == NULL) {
+            return NULL;
+        }
+        return block->record();
+    }
+
+    size_t KeystoneUserInfo::getRecordSize() const
+    {
+        if (block == NULL) {
+            return 0;
+        }
+        return block->recordSize;
+    }
+
+    size_t KeystoneUserInfo::getMemoryBytes() const
+    {
+        if (block == NULL) {
+            return 0;
+        }
+        return block->allocationSize();
+    }
+}}
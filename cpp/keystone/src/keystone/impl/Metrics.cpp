@@ -0,0 +1,352 @@
+#include "keystone/impl/Metrics.hpp"
+
+#include <sstream>
+
+
+namespace {
+    using keystone::impl::LatencyHistogram;
+    using keystone::impl::MetricsSnapshot;
+    using keystone::impl::OperationMetrics;
+
+    const char* operationNames[keystone::impl::OPERATION_COUNT] = {
+        "login",
+        "get_username",
+        "get_roles"
+    };
+
+    // The histogram is rendered with a bucket for every power of two
+    // between 64us and ~67s, which keeps the output stable between scrapes.
+    const unsigned firstRenderedExponent = 6;
+    const unsigned lastRenderedExponent = 26;
+
+    void escapeLabel(std::ostream& out, const std::string& value) {
+        for (size_t i = 0; i < value.size(); ++i) {
+            switch (value[i]) {
+            case '\\': out << "\\\\"; break;
+            case '"':  out << "\\\""; break;
+            case '\n': out << "\\n"; break;
+            default:   out << value[i];
+            }
+        }
+    }
+
+    void labels(std::ostream& out, const MetricsSnapshot::Endpoint& endpoint, size_t operation) {
+        out << "endpoint=\"";
+        escapeLabel(out, endpoint.endpoint);
+        out << "\",operation=\"" << operationNames[operation] << "\"";
+    }
+
+    void header(std::ostream& out, const char* name, const char* type, const char* help) {
+        out << "# HELP " << name << " " << help << "\n";
+        out << "# TYPE " << name << " " << type << "\n";
+    }
+
+    // Writes one sample line per endpoint and operation.
+    template<class Value>
+    void samples(std::ostream& out, const MetricsSnapshot& snapshot, const char* name, Value value) {
+        for (size_t e = 0; e < snapshot.endpoints.size(); ++e) {
+            for (size_t op = 0; op < keystone::impl::OPERATION_COUNT; ++op) {
+                out << name << "{";
+                labels(out, snapshot.endpoints[e], op);
+                out << "} " << value(snapshot.endpoints[e].operations[op]) << "\n";
+            }
+        }
+    }
+}
+
+
+namespace keystone { namespace impl {
+
+    LatencyHistogram::LatencyHistogram() : count(0), sumMicros(0) {
+        for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+            counts[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    size_t LatencyHistogram::bucketIndex(uint64_t micros) {
+        if (micros < SUB_BUCKETS) {
+            return size_t(micros);
+        }
+        const uint64_t largest = (uint64_t(2) << MAX_EXPONENT) - 1;
+        if (micros > largest) {
+            micros = largest;
+        }
+        unsigned exponent = SUB_BUCKET_BITS;
+        while ((micros >> (exponent + 1)) != 0) {
+            ++exponent;
+        }
+        unsigned shift = exponent - SUB_BUCKET_BITS;
+        size_t sub = size_t(micros >> shift) - SUB_BUCKETS;
+        return (shift + 1) * SUB_BUCKETS + sub;
+    }
+
+    uint64_t LatencyHistogram::bucketUpperBound(size_t index) {
+        if (index < SUB_BUCKETS) {
+            return index + 1;
+        }
+        unsigned shift = unsigned(index / SUB_BUCKETS) - 1;
+        uint64_t sub = index % SUB_BUCKETS;
+        return (SUB_BUCKETS + sub + 1) << shift;
+    }
+
+    void LatencyHistogram::record(double seconds) {
+        uint64_t micros = seconds > 0 ? uint64_t(seconds * 1e6 + 0.5) : 0;
+        counts[bucketIndex(micros)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sumMicros.fetch_add(micros, std::memory_order_relaxed);
+    }
+
+    void LatencyHistogram::snapshot(Snapshot& snapshot) const {
+        snapshot.counts.resize(BUCKET_COUNT);
+        for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+            snapshot.counts[i] = counts[i].load(std::memory_order_relaxed);
+        }
+        snapshot.count = count.load(std::memory_order_relaxed);
+        snapshot.sumSeconds = sumMicros.load(std::memory_order_relaxed) * 1e-6;
+    }
+
+    void LatencyHistogram::Snapshot::add(const Snapshot& other) {
+        if (counts.size() < other.counts.size()) {
+            counts.resize(other.counts.size());
+        }
+        for (size_t i = 0; i < other.counts.size(); ++i) {
+            counts[i] += other.counts[i];
+        }
+        count += other.count;
+        sumSeconds += other.sumSeconds;
+    }
+
+    double LatencyHistogram::Snapshot::quantile(double q) const {
+        // The bucket counts and the total are read separately, so sum the buckets.
+        uint64_t total = 0;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            total += counts[i];
+        }
+        if (total == 0) {
+            return 0;
+        }
+        if (q < 0) {
+            q = 0;
+        }
+        uint64_t rank = uint64_t(q * total + 0.5);
+        if (rank == 0) {
+            rank = 1;
+        }
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return bucketUpperBound(i) * 1e-6;
+            }
+        }
+        return bucketUpperBound(counts.size() - 1) * 1e-6;
+    }
+
+
+    StripedCounter::StripedCounter() {
+        for (unsigned i = 0; i < STRIPES; ++i) {
+            cells[i].value.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t StripedCounter::load(std::memory_order order) const {
+        uint64_t total = 0;
+        for (unsigned i = 0; i < STRIPES; ++i) {
+            total += cells[i].value.load(order);
+        }
+        return total;
+    }
+
+    unsigned StripedCounter::stripe() {
+        static std::atomic<unsigned> nextStripe(0);
+        thread_local unsigned stripe = nextStripe.fetch_add(1, std::memory_order_relaxed) % STRIPES;
+        return stripe;
+    }
+
+
+    OperationMetrics::OperationMetrics()
+        : requests(0), bytesSent(0), bytesReceived(0), connectionsOpened(0),
+          connectionsReused(0), tlsHandshakes(0), cacheMisses(0),
+          rejectedLocally(0), inFlight(0) {
+        for (size_t i = 0; i < ERROR_CODE_COUNT; ++i) {
+            errors[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    OperationMetrics::Snapshot::Snapshot()
+        : requests(0), bytesSent(0), bytesReceived(0), connectionsOpened(0),
+          connectionsReused(0), tlsHandshakes(0), cacheHits(0), cacheMisses(0),
+          rejectedLocally(0), inFlight(0) {
+        for (size_t i = 0; i < ERROR_CODE_COUNT; ++i) {
+            errors[i] = 0;
+        }
+    }
+
+    void OperationMetrics::Snapshot::add(const Snapshot& other) {
+        requests += other.requests;
+        for (size_t i = 0; i < ERROR_CODE_COUNT; ++i) {
+            errors[i] += other.errors[i];
+        }
+        bytesSent += other.bytesSent;
+        bytesReceived += other.bytesReceived;
+        connectionsOpened += other.connectionsOpened;
+        connectionsReused += other.connectionsReused;
+        tlsHandshakes += other.tlsHandshakes;
+        cacheHits += other.cacheHits;
+        cacheMisses += other.cacheMisses;
+        rejectedLocally += other.rejectedLocally;
+        inFlight += other.inFlight;
+        latency.add(other.latency);
+    }
+
+    uint64_t OperationMetrics::Snapshot::totalErrors() const {
+        uint64_t total = 0;
+        for (size_t i = 0; i < ERROR_CODE_COUNT; ++i) {
+            total += errors[i];
+        }
+        return total;
+    }
+
+    void OperationMetrics::snapshot(Snapshot& snapshot) const {
+        snapshot.requests = requests.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < ERROR_CODE_COUNT; ++i) {
+            snapshot.errors[i] = errors[i].load(std::memory_order_relaxed);
+        }
+        snapshot.bytesSent = bytesSent.load(std::memory_order_relaxed);
+        snapshot.bytesReceived = bytesReceived.load(std::memory_order_relaxed);
+        snapshot.connectionsOpened = connectionsOpened.load(std::memory_order_relaxed);
+        snapshot.connectionsReused = connectionsReused.load(std::memory_order_relaxed);
+        snapshot.tlsHandshakes = tlsHandshakes.load(std::memory_order_relaxed);
+        snapshot.cacheHits = cacheHits.load(std::memory_order_relaxed);
+        snapshot.cacheMisses = cacheMisses.load(std::memory_order_relaxed);
+        snapshot.rejectedLocally = rejectedLocally.load(std::memory_order_relaxed);
+        snapshot.inFlight = inFlight.load(std::memory_order_relaxed);
+        latency.snapshot(snapshot.latency);
+    }
+
+
+    OperationMetrics::Snapshot MetricsSnapshot::total(Operation operation) const {
+        OperationMetrics::Snapshot result;
+        for (size_t e = 0; e < endpoints.size(); ++e) {
+            result.add(endpoints[e].operations[operation]);
+        }
+        return result;
+    }
+
+    void MetricsSnapshot::renderPrometheus(std::string& output) const {
+        typedef OperationMetrics::Snapshot S;
+        std::ostringstream out;
+        out.precision(9);
+
+        header(out, "keystone_requests_total", "counter", "Calls made to the keystone service.");
+        samples(out, *this, "keystone_requests_total", [](const S& s) { return s.requests; });
+
+        header(out, "keystone_errors_total", "counter", "Failed calls to the keystone service, by class.");
+        for (size_t e = 0; e < endpoints.size(); ++e) {
+            for (size_t op = 0; op < OPERATION_COUNT; ++op) {
+                for (size_t c = ERROR_NONE + 1; c < ERROR_CODE_COUNT; ++c) {
+                    out << "keystone_errors_total{";
+                    labels(out, endpoints[e], op);
+                    out << ",class=\"" << errorName(ErrorCode(c)) << "\"} "
+                        << endpoints[e].operations[op].errors[c] << "\n";
+                }
+            }
+        }
+
+        header(out, "keystone_bytes_sent_total", "counter", "Bytes uploaded to the keystone service.");
+        samples(out, *this, "keystone_bytes_sent_total", [](const S& s) { return s.bytesSent; });
+
+        header(out, "keystone_bytes_received_total", "counter", "Bytes downloaded from the keystone service.");
+        samples(out, *this, "keystone_bytes_received_total", [](const S& s) { return s.bytesReceived; });
+
+        header(out, "keystone_connections_opened_total", "counter", "New connections opened.");
+        samples(out, *this, "keystone_connections_opened_total", [](const S& s) { return s.connectionsOpened; });
+
+        header(out, "keystone_connections_reused_total", "counter", "Calls made over an already open connection.");
+        samples(out, *this, "keystone_connections_reused_total", [](const S& s) { return s.connectionsReused; });
+
+        header(out, "keystone_connection_reuse_ratio", "gauge", "Share of calls made over an already open connection.");
+        samples(out, *this, "keystone_connection_reuse_ratio", [](const S& s) {
+            uint64_t calls = s.connectionsOpened + s.connectionsReused;
+            return calls == 0 ? 0.0 : double(s.connectionsReused) / calls;
+        });
+
+        header(out, "keystone_tls_handshakes_total", "counter", "TLS handshakes performed.");
+        samples(out, *this, "keystone_tls_handshakes_total", [](const S& s) { return s.tlsHandshakes; });
+
+        header(out, "keystone_cache_hits_total", "counter", "Calls answered from a cache.");
+        samples(out, *this, "keystone_cache_hits_total", [](const S& s) { return s.cacheHits; });
+
+        header(out, "keystone_cache_misses_total", "counter", "Cache lookups that had to go to the service.");
+        samples(out, *this, "keystone_cache_misses_total", [](const S& s) { return s.cacheMisses; });
+
+        header(out, "keystone_rejected_locally_total", "counter", "Calls refused without contacting the service (eg. malformed tokens).");
+        samples(out, *this, "keystone_rejected_locally_total", [](const S& s) { return s.rejectedLocally; });
+
+        header(out, "keystone_in_flight", "gauge", "Calls currently in progress.");
+        samples(out, *this, "keystone_in_flight", [](const S& s) { return s.inFlight; });
+
+        header(out, "keystone_request_duration_seconds", "histogram", "Duration of calls to the keystone service.");
+        for (size_t e = 0; e < endpoints.size(); ++e) {
+            for (size_t op = 0; op < OPERATION_COUNT; ++op) {
+                const LatencyHistogram::Snapshot& latency = endpoints[e].operations[op].latency;
+                uint64_t cumulative = 0;
+                size_t bucket = 0;
+                for (unsigned exponent = firstRenderedExponent; exponent <= lastRenderedExponent; ++exponent) {
+                    uint64_t bound = uint64_t(1) << exponent;
+                    for (; bucket < latency.counts.size()
+                           && LatencyHistogram::bucketUpperBound(bucket) <= bound; ++bucket) {
+                        cumulative += latency.counts[bucket];
+                    }
+                    out << "keystone_request_duration_seconds_bucket{";
+                    labels(out, endpoints[e], op);
+                    out << ",le=\"" << bound * 1e-6 << "\"} " << cumulative << "\n";
+                }
+                for (; bucket < latency.counts.size(); ++bucket) {
+                    cumulative += latency.counts[bucket];
+                }
+                out << "keystone_request_duration_seconds_bucket{";
+                labels(out, endpoints[e], op);
+                out << ",le=\"+Inf\"} " << cumulative << "\n";
+
+                out << "keystone_request_duration_seconds_sum{";
+                labels(out, endpoints[e], op);
+                out << "} " << latency.sumSeconds << "\n";
+
+                out << "keystone_request_duration_seconds_count{";
+                labels(out, endpoints[e], op);
+                out << "} " << cumulative << "\n";
+            }
+        }
+
+        output = out.str();
+    }
+
+
+    Metrics& Metrics::instance() {
+        static Metrics metrics;
+        return metrics;
+    }
+
+    EndpointMetrics* Metrics::endpoint(const std::string& endpoint) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < endpoints.size(); ++i) {
+            if (endpoints[i].endpoint == endpoint) {
+                return &endpoints[i];
+            }
+        }
+        endpoints.emplace_back(endpoint);
+        return &endpoints.back();
+    }
+
+    void Metrics::snapshot(MetricsSnapshot& snapshot) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        snapshot.endpoints.resize(endpoints.size());
+        for (size_t e = 0; e < endpoints.size(); ++e) {
+            snapshot.endpoints[e].endpoint = endpoints[e].endpoint;
+            for (size_t op = 0; op < OPERATION_COUNT; ++op) {
+                endpoints[e].operations[op].snapshot(snapshot.endpoints[e].operations[op]);
+            }
+        }
+    }
+}}
@@ -0,0 +1,128 @@
+#include "keystone/impl/NegativeCache.hpp"
+#include "keystone/impl/Hash.hpp"
+#include "keystone/impl/Clock.hpp"
+
+
+namespace {
+    /**
+     * The bit positions within a block, 9 independent bits each (enough for 14
+     * positions). Double hashing (a + i*b) is not good enough here: in a 512 bit
+     * block, keys sharing b share most of their bits.
+     */
+    class Probes {
+    public:
+        explicit Probes(uint64_t hash)
+            : hash(hash), bits(keystone::impl::mix64(hash)), available(7) {}
+
+        unsigned next() {
+            if (available == 0) {
+                bits = keystone::impl::mix64(hash ^ UINT64_C(0x9e3779b97f4a7c15));
+                available = 7;
+            }
+            unsigned bit = static_cast<unsigned>(bits & 511);
+            bits >>= 9;
+            available--;
+            return bit;
+        }
+
+    private:
+        uint64_t hash;
+        uint64_t bits;
+        unsigned available;
+    };
+}
+
+
+namespace keystone { namespace impl {
+
+    NegativeCache::NegativeCache(size_t expectedEntries, double ttl)
+        : expectedEntries(expectedEntries), ttl(ttl), current(0) {
+        generationCapacity = expectedEntries / 2 > 0 ? expectedEntries / 2 : 1;
+        blockCount = (generationCapacity * BITS_PER_ENTRY + BLOCK_BITS - 1) / BLOCK_BITS;
+        rotationPeriod = static_cast<int64_t>(ttl * 0.5e9);
+        for (unsigned i = 0; i < 2; i++) {
+            generations[i].words.reset(new std::atomic<uint64_t>[blockCount * BLOCK_WORDS]);
+            clear(generations[i]);
+        }
+        rotateAt.store(coarseMonotonicNanoseconds() + rotationPeriod);
+    }
+
+    bool NegativeCache::contains(uint64_t hash) {
+        rotateIfDue();
+        return test(generations[0], hash) || test(generations[1], hash);
+    }
+
+    void NegativeCache::insert(uint64_t hash) {
+        rotateIfDue();
+        Generation& generation = generations[current.load(std::memory_order_acquire)];
+        std::atomic<uint64_t>* block = &generation.words[blockOf(hash) * BLOCK_WORDS];
+        Probes probes(hash);
+        for (unsigned i = 0; i < HASH_COUNT; i++) {
+            unsigned bit = probes.next();
+            block[bit / 64].fetch_or(uint64_t(1) << (bit % 64), std::memory_order_relaxed);
+        }
+        generation.inserted.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void NegativeCache::clear() {
+        std::lock_guard<std::mutex> lock(rotationMutex);
+        clear(generations[0]);
+        clear(generations[1]);
+        rotateAt.store(coarseMonotonicNanoseconds() + rotationPeriod, std::memory_order_relaxed);
+    }
+
+    size_t NegativeCache::getMemoryBytes() const {
+        return 2 * blockCount * BLOCK_WORDS * sizeof(uint64_t);
+    }
+
+    size_t NegativeCache::blockOf(uint64_t hash) const {
+        return static_cast<size_t>((hash >> 32) * blockCount >> 32);
+    }
+
+    bool NegativeCache::test(const Generation& generation, uint64_t hash) const {
+        const std::atomic<uint64_t>* block = &generation.words[blockOf(hash) * BLOCK_WORDS];
+        Probes probes(hash);
+        for (unsigned i = 0; i < HASH_COUNT; i++) {
+            unsigned bit = probes.next();
+            if ((block[bit / 64].load(std::memory_order_relaxed) & (uint64_t(1) << (bit % 64))) == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void NegativeCache::clear(Generation& generation) {
+        size_t wordCount = blockCount * BLOCK_WORDS;
+        for (size_t i = 0; i < wordCount; i++) {
+            generation.words[i].store(0, std::memory_order_relaxed);
+        }
+        generation.inserted.store(0, std::memory_order_relaxed);
+    }
+
+    void NegativeCache::rotateIfDue() {
+        int64_t now = coarseMonotonicNanoseconds();
+        if (now < rotateAt.load(std::memory_order_relaxed)
+            && generations[current.load(std::memory_order_relaxed)].inserted.load(std::memory_order_relaxed) < generationCapacity) {
+            return;
+        }
+
+        // Whoever gets the lock rotates, everybody else carries on with the old generations.
+        std::unique_lock<std::mutex> lock(rotationMutex, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            return;
+        }
+        unsigned newest = current.load(std::memory_order_relaxed);
+        if (now < rotateAt.load(std::memory_order_relaxed)
+            && generations[newest].inserted.load(std::memory_order_relaxed) < generationCapacity) {
+            return;
+        }
+        // Lookups racing with the clearing may miss entries of the old generation, which is harmless.
+        clear(generations[1 - newest]);
+        if (now >= rotateAt.load(std::memory_order_relaxed) + rotationPeriod) {
+            // Idle for more than a whole ttl, everything has expired.
+            clear(generations[newest]);
+        }
+        current.store(1 - newest, std::memory_order_release);
+        rotateAt.store(now + rotationPeriod, std::memory_order_relaxed);
+    }
+}}
@@ -0,0 +1,272 @@
+#include "keystone/impl/Policy.hpp"
+#include "keystone/impl/Error.hpp"
+
+#include <ctype.h>
+#include <sstream>
+#include <stdexcept>
+
+namespace keystone { namespace impl {
+
+    /**
+     * Recursive descent parser emitting the postfix program of a Policy.
+     */
+    class PolicyCompiler {
+    public:
+        PolicyCompiler(Policy& policy) : policy(policy), text(policy.expression), position(0), depth(0), maxDepth(0), nesting(0) {}
+
+        void compile() {
+            skipSpaces();
+            if (position == text.size()) {
+                fail("empty policy");
+            }
+            parseExpression();
+            skipSpaces();
+            if (position != text.size()) {
+                fail("unexpected input");
+            }
+            if (maxDepth > Policy::MAX_DEPTH) {
+                fail("policy is too deeply nested");
+            }
+        }
+
+    private:
+        Policy& policy;
+        const std::string& text;
+        size_t position;
+        size_t depth;
+        size_t maxDepth;
+        // Parentheses and negations being parsed, bounded so the recursion can not overflow the stack.
+        size_t nesting;
+
+        void fail(const char* message) {
+            std::stringstream ss;
+            ss << "Invalid policy \"" << text << "\" at position " << position << ": " << message;
+            throw Error(ERROR_INVALID_ARGUMENT, ss.str());
+        }
+
+        void skipSpaces() {
+            while (position < text.size() && isspace((unsigned char)text[position])) {
+                ++position;
+            }
+        }
+
+        static bool isRoleChar(char c) {
+            return isalnum((unsigned char)c) || c == '_' || c == '.' || c == ':' || c == '@' || c == '-';
+        }
+
+        // Matches either the symbol or the (case insensitive) keyword as a whole word.
+        bool accept(const char* symbol, const char* keyword) {
+            skipSpaces();
+            size_t symbolLength = std::char_traits<char>::length(symbol);
+            if (text.compare(position, symbolLength, symbol) == 0) {
+                position += symbolLength;
+                return true;
+            }
+            size_t keywordLength = std::char_traits<char>::length(keyword);
+            if (position + keywordLength > text.size()) {
+                return false;
+            }
+            for (size_t i = 0; i < keywordLength; ++i) {
+                if (toupper((unsigned char)text[position + i]) != keyword[i]) {
+                    return false;
+                }
+            }
+            if (position + keywordLength < text.size() && isRoleChar(text[position + keywordLength])) {
+                return false;
+            }
+            position += keywordLength;
+            return true;
+        }
+
+        void emit(Policy::OpCode op, uint32_t operand = 0) {
+            Policy::Instruction instruction;
+            instruction.op = op;
+            instruction.operand = operand;
+            policy.program.push_back(instruction);
+
+            if (op == Policy::OP_ROLE) {
+                ++depth;
+                if (depth > maxDepth) {
+                    maxDepth = depth;
+                }
+            } else if (op != Policy::OP_NOT) {
+                --depth;
+            }
+        }
+
+        void enter() {
+            if (++nesting > Policy::MAX_DEPTH) {
+                fail("policy is too deeply nested");
+            }
+        }
+
+        void parseExpression() {
+            parseTerm();
+            while (accept("||", "OR")) {
+                parseTerm();
+                emit(Policy::OP_OR);
+            }
+        }
+
+        void parseTerm() {
+            parseFactor();
+            while (accept("&&", "AND")) {
+                parseFactor();
+                emit(Policy::OP_AND);
+            }
+        }
+
+        void parseFactor() {
+            if (accept("!", "NOT")) {
+                enter();
+                parseFactor();
+                --nesting;
+                emit(Policy::OP_NOT);
+                return;
+            }
+            skipSpaces();
+            if (position == text.size()) {
+                fail("expected a role");
+            }
+            if (text[position] == '(') {
+                ++position;
+                enter();
+                parseExpression();
+                --nesting;
+                skipSpaces();
+                if (position == text.size() || text[position] != ')') {
+                    fail("expected ')'");
+                }
+                ++position;
+                return;
+            }
+            emit(Policy::OP_ROLE, roleOperand(parseRole()));
+        }
+
+        std::string parseRole() {
+            if (text[position] == '"') {
+                size_t end = text.find('"', position + 1);
+                if (end == std::string::npos) {
+                    fail("unterminated role name");
+                }
+                std::string role = text.substr(position + 1, end - position - 1);
+                position = end + 1;
+                return role;
+            }
+            size_t begin = position;
+            while (position < text.size() && isRoleChar(text[position])) {
+                ++position;
+            }
+            if (begin == position) {
+                fail("expected a role");
+            }
+            return text.substr(begin, position - begin);
+        }
+
+        uint32_t roleOperand(const std::string& role) {
+            RoleId id;
+            if (!RoleTable::instance().intern(role.data(), role.size(), id)) {
+                fail("too many distinct roles");
+            }
+            for (size_t i = 0; i < policy.referencedRoles.size(); ++i) {
+                if (policy.referencedRoles[i] == id) {
+                    return uint32_t(i);
+                }
+            }
+            policy.referencedRoles.push_back(id);
+            return uint32_t(policy.referencedRoles.size() - 1);
+        }
+    };
+
+    namespace {
+        // Gives the policy program the value of its i'th referenced role.
+        struct MaskRoles {
+            uint64_t mask;
+            bool operator()(uint32_t operand) const {
+                return (mask >> operand) & 1;
+            }
+        };
+
+        struct UserInfoRoles {
+            const KeystoneUserInfo& info;
+            const std::vector<RoleId>& referencedRoles;
+            bool operator()(uint32_t operand) const {
+                return info.hasRole(referencedRoles[operand]);
+            }
+        };
+
+        template<class Roles>
+        bool runProgram(const std::vector<Policy::Instruction>& program, const Roles& roles);
+    }
+
+    Policy::Policy(const std::string& expression) : expression(expression) {
+        PolicyCompiler compiler(*this);
+        compiler.compile();
+
+        if (referencedRoles.size() <= MAX_TABLE_ROLES) {
+            uint64_t combinations = uint64_t(1) << referencedRoles.size();
+            decisions.assign((combinations + 63) / 64, 0);
+            for (uint64_t mask = 0; mask < combinations; ++mask) {
+                if (run(mask)) {
+                    decisions[mask / 64] |= uint64_t(1) << (mask % 64);
+                }
+            }
+        }
+    }
+
+    bool Policy::evaluate(const KeystoneUserInfo& info) const {
+        if (!decisions.empty()) {
+            uint64_t mask = gatherRoles(info);
+            return (decisions[mask / 64] >> (mask % 64)) & 1;
+        }
+        UserInfoRoles roles = { info, referencedRoles };
+        return runProgram(program, roles);
+    }
+
+    bool Policy::run(uint64_t roleMask) const {
+        MaskRoles roles = { roleMask };
+        return runProgram(program, roles);
+    }
+
+    uint64_t Policy::gatherRoles(const KeystoneUserInfo& info) const {
+        const uint64_t* bits = info.getRoleBits();
+        size_t firstWord = info.getFirstRoleWord();
+        size_t wordCount = info.getRoleWordCount();
+        uint64_t mask = 0;
+        for (size_t i = 0; i < referencedRoles.size(); ++i) {
+            RoleId id = referencedRoles[i];
+            // Words below the first one wrap around to large offsets.
+            size_t word = id / 64 - firstWord;
+            if (word < wordCount) {
+                mask |= ((bits[word] >> (id % 64)) & 1) << i;
+            }
+        }
+        return mask;
+    }
+
+    namespace {
+        template<class Roles>
+        bool runProgram(const std::vector<Policy::Instruction>& program, const Roles& roles) {
+            // The stack holds one bit per entry, the compiler limits the depth to 64.
+            uint64_t stack = 0;
+            for (size_t i = 0; i < program.size(); ++i) {
+                const Policy::Instruction& instruction = program[i];
+                switch (instruction.op) {
+                case Policy::OP_ROLE:
+                    stack = (stack << 1) | (roles(instruction.operand) ? 1 : 0);
+                    break;
+                case Policy::OP_NOT:
+                    stack ^= 1;
+                    break;
+                case Policy::OP_AND:
+                    stack = (stack >> 1) & (stack | ~uint64_t(1));
+                    break;
+                case Policy::OP_OR:
+                    stack = (stack >> 1) | (stack & 1);
+                    break;
+                }
+            }
+            return (stack & 1) != 0;
+        }
+    }
+}}
@@ -0,0 +1,95 @@
+#include "keystone/impl/Revocation.hpp"
+
+#include <chrono>
+#include <fstream>
+
+
+namespace keystone { namespace impl {
+
+    bool RevocationList::matches(const KeystoneUserInfo& info) const {
+        if (!tokens.empty() && tokens.count(info.getToken().str()) > 0) {
+            return true;
+        }
+        return !usernames.empty() && usernames.count(info.getUsername().str()) > 0;
+    }
+
+    RevokedEntries::RevokedEntries(const RevocationList& list, const SipKey& key) : list(list) {
+        for (std::unordered_set<std::string>::const_iterator it = list.tokens.begin(); it != list.tokens.end(); ++it) {
+            tokenHashes.insert(tokenHash(key, it->data(), it->size()));
+        }
+    }
+
+    bool RevokedEntries::matches(const CacheKey& key, const KeystoneUserInfo& info) const {
+        if (!tokenHashes.empty() && tokenHashes.count(key.high) > 0) {
+            return true;
+        }
+        return !list.usernames.empty() && list.usernames.count(info.getUsername().str()) > 0;
+    }
+
+    Status readRevocationFile(const std::string& path, RevocationList& list) {
+        std::ifstream file(path.c_str());
+        if (!file) {
+            return Status(ERROR_UNKNOWN, "Could not open the revocation file");
+        }
+        std::string line;
+        while (std::getline(file, line)) {
+            size_t begin = line.find_first_not_of(" \t\r");
+            if (begin == std::string::npos || line[begin] == '#') {
+                continue;
+            }
+            size_t end = line.find_last_not_of(" \t\r") + 1;
+            if (line.compare(begin, 5, "user ") == 0) {
+                size_t name = line.find_first_not_of(" \t", begin + 5);
+                if (name < end) {
+                    list.usernames.insert(line.substr(name, end - name));
+                }
+            } else {
+                list.tokens.insert(line.substr(begin, end - begin));
+            }
+        }
+        if (file.bad()) {
+            return Status(ERROR_UNKNOWN, "Could not read the revocation file");
+        }
+        return Status();
+    }
+
+    RevocationPoller::RevocationPoller(double interval, const Source& source, const Purge& purge)
+        : interval(interval), source(source), purge(purge), stopping(false),
+          lastStatus(ERROR_UNKNOWN, "Not polled yet") {
+        poller = std::thread(&RevocationPoller::pollLoop, this);
+    }
+
+    RevocationPoller::~RevocationPoller() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        poller.join();
+    }
+
+    Status RevocationPoller::getLastStatus() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return lastStatus;
+    }
+
+    void RevocationPoller::pollLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping) {
+            lock.unlock();
+            RevocationList list;
+            Status status;
+            try {
+                status = source(list);
+                if (status.isOk()) {
+                    purge(list);
+                }
+            } catch (...) {
+                status = Status(ERROR_UNKNOWN, "Unknown error");
+            }
+            lock.lock();
+            lastStatus = status;
+            wake.wait_for(lock, std::chrono::duration<double>(interval), [this]() { return stopping; });
+        }
+    }
+}}
@@ -0,0 +1,58 @@
+#include "keystone/impl/RoleCache.hpp"
+#include "keystone/impl/Clock.hpp"
+
+
+namespace keystone { namespace impl {
+
+    RoleCache::RoleCache(size_t capacity, double ttl)
+        : capacity(capacity > 0 ? capacity : 1), ttl(ttl) {
+        ttlNanoseconds = static_cast<int64_t>(ttl * 1e9);
+    }
+
+    bool RoleCache::find(const std::string& username, const std::string& tenantName,
+                         std::vector<std::string>& roles) const {
+        std::string key = keyOf(username, tenantName);
+        int64_t now = coarseMonotonicNanoseconds();
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unordered_map<std::string, Entry>::const_iterator found = entries.find(key);
+        if (found == entries.end() || found->second.expiresAt <= now) {
+            return false;
+        }
+        roles = found->second.roles;
+        return true;
+    }
+
+    void RoleCache::insert(const std::string& username, const std::string& tenantName,
+                           const std::vector<std::string>& roles) {
+        Entry entry;
+        entry.expiresAt = coarseMonotonicNanoseconds() + ttlNanoseconds;
+        entry.roles = roles;
+        std::string key = keyOf(username, tenantName);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (entries.size() >= capacity && entries.find(key) == entries.end()) {
+            entries.erase(entries.begin());
+        }
+        entries[key] = std::move(entry);
+    }
+
+    void RoleCache::clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+    }
+
+    size_t RoleCache::size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.size();
+    }
+
+    std::string RoleCache::keyOf(const std::string& username, const std::string& tenantName) {
+        // Neither name can contain a null character (they are sent as XML).
+        std::string key;
+        key.reserve(username.size() + 1 + tenantName.size());
+        key += username;
+        key += '\0';
+        key += tenantName;
+        return key;
+    }
+}}
@@ -0,0 +1,143 @@
+#include "keystone/impl/RoleTable.hpp"
+
+#include <string.h>
+
+namespace {
+    // Grown by doubling, the index is kept at most half full so probes stay short.
+    const size_t INITIAL_SLOTS = 64;
+}
+
+namespace keystone { namespace impl {
+
+    void RoleSet::add(RoleId id) {
+        size_t word = id / 64;
+        if (word >= words.size()) {
+            words.resize(word + 1, 0);
+        }
+        words[word] |= uint64_t(1) << (id % 64);
+    }
+
+    bool RoleSet::contains(RoleId id) const {
+        size_t word = id / 64;
+        return word < words.size() && (words[word] & (uint64_t(1) << (id % 64))) != 0;
+    }
+
+    bool RoleSet::empty() const {
+        for (size_t i = 0; i < words.size(); ++i) {
+            if (words[i] != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool RoleSet::isSubsetOf(const uint64_t* bits, size_t wordCount) const {
+        for (size_t i = 0; i < words.size(); ++i) {
+            uint64_t available = i < wordCount ? bits[i] : 0;
+            if ((words[i] & available) != words[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool RoleSet::intersects(const uint64_t* bits, size_t wordCount) const {
+        size_t count = words.size() < wordCount ? words.size() : wordCount;
+        for (size_t i = 0; i < count; ++i) {
+            if ((words[i] & bits[i]) != 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    RoleTable::Index::Index(size_t slotCount)
+        : mask(slotCount - 1), slots(new std::atomic<const Entry*>[slotCount]) {
+        for (size_t i = 0; i < slotCount; ++i) {
+            slots[i].store(NULL, std::memory_order_relaxed);
+        }
+    }
+
+    RoleTable::RoleTable() {
+        indexes.push_back(std::unique_ptr<Index>(new Index(INITIAL_SLOTS)));
+        current.store(indexes.back().get(), std::memory_order_release);
+    }
+
+    RoleTable& RoleTable::instance() {
+        static RoleTable table;
+        return table;
+    }
+
+    bool RoleTable::intern(const char* name, size_t length, RoleId& id) {
+        uint64_t hash = hashOf(name, length);
+        if (find(*current.load(std::memory_order_acquire), name, length, hash, id)) {
+            return true;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        // Another thread may have added it meanwhile.
+        if (find(*indexes.back(), name, length, hash, id)) {
+            return true;
+        }
+        if (entries.size() >= MAX_ROLES) {
+            return false;
+        }
+        Entry entry;
+        entry.name.assign(name, length);
+        entry.hash = hash;
+        entry.id = RoleId(entries.size());
+        entries.push_back(entry);
+
+        Index& index = *indexes.back();
+        if (2 * entries.size() > index.mask + 1) {
+            // Readers keep using the old index until they see the new one.
+            std::unique_ptr<Index> grown(new Index(2 * (index.mask + 1)));
+            for (size_t i = 0; i < entries.size(); ++i) {
+                place(*grown, &entries[i]);
+            }
+            indexes.push_back(std::move(grown));
+            current.store(indexes.back().get(), std::memory_order_release);
+        } else {
+            place(index, &entries.back());
+        }
+        id = entries.back().id;
+        return true;
+    }
+
+    size_t RoleTable::size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.size();
+    }
+
+    uint64_t RoleTable::hashOf(const char* name, size_t length) {
+        // FNV-1a, role names are short and not chosen by the caller of intern.
+        uint64_t hash = UINT64_C(14695981039346656037);
+        for (size_t i = 0; i < length; ++i) {
+            hash ^= static_cast<unsigned char>(name[i]);
+            hash *= UINT64_C(1099511628211);
+        }
+        return hash;
+    }
+
+    bool RoleTable::find(const Index& index, const char* name, size_t length, uint64_t hash, RoleId& id) {
+        for (size_t slot = size_t(hash) & index.mask;; slot = (slot + 1) & index.mask) {
+            const Entry* entry = index.slots[slot].load(std::memory_order_acquire);
+            if (entry == NULL) {
+                return false;
+            }
+            if (entry->hash == hash && entry->name.size() == length
+                && memcmp(entry->name.data(), name, length) == 0) {
+                id = entry->id;
+                return true;
+            }
+        }
+    }
+
+    void RoleTable::place(Index& index, const Entry* entry) {
+        size_t slot = size_t(entry->hash) & index.mask;
+        while (index.slots[slot].load(std::memory_order_relaxed) != NULL) {
+            slot = (slot + 1) & index.mask;
+        }
+        index.slots[slot].store(entry, std::memory_order_release);
+    }
+}}
@@ -0,0 +1,268 @@
+#include "keystone/impl/SessionCache.hpp"
+#include "keystone/impl/Clock.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+
+namespace {
+    // How long the refresh thread sleeps when there is nothing to refresh.
+    const int64_t IDLE_WAKE_NANOSECONDS = INT64_C(60000000000);
+
+    // The delay before a failed refresh is retried, at most.
+    const int64_t MAX_RETRY_NANOSECONDS = INT64_C(5000000000);
+
+    // The compiler must not drop the wipe as a dead store.
+    void wipe(std::string& secret) {
+        volatile char* data = secret.empty() ? NULL : &secret[0];
+        for (size_t i = 0; i < secret.size(); i++) {
+            data[i] = 0;
+        }
+    }
+}
+
+
+namespace keystone { namespace impl {
+
+    SessionCache::Session::~Session() {
+        wipe(password);
+    }
+
+    SessionCache::SessionCache(size_t capacity, double lifetime, double refreshAfter, const Login& login)
+        : capacity(capacity > 0 ? capacity : 1), lifetime(lifetime), refreshAfter(refreshAfter),
+          loginFunction(login), passwordKey(randomSipKey()), stopping(false), pauses(0), refreshing(false) {
+        lifetimeNanoseconds = static_cast<int64_t>(lifetime * 1e9);
+        refreshAfterNanoseconds = static_cast<int64_t>(refreshAfter * 1e9);
+        refresher = std::thread(&SessionCache::refreshLoop, this);
+    }
+
+    SessionCache::~SessionCache() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeRefresher.notify_all();
+        refresher.join();
+    }
+
+    Status SessionCache::login(const std::string& username, const std::string& password,
+                               const std::string& tenantName, KeystoneUserInfo& info,
+                               RequestTimings* timings, bool& cached) {
+        std::string key = keyOf(username, password, tenantName);
+        std::unique_lock<std::mutex> lock(mutex);
+        std::shared_ptr<Session>& slot = sessions[key];
+        if (!slot) {
+            if (sessions.size() > capacity) {
+                evictOne();
+            }
+            slot = std::make_shared<Session>();
+            slot->username = username;
+            slot->password = password;
+            slot->tenantName = tenantName;
+        }
+        // The slot reference does not survive the waits below.
+        std::shared_ptr<Session> session = slot;
+        session->lastUsedAt = monotonicNanoseconds();
+        session->used = true;
+
+        uint64_t attempts = session->attempts;
+        while (!isFresh(*session, monotonicNanoseconds()) && session->loggingIn) {
+            loginDone.wait(lock);
+        }
+        if (isFresh(*session, monotonicNanoseconds())) {
+            info = session->info;
+            cached = true;
+            return Status();
+        }
+        if (session->attempts != attempts) {
+            // Another thread's login for this session just failed.
+            cached = true;
+            return session->lastStatus;
+        }
+
+        session->loggingIn = true;
+        lock.unlock();
+        KeystoneUserInfo fresh;
+        Status status;
+        try {
+            status = loginFunction(username, password, tenantName, fresh, timings);
+        } catch (...) {
+            status = Status(ERROR_UNKNOWN, "Unknown error");
+        }
+        lock.lock();
+        session->loggingIn = false;
+        session->attempts++;
+        session->lastStatus = status;
+        if (status.isOk()) {
+            session->info = fresh;
+            session->obtainedAt = monotonicNanoseconds();
+            session->retryAt = 0;
+            session->used = false;
+            info = fresh;
+        } else if (session->obtainedAt == 0) {
+            // Failed logins (eg. wrong passwords) are not kept.
+            std::unordered_map<std::string, std::shared_ptr<Session> >::iterator found = sessions.find(key);
+            if (found != sessions.end() && found->second == session) {
+                sessions.erase(found);
+            }
+        }
+        lock.unlock();
+        loginDone.notify_all();
+        wakeRefresher.notify_all();
+        cached = false;
+        return status;
+    }
+
+    void SessionCache::pause() {
+        std::unique_lock<std::mutex> lock(mutex);
+        pauses++;
+        while (refreshing) {
+            refreshDone.wait(lock);
+        }
+    }
+
+    void SessionCache::resume() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pauses--;
+        }
+        wakeRefresher.notify_all();
+    }
+
+    void SessionCache::clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        sessions.clear();
+    }
+
+    size_t SessionCache::eraseIf(const std::function<bool(const KeystoneUserInfo& info)>& match) {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t erased = 0;
+        for (std::unordered_map<std::string, std::shared_ptr<Session> >::iterator it = sessions.begin();
+             it != sessions.end();) {
+            if (it->second->obtainedAt != 0 && match(it->second->info)) {
+                it = sessions.erase(it);
+                erased++;
+            } else {
+                ++it;
+            }
+        }
+        return erased;
+    }
+
+    size_t SessionCache::size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return sessions.size();
+    }
+
+    std::string SessionCache::keyOf(const std::string& username, const std::string& password,
+                                    const std::string& tenantName) const {
+        uint64_t digest[2];
+        sipHash128(passwordKey, password.data(), password.size(), digest);
+        std::string key;
+        key.reserve(username.size() + tenantName.size() + 2 + sizeof(digest));
+        key += username;
+        key += '\0';
+        key += tenantName;
+        key += '\0';
+        key.append(reinterpret_cast<const char*>(digest), sizeof(digest));
+        return key;
+    }
+
+    bool SessionCache::isFresh(const Session& session, int64_t now) const {
+        return session.obtainedAt != 0 && now < session.obtainedAt + lifetimeNanoseconds;
+    }
+
+    void SessionCache::evictOne() {
+        std::unordered_map<std::string, std::shared_ptr<Session> >::iterator oldest = sessions.end();
+        for (std::unordered_map<std::string, std::shared_ptr<Session> >::iterator it = sessions.begin();
+             it != sessions.end(); ++it) {
+            if (it->second && !it->second->loggingIn
+                && (oldest == sessions.end() || it->second->lastUsedAt < oldest->second->lastUsedAt)) {
+                oldest = it;
+            }
+        }
+        if (oldest != sessions.end()) {
+            sessions.erase(oldest);
+        }
+    }
+
+    void SessionCache::refreshLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping) {
+            if (pauses > 0) {
+                wakeRefresher.wait(lock);
+                continue;
+            }
+            int64_t now = monotonicNanoseconds();
+            int64_t wakeAt = now + IDLE_WAKE_NANOSECONDS;
+            std::vector<std::shared_ptr<Session> > due;
+            for (std::unordered_map<std::string, std::shared_ptr<Session> >::iterator it = sessions.begin();
+                 it != sessions.end();) {
+                Session& session = *it->second;
+                if (session.loggingIn || session.obtainedAt == 0) {
+                    ++it;
+                    continue;
+                }
+                int64_t refreshAt = std::max(session.obtainedAt + refreshAfterNanoseconds, session.retryAt);
+                if (refreshAt > now) {
+                    wakeAt = std::min(wakeAt, refreshAt);
+                    ++it;
+                } else if (!session.used) {
+                    it = sessions.erase(it);
+                } else {
+                    session.loggingIn = true;
+                    due.push_back(it->second);
+                    ++it;
+                }
+            }
+
+            size_t refreshed = 0;
+            for (; refreshed < due.size() && !stopping && pauses == 0; refreshed++) {
+                Session& session = *due[refreshed];
+                refreshing = true;
+                lock.unlock();
+                KeystoneUserInfo fresh;
+                Status status;
+                try {
+                    status = loginFunction(session.username, session.password, session.tenantName, fresh, NULL);
+                } catch (...) {
+                    status = Status(ERROR_UNKNOWN, "Unknown error");
+                }
+                lock.lock();
+                refreshing = false;
+                refreshDone.notify_all();
+                session.loggingIn = false;
+                session.attempts++;
+                int64_t finished = monotonicNanoseconds();
+                if (status.isOk()) {
+                    session.info = fresh;
+                    session.obtainedAt = finished;
+                    session.retryAt = 0;
+                    session.used = false;
+                } else if (isFresh(session, finished)) {
+                    // Callers keep getting the old session until its lifetime is over.
+                    int64_t remaining = session.obtainedAt + lifetimeNanoseconds - finished;
+                    session.retryAt = finished + std::max<int64_t>(std::min(MAX_RETRY_NANOSECONDS, remaining / 4),
+                                                                   INT64_C(100000000));
+                } else {
+                    // Too late, the next caller logs in itself.
+                    session.info = KeystoneUserInfo();
+                    session.obtainedAt = 0;
+                }
+                session.lastStatus = status;
+                loginDone.notify_all();
+            }
+            if (!due.empty()) {
+                // Release the sessions left over when stopping or pausing, and look again.
+                for (size_t i = refreshed; i < due.size(); i++) {
+                    due[i]->loggingIn = false;
+                }
+                loginDone.notify_all();
+                continue;
+            }
+
+            wakeRefresher.wait_for(lock, std::chrono::nanoseconds(wakeAt - now));
+        }
+    }
+}}
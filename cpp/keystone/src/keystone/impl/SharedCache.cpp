@@ -0,0 +1,423 @@
+#include "keystone/impl/SharedCache.hpp"
+#include "keystone/impl/Clock.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace {
+    const uint64_t SEGMENT_MAGIC = UINT64_C(0x4b53484d43414348); // "KSHMCACH"
+    const uint32_t SEGMENT_VERSION = 3;
+
+    // How long an attaching process waits for the creator to finish the header.
+    const int ATTACH_WAIT_MILLISECONDS = 1000;
+
+    // Reads retried because a writer was active, before the slot is taken as a miss.
+    const int READ_ATTEMPTS = 4;
+
+    size_t roundUpToPowerOfTwo(size_t value) {
+        size_t result = 1;
+        while (result < value) {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    thread_local std::vector<char> recordBuffer;
+}
+
+
+namespace keystone { namespace impl {
+
+    /**
+     * The start of the segment, padded to a cache line. The creator sets the
+     * magic last, attaching processes wait for it.
+     */
+    struct SharedCache::Header {
+        std::atomic<uint64_t> magic;
+        uint32_t version;
+        uint32_t slotSize;
+        uint64_t slotCount;
+        uint64_t segmentSize;
+        // Entries of older generations are ignored, see clear().
+        std::atomic<uint64_t> generation;
+        // The SipKey of the cache keys, drawn by the creator.
+        uint64_t hashKey[2];
+        char padding[64 - 7 * sizeof(uint64_t)];
+    };
+
+    /**
+     * The start of each slot, followed by the record. The fields are atomics
+     * only so that the racy reads of the seqlock are well defined; the
+     * sequence decides whether what was read is used.
+     */
+    struct SharedCache::Slot {
+        // Odd while a writer is busy, 0 if the slot was never written.
+        std::atomic<uint32_t> sequence;
+        std::atomic<uint32_t> recordSize;
+        std::atomic<uint64_t> keyLow;
+        std::atomic<uint64_t> keyHigh;
+        std::atomic<int64_t> expiresAt;
+        std::atomic<uint64_t> generation;
+
+        char* record() {
+            return reinterpret_cast<char*>(this + 1);
+        }
+    };
+
+    SharedCache::SharedCache() : ttlNanoseconds(0), segment(NULL), segmentSize(0), header(NULL) {
+        key.k0 = 0;
+        key.k1 = 0;
+    }
+
+    SharedCache::~SharedCache() {
+        close();
+    }
+
+#if defined(_WIN32)
+
+    Status SharedCache::open(const std::string&, size_t, size_t, double) {
+        return Status(ERROR_INVALID_ARGUMENT, "Shared memory caches are not supported on this platform");
+    }
+
+    void SharedCache::close() {}
+
+#else
+
+    Status SharedCache::open(const std::string& name, size_t capacity, size_t slotSize, double ttl) {
+        close();
+        if (name.size() < 2 || name.size() > 251 || name[0] != '/' || name.find('/', 1) != std::string::npos) {
+            return Status(ERROR_INVALID_ARGUMENT, "Invalid shared memory segment name");
+        }
+        slotSize = slotSize > 0 ? (slotSize + 63) / 64 * 64 : DEFAULT_SLOT_SIZE;
+        if (capacity == 0 || slotSize < sizeof(Slot) + 64) {
+            return Status(ERROR_INVALID_ARGUMENT, "Invalid shared cache geometry");
+        }
+        size_t slotCount = roundUpToPowerOfTwo(capacity);
+
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        bool created = fd >= 0;
+        if (!created) {
+            if (errno != EEXIST) {
+                return Status(ERROR_UNKNOWN, "Could not create the shared memory segment");
+            }
+            fd = shm_open(name.c_str(), O_RDWR, 0600);
+            if (fd < 0) {
+                return Status(ERROR_UNKNOWN, "Could not open the shared memory segment");
+            }
+            // Whoever can write the segment knows its key and can plant any userinfo, so
+            // only segments private to this user are attached (as with cache files).
+            struct stat owner;
+            if (fstat(fd, &owner) != 0 || !S_ISREG(owner.st_mode) || owner.st_uid != geteuid()
+                || (owner.st_mode & (S_IRWXG | S_IRWXO)) != 0) {
+                ::close(fd);
+                return Status(ERROR_INVALID_ARGUMENT, "The shared memory segment is not private to this user");
+            }
+        }
+
+        void* mapping = MAP_FAILED;
+        size_t mappingSize = 0;
+        if (created) {
+            mappingSize = sizeof(Header) + slotCount * slotSize;
+            // The new pages read as zero: no slot has been written.
+            if (ftruncate(fd, off_t(mappingSize)) == 0) {
+                mapping = mmap(NULL, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            }
+            if (mapping != MAP_FAILED) {
+                Header* fresh = static_cast<Header*>(mapping);
+                fresh->version = SEGMENT_VERSION;
+                fresh->slotSize = uint32_t(slotSize);
+                fresh->slotCount = slotCount;
+                fresh->segmentSize = mappingSize;
+                fresh->generation.store(1, std::memory_order_relaxed);
+                SipKey drawn = randomSipKey();
+                fresh->hashKey[0] = drawn.k0;
+                fresh->hashKey[1] = drawn.k1;
+                fresh->magic.store(SEGMENT_MAGIC, std::memory_order_release);
+            }
+            else {
+                shm_unlink(name.c_str());
+            }
+        }
+        else {
+            // Wait for the creator to size the segment and fill in the header.
+            for (int waited = 0; waited < ATTACH_WAIT_MILLISECONDS; waited++) {
+                struct stat status;
+                if (fstat(fd, &status) == 0 && size_t(status.st_size) >= sizeof(Header)) {
+                    void* headerMapping = mmap(NULL, sizeof(Header), PROT_READ, MAP_SHARED, fd, 0);
+                    if (headerMapping != MAP_FAILED) {
+                        const Header* existing = static_cast<const Header*>(headerMapping);
+                        if (existing->magic.load(std::memory_order_acquire) == SEGMENT_MAGIC) {
+                            mappingSize = existing->segmentSize;
+                            bool valid = existing->version == SEGMENT_VERSION
+                                && existing->slotSize >= sizeof(Slot) + 64 && existing->slotSize % 64 == 0
+                                && existing->slotCount > 0 && (existing->slotCount & (existing->slotCount - 1)) == 0
+                                && mappingSize == sizeof(Header) + existing->slotCount * existing->slotSize
+                                && size_t(status.st_size) >= mappingSize;
+                            munmap(headerMapping, sizeof(Header));
+                            if (!valid) {
+                                ::close(fd);
+                                return Status(ERROR_INVALID_ARGUMENT, "The shared memory segment has an incompatible layout");
+                            }
+                            mapping = mmap(NULL, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                            break;
+                        }
+                        munmap(headerMapping, sizeof(Header));
+                    }
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            return Status(ERROR_UNKNOWN, "Could not map the shared memory segment");
+        }
+
+        this->name = name;
+        ttlNanoseconds = static_cast<int64_t>(ttl * 1e9);
+        segment = mapping;
+        segmentSize = mappingSize;
+        header = static_cast<Header*>(mapping);
+        key.k0 = header->hashKey[0];
+        key.k1 = header->hashKey[1];
+        return Status();
+    }
+
+    void SharedCache::close() {
+        if (segment != NULL) {
+            munmap(segment, segmentSize);
+            segment = NULL;
+            segmentSize = 0;
+            header = NULL;
+        }
+    }
+
+#endif
+
+    size_t SharedCache::getCapacity() const {
+        return header != NULL ? size_t(header->slotCount) : 0;
+    }
+
+    size_t SharedCache::getSlotSize() const {
+        return header != NULL ? size_t(header->slotSize) : 0;
+    }
+
+    SharedCache::Slot* SharedCache::slot(size_t index) const {
+        char* slots = static_cast<char*>(segment) + sizeof(Header);
+        return reinterpret_cast<Slot*>(slots + (index & (header->slotCount - 1)) * header->slotSize);
+    }
+
+    bool SharedCache::find(const CacheKey& key, KeystoneUserInfo& info) const {
+        if (header == NULL) {
+            return false;
+        }
+        uint64_t generation = header->generation.load(std::memory_order_acquire);
+        int64_t now = coarseMonotonicNanoseconds();
+        size_t maxRecordSize = header->slotSize - sizeof(Slot);
+        recordBuffer.resize(maxRecordSize);
+
+        for (unsigned probe = 0; probe < PROBE_LIMIT; probe++) {
+            Slot* candidate = slot(size_t(key.low) + probe);
+            for (int attempt = 0; attempt < READ_ATTEMPTS; attempt++) {
+                uint32_t sequence = candidate->sequence.load(std::memory_order_acquire);
+                if (sequence == 0) {
+                    // Slots are never emptied, so the token is not further on.
+                    return false;
+                }
+                if (sequence & 1) {
+                    continue;
+                }
+                CacheKey candidateKey;
+                candidateKey.low = candidate->keyLow.load(std::memory_order_relaxed);
+                candidateKey.high = candidate->keyHigh.load(std::memory_order_relaxed);
+                if (!sameCacheKey(candidateKey, key)) {
+                    break;
+                }
+                int64_t expiresAt = candidate->expiresAt.load(std::memory_order_relaxed);
+                uint64_t entryGeneration = candidate->generation.load(std::memory_order_relaxed);
+                size_t recordSize = candidate->recordSize.load(std::memory_order_relaxed);
+                if (recordSize > maxRecordSize) {
+                    continue;
+                }
+                // A seqlock read: the copy may be torn, which the sequence check below detects.
+                memcpy(&recordBuffer[0], candidate->record(), recordSize);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (candidate->sequence.load(std::memory_order_relaxed) != sequence) {
+                    continue;
+                }
+
+                if (entryGeneration != generation || expiresAt <= now) {
+                    return false;
+                }
+                KeystoneUserInfo found;
+                if (!KeystoneUserInfo::fromRecord(&recordBuffer[0], recordSize, found)) {
+                    return false;
+                }
+                info.swap(found);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void SharedCache::insert(const CacheKey& key, const KeystoneUserInfo& info) {
+        insert(key, info, coarseMonotonicNanoseconds() + ttlNanoseconds);
+    }
+
+    void SharedCache::insert(const CacheKey& key, const KeystoneUserInfo& info, int64_t expiresAt) {
+        if (info.getToken().size != 0) {
+            insert(key, info.withoutToken(), expiresAt);
+            return;
+        }
+        if (header == NULL || info.getRecordSize() > header->slotSize - sizeof(Slot)) {
+            return;
+        }
+        uint64_t generation = header->generation.load(std::memory_order_acquire);
+        int64_t now = coarseMonotonicNanoseconds();
+
+        // Prefer the slot of the same key, then a never used one, then a stale one,
+        // and else the one that expires first.
+        Slot* chosen = NULL;
+        uint32_t chosenSequence = 0;
+        int chosenRank = -1;
+        int64_t chosenExpiry = 0;
+        for (unsigned probe = 0; probe < PROBE_LIMIT && chosenRank < 3; probe++) {
+            Slot* candidate = slot(size_t(key.low) + probe);
+            uint32_t sequence = candidate->sequence.load(std::memory_order_acquire);
+            if (sequence & 1) {
+                continue;
+            }
+            int64_t candidateExpiry = candidate->expiresAt.load(std::memory_order_relaxed);
+            int rank;
+            if (sequence != 0 && candidate->keyLow.load(std::memory_order_relaxed) == key.low
+                && candidate->keyHigh.load(std::memory_order_relaxed) == key.high) {
+                rank = 3;
+            }
+            else if (sequence == 0) {
+                rank = 2;
+            }
+            else if (candidate->generation.load(std::memory_order_relaxed) != generation || candidateExpiry <= now) {
+                rank = 1;
+            }
+            else {
+                rank = 0;
+            }
+            if (rank > chosenRank || (rank == 0 && chosenRank == 0 && candidateExpiry < chosenExpiry)) {
+                chosen = candidate;
+                chosenSequence = sequence;
+                chosenRank = rank;
+                chosenExpiry = candidateExpiry;
+            }
+            if (rank == 2) {
+                // Slots after a never used one are never used either.
+                break;
+            }
+        }
+        if (chosen == NULL
+            || !chosen->sequence.compare_exchange_strong(chosenSequence, chosenSequence + 1, std::memory_order_acq_rel)) {
+            return;
+        }
+        // Readers must see the odd sequence before any of the new contents.
+        std::atomic_thread_fence(std::memory_order_release);
+
+        chosen->recordSize.store(uint32_t(info.getRecordSize()), std::memory_order_relaxed);
+        chosen->keyLow.store(key.low, std::memory_order_relaxed);
+        chosen->keyHigh.store(key.high, std::memory_order_relaxed);
+        chosen->expiresAt.store(expiresAt, std::memory_order_relaxed);
+        chosen->generation.store(generation, std::memory_order_relaxed);
+        memcpy(chosen->record(), info.getRecord(), info.getRecordSize());
+        chosen->sequence.store(chosenSequence + 2, std::memory_order_release);
+    }
+
+    void SharedCache::collect(std::vector<CachedUserInfo>& entries) const {
+        if (header == NULL) {
+            return;
+        }
+        uint64_t currentGeneration = header->generation.load(std::memory_order_acquire);
+        int64_t now = coarseMonotonicNanoseconds();
+        for (size_t i = 0; i < header->slotCount; i++) {
+            CacheKey key;
+            int64_t expiresAt;
+            uint64_t generation;
+            KeystoneUserInfo info;
+            if (read(slot(i), key, expiresAt, generation, info) && generation == currentGeneration && expiresAt > now) {
+                entries.push_back(CachedUserInfo(key, info, expiresAt));
+            }
+        }
+    }
+
+    bool SharedCache::read(Slot* slot, CacheKey& key, int64_t& expiresAt, uint64_t& generation,
+                           KeystoneUserInfo& info) const {
+        size_t maxRecordSize = header->slotSize - sizeof(Slot);
+        recordBuffer.resize(maxRecordSize);
+        for (int attempt = 0; attempt < READ_ATTEMPTS; attempt++) {
+            uint32_t sequence = slot->sequence.load(std::memory_order_acquire);
+            if (sequence == 0) {
+                return false;
+            }
+            if (sequence & 1) {
+                continue;
+            }
+            key.low = slot->keyLow.load(std::memory_order_relaxed);
+            key.high = slot->keyHigh.load(std::memory_order_relaxed);
+            expiresAt = slot->expiresAt.load(std::memory_order_relaxed);
+            generation = slot->generation.load(std::memory_order_relaxed);
+            size_t recordSize = slot->recordSize.load(std::memory_order_relaxed);
+            if (recordSize > maxRecordSize) {
+                continue;
+            }
+            memcpy(&recordBuffer[0], slot->record(), recordSize);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot->sequence.load(std::memory_order_relaxed) == sequence) {
+                return KeystoneUserInfo::fromRecord(&recordBuffer[0], recordSize, info);
+            }
+        }
+        return false;
+    }
+
+    size_t SharedCache::eraseIf(const CacheEntryMatch& match) {
+        if (header == NULL) {
+            return 0;
+        }
+        uint64_t currentGeneration = header->generation.load(std::memory_order_acquire);
+        size_t erased = 0;
+        for (size_t i = 0; i < header->slotCount; i++) {
+            Slot* candidate = slot(i);
+            uint32_t sequence = candidate->sequence.load(std::memory_order_acquire);
+            CacheKey key;
+            int64_t expiresAt;
+            uint64_t generation;
+            KeystoneUserInfo info;
+            if (sequence == 0 || (sequence & 1) || !read(candidate, key, expiresAt, generation, info)
+                || generation != currentGeneration || !match(key, info)) {
+                continue;
+            }
+            // Fails if the slot was rewritten since it was read, and then holds another entry.
+            if (!candidate->sequence.compare_exchange_strong(sequence, sequence + 1, std::memory_order_acq_rel)) {
+                continue;
+            }
+            std::atomic_thread_fence(std::memory_order_release);
+            candidate->expiresAt.store(0, std::memory_order_relaxed);
+            candidate->sequence.store(sequence + 2, std::memory_order_release);
+            erased++;
+        }
+        return erased;
+    }
+
+    void SharedCache::clear() {
+        if (header != NULL) {
+            header->generation.fetch_add(1, std::memory_order_acq_rel);
+        }
+    }
+}}
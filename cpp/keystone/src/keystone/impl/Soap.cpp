@@ -0,0 +1,268 @@
+#include "keystone/impl/Soap.hpp"
+#include "keystone/impl/Error.hpp"
+#include "pugi4lunch/pugixml.hpp"
+
+#include <ctype.h>
+#include <string.h>
+
+
+
+namespace {
+    const char ENVELOPE_BEGIN[] =
+        "<?xml version='1.0' encoding='UTF-8'?>\n"
+        "<S:Envelope xmlns:S='http://schemas.xmlsoap.org/soap/envelope/' xmlns:SOAP-ENV='http://schemas.xmlsoap.org/soap/envelope/'>\n"
+        "<SOAP-ENV:Header/>\n"
+        "<S:Body>\n";
+
+    const char ENVELOPE_END[] =
+        "</S:Body>\n"
+        "</S:Envelope>\n";
+
+    void beginEnvelope(std::string& request, const char* operation) {
+        request.clear();
+        request.reserve(512);
+        request += ENVELOPE_BEGIN;
+        request += "<ns2:";
+        request += operation;
+        request += " xmlns:ns2='http://authmanager.sintef.no/'>\n";
+    }
+
+    void addElement(std::string& request, const char* name, const std::string& value) {
+        request += "<ns2:";
+        request += name;
+        request += ">";
+        request += value;
+        request += "</ns2:";
+        request += name;
+        request += ">\n";
+    }
+
+    void endEnvelope(std::string& request, const char* operation) {
+        request += "</ns2:";
+        request += operation;
+        request += ">\n";
+        request += ENVELOPE_END;
+    }
+
+    using keystone::impl::Status;
+    using keystone::impl::ERROR_PARSE;
+
+    const Status NOT_XML(ERROR_PARSE, "Could not parse xml document returned from server");
+    const Status UNEXPECTED_STRUCTURE(ERROR_PARSE, "Unexpected XML document structure");
+
+    /**
+     * Parses the document and finds the response node of the given operation.
+     */
+    Status responseNode(pugi4lunch::pugi::xml_document& document,
+        std::string& response, const char* responseName, pugi4lunch::pugi::xml_node& node) {
+        if (response.empty() || !document.load_buffer_inplace(&response[0], response.size())) {
+            return NOT_XML;
+        }
+
+        pugi4lunch::pugi::xml_node envelopeNode = document.child("S:Envelope");
+
+        if(!envelopeNode) {
+            return UNEXPECTED_STRUCTURE;
+        }
+
+        pugi4lunch::pugi::xml_node bodyNode = envelopeNode.child("S:Body");
+
+        if(!bodyNode) {
+            return UNEXPECTED_STRUCTURE;
+        }
+
+        node = bodyNode.child(responseName);
+
+        if(!node) {
+            return UNEXPECTED_STRUCTURE;
+        }
+        return Status();
+    }
+
+    /**
+     * Gets the text of the single <return> element of a response.
+     */
+    Status returnValue(pugi4lunch::pugi::xml_document& document, std::string& response,
+                       const char* responseName, std::string& value) {
+        pugi4lunch::pugi::xml_node node;
+        Status status = responseNode(document, response, responseName, node);
+        if (!status.isOk()) {
+            return status;
+        }
+
+        pugi4lunch::pugi::xml_node returnNode = node.child("return");
+        if (!returnNode) {
+            return UNEXPECTED_STRUCTURE;
+        }
+
+        pugi4lunch::pugi::xml_node valueNode = returnNode.first_child();
+        if (!valueNode) {
+            return UNEXPECTED_STRUCTURE;
+        }
+
+        value = valueNode.value();
+        if(value.size() == 0) {
+            return UNEXPECTED_STRUCTURE;
+        }
+        return Status();
+    }
+    // Fault reasons (in lower case) of the service rejecting the credentials or the token.
+    const char* const REJECTION_REASONS[] = {
+        "invalid credentials", "invalid username", "invalid password", "invalid token", "invalid session",
+        "bad authorization", "unauthorized", "not authorized", "authentication failed", "access denied",
+        "expired"
+    };
+
+    const char* localName(const char* name) {
+        const char* colon = strrchr(name, ':');
+        return colon != NULL ? colon + 1 : name;
+    }
+
+    struct LocalNameIs {
+        const char* name;
+
+        bool operator()(pugi4lunch::pugi::xml_node node) const {
+            return node.type() == pugi4lunch::pugi::node_element && strcmp(localName(node.name()), name) == 0;
+        }
+    };
+
+    /**
+     * The text of the first element named \c first or else \c second (in any namespace) below \c node.
+     */
+    std::string descendantText(pugi4lunch::pugi::xml_node node, const char* first, const char* second) {
+        LocalNameIs firstName = { first };
+        pugi4lunch::pugi::xml_node found = node.find_node(firstName);
+        if (!found) {
+            LocalNameIs secondName = { second };
+            found = node.find_node(secondName);
+        }
+        return found ? found.child_value() : "";
+    }
+
+    bool isSenderFault(const std::string& code) {
+        // SOAP 1.1 Client (or a Client.* subcode), SOAP 1.2 Sender.
+        const char* name = localName(code.c_str());
+        return strncmp(name, "Client", 6) == 0 || strcmp(name, "Sender") == 0;
+    }
+
+    bool hasRejectionReason(std::string reason) {
+        for (size_t i = 0; i < reason.size(); i++) {
+            reason[i] = char(tolower((unsigned char)reason[i]));
+        }
+        for (size_t i = 0; i < sizeof(REJECTION_REASONS) / sizeof(REJECTION_REASONS[0]); i++) {
+            if (reason.find(REJECTION_REASONS[i]) != std::string::npos) {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+namespace keystone { namespace impl { namespace soap {
+
+    void buildGetSessionTokenRequest(const std::string& username,
+        const std::string& password,
+        const std::string& tenantName,
+        std::string& request) {
+        beginEnvelope(request, "getSessionToken");
+        addElement(request, "username", username);
+        addElement(request, "password", password);
+        addElement(request, "project", tenantName);
+        endEnvelope(request, "getSessionToken");
+    }
+
+    void buildGetUsernameRequest(const std::string& sessionToken, std::string& request) {
+        beginEnvelope(request, "getUsername");
+        addElement(request, "sessionToken", sessionToken);
+        endEnvelope(request, "getUsername");
+    }
+
+    void buildGetRolesRequest(const std::string& sessionToken, std::string& request) {
+        beginEnvelope(request, "getRoles");
+        addElement(request, "sessionToken", sessionToken);
+        endEnvelope(request, "getRoles");
+    }
+
+    bool isFault(const std::string& response) {
+        // Looks for a Fault start tag (any namespace prefix) without parsing the document.
+        static const char name[] = "Fault";
+        const size_t length = sizeof(name) - 1;
+        for (size_t at = response.find(name); at != std::string::npos; at = response.find(name, at + length)) {
+            if (at == 0 || at + length >= response.size()) {
+                continue;
+            }
+            char before = response[at - 1];
+            char after = response[at + length];
+            if ((before == '<' || before == ':') && (after == '>' || after == ' ' || after == '/')) {
+                size_t tagStart = response.rfind('<', at);
+                if (tagStart != std::string::npos && response[tagStart + 1] != '/') {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    bool isRejectionFault(const std::string& response) {
+        if (!isFault(response)) {
+            return false;
+        }
+        pugi4lunch::pugi::xml_document document;
+        if (!document.load_buffer(response.data(), response.size())) {
+            return false;
+        }
+        LocalNameIs faultName = { "Fault" };
+        pugi4lunch::pugi::xml_node fault = document.find_node(faultName);
+        if (!fault) {
+            return false;
+        }
+        return isSenderFault(descendantText(fault, "faultcode", "Value"))
+            || hasRejectionReason(descendantText(fault, "faultstring", "Text"));
+    }
+
+    Status classifyFailure(Operation operation, const Status& status, const std::string& response) {
+        if (status.code == ERROR_HTTP) {
+            if (status.httpStatus == 401 || status.httpStatus == 403
+                || (status.httpStatus == 500 && isRejectionFault(response))) {
+                if (operation == OPERATION_LOGIN) {
+                    return Status(ERROR_INVALID_CREDENTIALS, "The service rejected the credentials", status.httpStatus);
+                }
+                return Status(ERROR_INVALID_TOKEN, "The service rejected the session token", status.httpStatus);
+            }
+        }
+        return status;
+    }
+
+    Status parseGetSessionTokenResponse(std::string& response, std::string& sessionToken) {
+        pugi4lunch::pugi::xml_document document;
+        return returnValue(document, response, "ns2:getSessionTokenResponse", sessionToken);
+    }
+
+    Status parseGetUsernameResponse(std::string& response, std::string& username) {
+        pugi4lunch::pugi::xml_document document;
+        return returnValue(document, response, "ns2:getUsernameResponse", username);
+    }
+
+    Status parseGetRolesResponse(std::string& response, std::vector<std::string>& roles) {
+        pugi4lunch::pugi::xml_document document;
+        pugi4lunch::pugi::xml_node rolesNode;
+        Status status = responseNode(document, response, "ns2:getRolesResponse", rolesNode);
+        if (!status.isOk()) {
+            return status;
+        }
+
+        roles.clear();
+        for (pugi4lunch::pugi::xml_node returnNode = rolesNode.first_child(); returnNode; returnNode = returnNode.next_sibling()) {
+            pugi4lunch::pugi::xml_node roleNode = returnNode.first_child();
+            if (!roleNode) {
+                return UNEXPECTED_STRUCTURE;
+            }
+            const char* role = roleNode.value();
+            if (*role == '\0') {
+                return UNEXPECTED_STRUCTURE;
+            }
+            roles.push_back(role);
+        }
+        return Status();
+    }
+}}}
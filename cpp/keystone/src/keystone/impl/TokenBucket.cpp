@@ -0,0 +1,32 @@
+#include "keystone/impl/TokenBucket.hpp"
+#include "keystone/impl/Clock.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+
+namespace keystone { namespace impl {
+
+    TokenBucket::TokenBucket(double rate, double burst)
+        : rate(rate > 0 ? rate : 0), burst(burst > 1 ? burst : 1), tokens(this->burst),
+          updatedAt(monotonicNanoseconds()) {}
+
+    void TokenBucket::acquire() {
+        if (rate == 0) {
+            return;
+        }
+        double wait;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            int64_t now = monotonicNanoseconds();
+            tokens = std::min(burst, tokens + (now - updatedAt) * 1e-9 * rate);
+            updatedAt = now;
+            tokens -= 1;
+            wait = tokens < 0 ? -tokens / rate : 0;
+        }
+        if (wait > 0) {
+            std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+        }
+    }
+}}
@@ -0,0 +1,504 @@
+#include "keystone/impl/TokenCache.hpp"
+#include "keystone/impl/Epoch.hpp"
+#include "keystone/impl/Clock.hpp"
+#include "keystone/impl/Hash.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+
+namespace {
+    size_t roundUpToPowerOfTwo(size_t value) {
+        size_t result = 1;
+        while (result < value) {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    // Main entries compared when a W-TinyLFU shard needs a victim.
+    const size_t VICTIM_SAMPLE = 8;
+
+    // The smallest entry the frequency sketches are sized for, see setMemoryLimit.
+    const size_t MIN_ENTRY_BYTES = 128;
+
+    // Lookups counted in the frequency sketches: one in this many per thread, so that hits
+    // mostly leave the shared sketch words alone. Inserts are all counted.
+    const uint32_t SKETCH_SAMPLE_INTERVAL = 8;
+
+    thread_local uint32_t lookupsSinceSample = 0;
+
+    bool sampleLookup() {
+        if (++lookupsSinceSample < SKETCH_SAMPLE_INTERVAL) {
+            return false;
+        }
+        lookupsSinceSample = 0;
+        return true;
+    }
+
+    size_t roundDownToPowerOfTwo(size_t value) {
+        size_t result = 1;
+        while (result <= value / 2) {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    /**
+     * An entry of a per-thread table. Only ever touched by its thread.
+     */
+    struct LocalSlot {
+        LocalSlot() : invalidations(0), expiresAt(0) {
+            key.low = 0;
+            key.high = 0;
+        }
+
+        keystone::impl::CacheKey key;
+        // The invalidation count of the cache when the entry was copied (0 for empty slots).
+        uint64_t invalidations;
+        int64_t expiresAt;
+        keystone::impl::KeystoneUserInfo info;
+    };
+
+    struct LocalTable {
+        uint64_t cacheId;
+        std::vector<LocalSlot> slots;
+    };
+
+    // The tables of the caches this thread used lately. There are only a few caches
+    // (one per handle), so they are searched linearly.
+    const size_t maxLocalTables = 8;
+    thread_local std::vector<LocalTable> localTables;
+
+    std::atomic<uint64_t> nextLocalId(1);
+
+    LocalSlot& localSlot(uint64_t cacheId, size_t entries, uint64_t hash) {
+        for (size_t i = 0; i < localTables.size(); i++) {
+            if (localTables[i].cacheId == cacheId) {
+                return localTables[i].slots[hash & (entries - 1)];
+            }
+        }
+        if (localTables.size() >= maxLocalTables) {
+            localTables.erase(localTables.begin());
+        }
+        localTables.push_back(LocalTable());
+        localTables.back().cacheId = cacheId;
+        localTables.back().slots.resize(entries);
+        return localTables.back().slots[hash & (entries - 1)];
+    }
+}
+
+
+namespace keystone { namespace impl {
+
+    TokenCache::TokenCache(size_t capacity, double ttl, size_t shardCount)
+        : capacity(capacity > 0 ? capacity : 1), ttl(ttl),
+          memoryLimit(0), shardByteBudget(0), shardWindowBudget(0),
+          localId(nextLocalId.fetch_add(1)), localEntries(0), localStalenessNanoseconds(0), invalidations(1) {
+        ttlNanoseconds = static_cast<int64_t>(ttl * 1e9);
+        if (shardCount == 0) {
+            // Enough shards that writers on different cores rarely meet.
+            unsigned cores = std::thread::hardware_concurrency();
+            shardCount = cores > 4 ? 4 * cores : 16;
+        }
+        this->shardCount = roundUpToPowerOfTwo(shardCount);
+        if (this->shardCount > this->capacity) {
+            this->shardCount = roundDownToPowerOfTwo(this->capacity);
+        }
+        shardCapacity = (this->capacity + this->shardCount - 1) / this->shardCount;
+        bucketCount = roundUpToPowerOfTwo(shardCapacity);
+
+        shards.reset(new Shard[this->shardCount]);
+        for (size_t i = 0; i < this->shardCount; i++) {
+            shards[i].buckets.reset(new std::atomic<Entry*>[bucketCount]);
+            shards[i].random = mix64(i + 1);
+            for (size_t j = 0; j < bucketCount; j++) {
+                shards[i].buckets[j].store(NULL, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    TokenCache::~TokenCache() {
+        for (size_t i = 0; i < shardCount; i++) {
+            for (size_t j = 0; j < bucketCount; j++) {
+                Entry* entry = shards[i].buckets[j].load(std::memory_order_relaxed);
+                while (entry != NULL) {
+                    Entry* next = entry->next.load(std::memory_order_relaxed);
+                    delete entry;
+                    entry = next;
+                }
+            }
+        }
+    }
+
+    bool TokenCache::find(const CacheKey& key, KeystoneUserInfo& info) const {
+        int64_t now = coarseMonotonicNanoseconds();
+        LocalSlot* local = NULL;
+        uint64_t currentInvalidations = 0;
+        if (localEntries > 0) {
+            // Read before the shards, so an entry copied during a clear() is not trusted afterwards.
+            currentInvalidations = invalidations.load(std::memory_order_acquire);
+            local = &localSlot(localId, localEntries, key.low);
+            if (sameCacheKey(local->key, key) && local->invalidations == currentInvalidations && now < local->expiresAt) {
+                info = local->info;
+                return true;
+            }
+        }
+
+        EpochGuard guard;
+        Shard& shard = shardOf(key);
+        if (shard.sketch && sampleLookup()) {
+            shard.sketch->increment(key.low);
+        }
+        for (const Entry* entry = bucketOf(shard, key).load(std::memory_order_acquire);
+             entry != NULL; entry = entry->next.load(std::memory_order_acquire)) {
+            if (sameCacheKey(entry->key, key)) {
+                if (entry->expiresAt <= now) {
+                    return false;
+                }
+                info = entry->info;
+                if (local != NULL) {
+                    local->key = key;
+                    local->invalidations = currentInvalidations;
+                    local->expiresAt = std::min(entry->expiresAt, now + localStalenessNanoseconds);
+                    local->info = info.clone();
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void TokenCache::insert(const CacheKey& key, const KeystoneUserInfo& info) {
+        insert(key, info, coarseMonotonicNanoseconds() + ttlNanoseconds);
+    }
+
+    void TokenCache::insert(const CacheKey& key, const KeystoneUserInfo& info, int64_t expiresAt) {
+        if (info.getToken().size != 0) {
+            insert(key, info.withoutToken(), expiresAt);
+            return;
+        }
+        Entry* added = new Entry(key, expiresAt, info);
+        Entry* replaced = NULL;
+        Entry* evicted = NULL;
+        std::vector<Entry*> evictedEntries;
+        Shard& shard = shardOf(key);
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            std::atomic<Entry*>& bucket = bucketOf(shard, key);
+            std::atomic<Entry*>* link = &bucket;
+            for (Entry* entry = link->load(std::memory_order_relaxed); entry != NULL;
+                 link = &entry->next, entry = link->load(std::memory_order_relaxed)) {
+                if (sameCacheKey(entry->key, key)) {
+                    // Readers standing on the replaced entry can still follow its next pointer.
+                    link->store(entry->next.load(std::memory_order_relaxed), std::memory_order_release);
+                    replaced = entry;
+                    break;
+                }
+            }
+            if (replaced != NULL) {
+                // The new entry takes the place of the old one in the window or the main part.
+                shard.bytes -= replaced->bytes;
+                if (replaced->inWindow) {
+                    shard.windowBytes -= replaced->bytes;
+                    added->inWindow = true;
+                }
+            } else {
+                if (memoryLimit == 0 && shard.size >= shardCapacity) {
+                    evicted = evictBucket(shard);
+                }
+                shard.size++;
+                if (memoryLimit > 0) {
+                    added->inWindow = true;
+                    shard.window.push_back(key);
+                }
+            }
+            shard.bytes += added->bytes;
+            if (added->inWindow) {
+                shard.windowBytes += added->bytes;
+            }
+            added->next.store(bucket.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            bucket.store(added, std::memory_order_release);
+            if (memoryLimit > 0) {
+                shard.sketch->increment(key.low);
+                makeRoom(shard, evictedEntries);
+            }
+        }
+        if (replaced != NULL) {
+            EpochDomain::instance().retire(replaced, deleteEntry);
+        }
+        retireChain(evicted);
+        for (size_t i = 0; i < evictedEntries.size(); i++) {
+            EpochDomain::instance().retire(evictedEntries[i], deleteEntry);
+        }
+    }
+
+    void TokenCache::collect(std::vector<CachedUserInfo>& entries) const {
+        EpochGuard guard;
+        int64_t now = coarseMonotonicNanoseconds();
+        for (size_t i = 0; i < shardCount; i++) {
+            for (size_t j = 0; j < bucketCount; j++) {
+                for (const Entry* entry = shards[i].buckets[j].load(std::memory_order_acquire);
+                     entry != NULL; entry = entry->next.load(std::memory_order_acquire)) {
+                    if (entry->expiresAt > now) {
+                        entries.push_back(CachedUserInfo(entry->key, entry->info, entry->expiresAt));
+                    }
+                }
+            }
+        }
+    }
+
+    void TokenCache::clear() {
+        for (size_t i = 0; i < shardCount; i++) {
+            std::vector<Entry*> chains;
+            {
+                std::lock_guard<std::mutex> lock(shards[i].mutex);
+                for (size_t j = 0; j < bucketCount; j++) {
+                    Entry* chain = shards[i].buckets[j].exchange(NULL, std::memory_order_acq_rel);
+                    if (chain != NULL) {
+                        chains.push_back(chain);
+                    }
+                }
+                shards[i].size = 0;
+                shards[i].bytes = 0;
+                shards[i].windowBytes = 0;
+                shards[i].window.clear();
+            }
+            for (size_t j = 0; j < chains.size(); j++) {
+                retireChain(chains[j]);
+            }
+        }
+        invalidations.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    size_t TokenCache::eraseIf(const CacheEntryMatch& match) {
+        size_t erased = 0;
+        for (size_t i = 0; i < shardCount; i++) {
+            Shard& shard = shards[i];
+            std::vector<Entry*> removed;
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                for (size_t j = 0; j < bucketCount; j++) {
+                    std::atomic<Entry*>* link = &shard.buckets[j];
+                    for (Entry* entry = link->load(std::memory_order_relaxed); entry != NULL;
+                         entry = link->load(std::memory_order_relaxed)) {
+                        if (!match(entry->key, entry->info)) {
+                            link = &entry->next;
+                            continue;
+                        }
+                        link->store(entry->next.load(std::memory_order_relaxed), std::memory_order_release);
+                        shard.size--;
+                        shard.bytes -= entry->bytes;
+                        if (entry->inWindow) {
+                            shard.windowBytes -= entry->bytes;
+                            std::deque<CacheKey>::iterator queued = shard.window.begin();
+                            while (queued != shard.window.end() && !sameCacheKey(*queued, entry->key)) {
+                                ++queued;
+                            }
+                            if (queued != shard.window.end()) {
+                                shard.window.erase(queued);
+                            }
+                        }
+                        removed.push_back(entry);
+                    }
+                }
+            }
+            for (size_t j = 0; j < removed.size(); j++) {
+                EpochDomain::instance().retire(removed[j], deleteEntry);
+            }
+            erased += removed.size();
+        }
+        if (erased > 0) {
+            invalidations.fetch_add(1, std::memory_order_acq_rel);
+        }
+        return erased;
+    }
+
+    void TokenCache::setLocalCache(size_t entries, double maxStaleness) {
+        // A new id leaves the tables of the old size behind.
+        localId = nextLocalId.fetch_add(1);
+        localEntries = entries > 0 ? roundUpToPowerOfTwo(entries) : 0;
+        localStalenessNanoseconds = static_cast<int64_t>(maxStaleness * 1e9);
+    }
+
+    void TokenCache::setMemoryLimit(size_t bytes) {
+        memoryLimit = bytes;
+        shardByteBudget = bytes / shardCount;
+        shardWindowBudget = shardByteBudget / 100;
+        size_t sketchEntries = std::min(shardCapacity, shardByteBudget / MIN_ENTRY_BYTES + 1);
+        for (size_t i = 0; i < shardCount; i++) {
+            Shard& shard = shards[i];
+            std::vector<Entry*> evicted;
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                // Whatever is cached already counts as old entries.
+                while (popWindow(shard) != NULL) {
+                }
+                if (bytes > 0) {
+                    shard.sketch.reset(new FrequencySketch(sketchEntries));
+                    makeRoom(shard, evicted);
+                } else {
+                    shard.sketch.reset();
+                }
+            }
+            for (size_t j = 0; j < evicted.size(); j++) {
+                EpochDomain::instance().retire(evicted[j], deleteEntry);
+            }
+        }
+    }
+
+    size_t TokenCache::getMemoryBytes() const {
+        size_t total = 0;
+        for (size_t i = 0; i < shardCount; i++) {
+            std::lock_guard<std::mutex> lock(shards[i].mutex);
+            total += shards[i].bytes;
+        }
+        return total;
+    }
+
+    size_t TokenCache::size() const {
+        size_t total = 0;
+        for (size_t i = 0; i < shardCount; i++) {
+            std::lock_guard<std::mutex> lock(shards[i].mutex);
+            total += shards[i].size;
+        }
+        return total;
+    }
+
+    void TokenCache::deleteEntry(void* entry) {
+        delete static_cast<Entry*>(entry);
+    }
+
+    void TokenCache::retireChain(Entry* chain) {
+        while (chain != NULL) {
+            Entry* next = chain->next.load(std::memory_order_relaxed);
+            EpochDomain::instance().retire(chain, deleteEntry);
+            chain = next;
+        }
+    }
+
+    TokenCache::Shard& TokenCache::shardOf(const CacheKey& key) const {
+        // The buckets are picked by the low half of the key, the shards by the high one.
+        return shards[key.high & (shardCount - 1)];
+    }
+
+    std::atomic<TokenCache::Entry*>& TokenCache::bucketOf(Shard& shard, const CacheKey& key) const {
+        return shard.buckets[key.low & (bucketCount - 1)];
+    }
+
+    TokenCache::Entry* TokenCache::evictBucket(Shard& shard) {
+        for (;;) {
+            std::atomic<Entry*>& bucket = shard.buckets[shard.cursor];
+            shard.cursor = (shard.cursor + 1) & (bucketCount - 1);
+            Entry* chain = bucket.exchange(NULL, std::memory_order_acq_rel);
+            if (chain != NULL) {
+                for (Entry* entry = chain; entry != NULL; entry = entry->next.load(std::memory_order_relaxed)) {
+                    shard.size--;
+                    shard.bytes -= entry->bytes;
+                }
+                return chain;
+            }
+        }
+    }
+
+    void TokenCache::makeRoom(Shard& shard, std::vector<Entry*>& evicted) {
+        int64_t now = coarseMonotonicNanoseconds();
+        if (shard.bytes <= shardByteBudget && shard.size <= shardCapacity) {
+            // While there is room, entries leaving the window move on unchallenged.
+            while (shard.windowBytes > shardWindowBudget && shard.window.size() > 1) {
+                popWindow(shard);
+            }
+            return;
+        }
+        while (shard.bytes > shardByteBudget || shard.size > shardCapacity) {
+            // The newest entry always stays in the window, so it gets a chance to be used.
+            Entry* candidate = NULL;
+            if (shard.windowBytes > shardWindowBudget && shard.window.size() > 1) {
+                candidate = popWindow(shard);
+            }
+            Entry* victim = sampleVictim(shard, now, candidate);
+            Entry* loser;
+            if (candidate == NULL) {
+                if (victim == NULL) {
+                    // Only the window is left.
+                    if (shard.window.size() <= 1) {
+                        break;
+                    }
+                    loser = popWindow(shard);
+                } else {
+                    loser = victim;
+                }
+            } else if (victim == NULL) {
+                continue;
+            } else if (victim->expiresAt > now
+                       && shard.sketch->frequency(candidate->key.low) <= shard.sketch->frequency(victim->key.low)) {
+                loser = candidate;
+            } else {
+                loser = victim;
+            }
+            unlink(shard, loser);
+            evicted.push_back(loser);
+        }
+    }
+
+    TokenCache::Entry* TokenCache::popWindow(Shard& shard) {
+        while (!shard.window.empty()) {
+            CacheKey key = shard.window.front();
+            shard.window.pop_front();
+            for (Entry* entry = bucketOf(shard, key).load(std::memory_order_relaxed); entry != NULL;
+                 entry = entry->next.load(std::memory_order_relaxed)) {
+                if (sameCacheKey(entry->key, key) && entry->inWindow) {
+                    entry->inWindow = false;
+                    shard.windowBytes -= entry->bytes;
+                    return entry;
+                }
+            }
+        }
+        return NULL;
+    }
+
+    TokenCache::Entry* TokenCache::sampleVictim(Shard& shard, int64_t now, const Entry* exclude) {
+        size_t mainEntries = shard.size - shard.window.size();
+        if (mainEntries <= (exclude != NULL ? 1u : 0u)) {
+            return NULL;
+        }
+        shard.random = mix64(shard.random + 1);
+        size_t start = static_cast<size_t>(shard.random) & (bucketCount - 1);
+        Entry* best = NULL;
+        unsigned bestFrequency = 0;
+        size_t sampled = 0;
+        for (size_t i = 0; i < bucketCount && sampled < VICTIM_SAMPLE; i++) {
+            for (Entry* entry = shard.buckets[(start + i) & (bucketCount - 1)].load(std::memory_order_relaxed);
+                 entry != NULL; entry = entry->next.load(std::memory_order_relaxed)) {
+                if (entry->inWindow || entry == exclude) {
+                    continue;
+                }
+                if (entry->expiresAt <= now) {
+                    return entry;
+                }
+                unsigned frequency = shard.sketch->frequency(entry->key.low);
+                if (best == NULL || frequency < bestFrequency) {
+                    best = entry;
+                    bestFrequency = frequency;
+                }
+                sampled++;
+            }
+        }
+        return best;
+    }
+
+    void TokenCache::unlink(Shard& shard, Entry* entry) {
+        std::atomic<Entry*>* link = &bucketOf(shard, entry->key);
+        for (Entry* current = link->load(std::memory_order_relaxed); current != NULL;
+             link = &current->next, current = link->load(std::memory_order_relaxed)) {
+            if (current == entry) {
+                link->store(entry->next.load(std::memory_order_relaxed), std::memory_order_release);
+                shard.size--;
+                shard.bytes -= entry->bytes;
+                return;
+            }
+        }
+    }
+}}
@@ -0,0 +1,139 @@
+#include "keystone/impl/TokenFormat.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define KEYSTONE_TOKEN_FORMAT_SSE2 1
+#endif
+
+namespace keystone { namespace impl {
+
+    TokenFormat::TokenFormat()
+        : charset(CHARSET_ANY), minLength(1), maxLength(DEFAULT_MAX_LENGTH) {
+        setup();
+    }
+
+    TokenFormat::TokenFormat(Charset charset, size_t minLength, size_t maxLength)
+        : charset(charset), minLength(minLength < 1 ? 1 : minLength), maxLength(maxLength) {
+        setup();
+    }
+
+    void TokenFormat::setup() {
+        ranges.rangeCount = 0;
+        ranges.excludedCount = 0;
+
+        struct Range { uint8_t low, high; };
+        static const Range any[] = { {0x21, 0x7e} };
+        static const uint8_t anyExcluded[] = { '<', '>', '&', '\'', '"' };
+        static const Range hex[] = { {'0', '9'}, {'a', 'f'}, {'A', 'F'} };
+        static const Range uuid[] = { {'0', '9'}, {'a', 'f'}, {'A', 'F'}, {'-', '-'} };
+        static const Range base64url[] = { {'A', 'Z'}, {'a', 'z'}, {'0', '9'}, {'-', '-'}, {'_', '_'}, {'=', '='} };
+
+        const Range* selected = any;
+        size_t count = sizeof(any) / sizeof(any[0]);
+        switch (charset) {
+        case CHARSET_HEX:
+            selected = hex;
+            count = sizeof(hex) / sizeof(hex[0]);
+            break;
+        case CHARSET_UUID:
+            selected = uuid;
+            count = sizeof(uuid) / sizeof(uuid[0]);
+            break;
+        case CHARSET_BASE64URL:
+            selected = base64url;
+            count = sizeof(base64url) / sizeof(base64url[0]);
+            break;
+        default:
+            charset = CHARSET_ANY;
+            for (size_t i = 0; i < sizeof(anyExcluded); ++i) {
+                ranges.excluded[ranges.excludedCount++] = anyExcluded[i];
+            }
+        }
+        for (size_t i = 0; i < count; ++i) {
+            ranges.low[ranges.rangeCount] = selected[i].low;
+            ranges.high[ranges.rangeCount] = selected[i].high;
+            ++ranges.rangeCount;
+        }
+
+        for (size_t c = 0; c < 256; ++c) {
+            table[c] = false;
+        }
+        for (size_t r = 0; r < ranges.rangeCount; ++r) {
+            for (size_t c = ranges.low[r]; c <= ranges.high[r]; ++c) {
+                table[c] = true;
+            }
+        }
+        for (size_t e = 0; e < ranges.excludedCount; ++e) {
+            table[ranges.excluded[e]] = false;
+        }
+    }
+
+    bool TokenFormat::allInCharset(const uint8_t* data, size_t length) const {
+        size_t i = 0;
+#ifdef KEYSTONE_TOKEN_FORMAT_SSE2
+        __m128i low[MAX_RANGES];
+        __m128i width[MAX_RANGES];
+        __m128i excluded[MAX_EXCLUDED];
+        for (size_t r = 0; r < ranges.rangeCount; ++r) {
+            low[r] = _mm_set1_epi8(char(ranges.low[r]));
+            width[r] = _mm_set1_epi8(char(ranges.high[r] - ranges.low[r]));
+        }
+        for (size_t e = 0; e < ranges.excludedCount; ++e) {
+            excluded[e] = _mm_set1_epi8(char(ranges.excluded[e]));
+        }
+
+        for (; i + 16 <= length; i += 16) {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            __m128i accepted = _mm_setzero_si128();
+            for (size_t r = 0; r < ranges.rangeCount; ++r) {
+                // Unsigned low <= x <= high as (x - low) <= (high - low).
+                __m128i offset = _mm_sub_epi8(bytes, low[r]);
+                accepted = _mm_or_si128(accepted, _mm_cmpeq_epi8(_mm_min_epu8(offset, width[r]), offset));
+            }
+            for (size_t e = 0; e < ranges.excludedCount; ++e) {
+                accepted = _mm_andnot_si128(_mm_cmpeq_epi8(bytes, excluded[e]), accepted);
+            }
+            if (_mm_movemask_epi8(accepted) != 0xFFFF) {
+                return false;
+            }
+        }
+#endif
+        for (; i < length; ++i) {
+            if (!table[data[i]]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool TokenFormat::isValid(const char* token, size_t length) const {
+        if (token == NULL || length < minLength || length > maxLength) {
+            return false;
+        }
+        if (!allInCharset(reinterpret_cast<const uint8_t*>(token), length)) {
+            return false;
+        }
+        if (charset == CHARSET_UUID) {
+            // The charset allowed '-' anywhere, check the positions.
+            if (length == 36) {
+                for (size_t i = 0; i < length; ++i) {
+                    bool dashPosition = (i == 8 || i == 13 || i == 18 || i == 23);
+                    if ((token[i] == '-') != dashPosition) {
+                        return false;
+                    }
+                }
+            }
+            else if (length == 32) {
+                for (size_t i = 0; i < length; ++i) {
+                    if (token[i] == '-') {
+                        return false;
+                    }
+                }
+            }
+            else {
+                return false;
+            }
+        }
+        return true;
+    }
+}}
@@ -1,17 +1,119 @@
 #include "keystone/keystone.h"
 #include "keystone/impl/Keystone.hpp"
+#include "keystone/impl/AtomicFile.hpp"
+#include "keystone/impl/Metrics.hpp"
+#include "keystone/impl/Error.hpp"
+#include "keystone/impl/Policy.hpp"
+#include "keystone/impl/RoleTable.hpp"
 #include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
 
 #define KEYSTONE_METHOD_START try {
 
-#define KEYSTONE_METHOD_END return KEYSTONE_SUCCESS; } catch(...) { return KEYSTONE_UNKNOWN_ERROR; }
+#define KEYSTONE_METHOD_END return KEYSTONE_SUCCESS; } \
+    catch(const keystone::impl::Error& e) { return setLastErrorCopy(keystone_error_t(e.getCode()), e.what(), e.getHttpStatus(), e.getTransportCode()); } \
+    catch(const std::exception& e) { return setLastErrorCopy(KEYSTONE_UNKNOWN_ERROR, e.what()); } \
+    catch(...) { return setLastError(KEYSTONE_UNKNOWN_ERROR, "unknown error"); }
 struct keystone_data_struct {
     keystone::impl::Keystone* impl;
 };
 
 struct keystone_userinfo_struct {
-    keystone::impl::KeystoneUserInfo* impl;
+    keystone::impl::KeystoneUserInfo impl;
+    keystone::impl::RequestTimings timings;
+    // The token a userinfo was looked up with: the impl userinfos of lookups have none, so that
+    // cache hits hand out the cached userinfo as is. Empty for logins, whose userinfo has it.
+    std::string token;
 };
+
+struct keystone_policy_struct {
+    keystone::impl::Policy* impl;
+};
+
+struct keystone_stats_struct {
+    keystone::impl::MetricsSnapshot impl;
+    std::string prometheus;
+};
+
+struct keystone_revocation_list_struct {
+    keystone::impl::RevocationList* impl;
+};
+namespace {
+    struct LastError {
+        LastError() : code(KEYSTONE_SUCCESS), http_status(0), transport_code(0), message("") {}
+
+        keystone_error_t code;
+        long http_status;
+        int transport_code;
+        const char* message;
+        // Holds the message when it is not a static string (ie. from an exception).
+        std::string storage;
+    };
+
+    thread_local LastError lastError;
+
+    // message must be a static string, so failing is free of allocations.
+    keystone_error_t setLastError(keystone_error_t code, const char* message,
+                                  long http_status = 0, int transport_code = 0) {
+        lastError.code = code;
+        lastError.http_status = http_status;
+        lastError.transport_code = transport_code;
+        lastError.message = message;
+        return code;
+    }
+
+    keystone_error_t setLastErrorCopy(keystone_error_t code, const char* message,
+                                      long http_status = 0, int transport_code = 0) {
+        lastError.storage = message;
+        return setLastError(code, lastError.storage.c_str(), http_status, transport_code);
+    }
+
+    keystone::impl::StringRef tokenOf(const keystone_userinfo_t* info) {
+        if (info->token.empty()) {
+            return info->impl.getToken();
+        }
+        keystone::impl::StringRef token = { info->token.c_str(), info->token.size() };
+        return token;
+    }
+
+    keystone_error_t setLastError(const keystone::impl::Status& status) {
+        return setLastError(keystone_error_t(status.code), status.message, status.httpStatus, status.transportCode);
+    }
+
+    // The impl-side hooks point here, with a copy of the C hooks (owned by the impl hooks) as user data.
+    void callHook(keystone_hook_t hook, void* user_data, const keystone::impl::HookEvent& event) {
+        keystone_event_t c_event;
+        c_event.operation = keystone_operation_t(event.operation);
+        c_event.duration = event.duration;
+        c_event.outcome = keystone_error_t(event.outcome);
+        hook(user_data, &c_event);
+    }
+
+    void onRequestStart(void* hooks, const keystone::impl::HookEvent& event) {
+        const keystone_hooks_t* c_hooks = static_cast<const keystone_hooks_t*>(hooks);
+        callHook(c_hooks->on_request_start, c_hooks->user_data, event);
+    }
+
+    void onRequestEnd(void* hooks, const keystone::impl::HookEvent& event) {
+        const keystone_hooks_t* c_hooks = static_cast<const keystone_hooks_t*>(hooks);
+        callHook(c_hooks->on_request_end, c_hooks->user_data, event);
+    }
+
+    void onCacheHit(void* hooks, const keystone::impl::HookEvent& event) {
+        const keystone_hooks_t* c_hooks = static_cast<const keystone_hooks_t*>(hooks);
+        callHook(c_hooks->on_cache_hit, c_hooks->user_data, event);
+    }
+
+    void onCacheMiss(void* hooks, const keystone::impl::HookEvent& event) {
+        const keystone_hooks_t* c_hooks = static_cast<const keystone_hooks_t*>(hooks);
+        callHook(c_hooks->on_cache_miss, c_hooks->user_data, event);
+    }
+}
+
 extern "C" {
 
 
@@ -33,71 +135,90 @@ keystone_error_t keystone_free(keystone_data_t* data) {
 
 keystone_error_t keystone_login(keystone_data_t* data, const char* username, const char* password, const char* tenant_name, keystone_userinfo_t** userinfo) {
     KEYSTONE_METHOD_START
-	try {
-	    // Give sane default values: 
-	    *userinfo = NULL;
-	    *userinfo = new keystone_userinfo_t();
-	    (*userinfo)->impl = NULL;
-
-	    (*userinfo)->impl = new keystone::impl::KeystoneUserInfo();
+	// Give sane default values: 
+	*userinfo = NULL;
+	keystone_userinfo_t* result = new keystone_userinfo_t();
 
-	    data->impl->login(username, password, tenant_name, *((*userinfo)->impl));
+	keystone::impl::Status status;
+	try {
+	    status = data->impl->login(username, password, tenant_name, result->impl, &result->timings);
 	} catch(...) {
+	    delete result;
+	    throw;
+	}
+	if (!status.isOk()) {
 	    // Free up data: 
-	    if (*userinfo != NULL) {
-		if ((*userinfo)->impl != NULL) {
-		    delete (*userinfo)->impl;
-		    (*userinfo)->impl = NULL;
-		}
-		delete *userinfo;
-		*userinfo = NULL;
-	    }
-	    return KEYSTONE_UNKNOWN_ERROR;
+	    delete result;
+	    return setLastError(status);
 	}
+	*userinfo = result;
+    KEYSTONE_METHOD_END
+}
 
+keystone_error_t keystone_session_login(keystone_data_t* data, const char* username, const char* password, const char* tenant_name, keystone_userinfo_t** userinfo) {
+    KEYSTONE_METHOD_START
+        *userinfo = NULL;
+        keystone_userinfo_t* result = new keystone_userinfo_t();
+
+        keystone::impl::Status status;
+        try {
+            status = data->impl->sessionLogin(username, password, tenant_name, result->impl, &result->timings);
+        } catch(...) {
+            delete result;
+            throw;
+        }
+        if (!status.isOk()) {
+            delete result;
+            return setLastError(status);
+        }
+        *userinfo = result;
     KEYSTONE_METHOD_END
 }
 
 keystone_error_t keystone_userinfo_free(keystone_userinfo_t* info) {
     KEYSTONE_METHOD_START
-	bool some_argument_null = !((info != NULL) && (info->impl != NULL));
-	if ( info != NULL) {
-	    if ( info->impl != NULL) {
-		delete info->impl;
-		info->impl = NULL;
-	    }
-	    delete info;
-	    info = NULL;
-	}
-	if (some_argument_null) {
-	    return KEYSTONE_UNKNOWN_ERROR;
+	if ( info == NULL) {
+	    return setLastError(KEYSTONE_INVALID_ARGUMENT, "userinfo handle is NULL");
 	}
+	delete info;
     KEYSTONE_METHOD_END
 }
 
-keystone_error_t keystone_get_userinfo_from_token(keystone_data_t* data, const char* tenant_name, const char* session_token, keystone_userinfo_t** userinfo) {
+keystone_error_t keystone_userinfo_copy(const keystone_userinfo_t* info, keystone_userinfo_t** copy) {
     KEYSTONE_METHOD_START
-       try {
-	    // Give sane default values: 
-	    *userinfo = NULL;
-	    *userinfo = new keystone_userinfo_t();
-	    (*userinfo)->impl = NULL;
+        *copy = NULL;
+        if (info == NULL) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "userinfo handle is NULL");
+        }
+        *copy = new keystone_userinfo_t();
+        (*copy)->impl = info->impl;
+        (*copy)->timings = info->timings;
+        (*copy)->token = info->token;
+    KEYSTONE_METHOD_END
+}
 
-	    (*userinfo)->impl = new keystone::impl::KeystoneUserInfo();
+keystone_error_t keystone_get_userinfo_from_token(keystone_data_t* data, const char* tenant_name, const char* session_token, keystone_userinfo_t** userinfo) {
+    KEYSTONE_METHOD_START
+	// Give sane default values: 
+	*userinfo = NULL;
+	keystone_userinfo_t* result = new keystone_userinfo_t();
 
-	    data->impl->getUserInfo(tenant_name, session_token, *((*userinfo)->impl));
+	keystone::impl::Status status;
+	try {
+	    status = data->impl->getUserInfo(tenant_name, session_token, result->impl, &result->timings);
+	    if (status.isOk()) {
+	        result->token = session_token;
+	    }
 	} catch(...) {
+	    delete result;
+	    throw;
+	}
+	if (!status.isOk()) {
 	    // Free up data: 
-	    if (*userinfo != NULL) {
-		if ((*userinfo)->impl != NULL) {
-		    delete (*userinfo)->impl;
-		    (*userinfo)->impl = NULL;
-		}
-		delete *userinfo;
-		*userinfo = NULL;
-	    }
-	    return KEYSTONE_UNKNOWN_ERROR;
+	    delete result;
+	    return setLastError(status);
 	}
+	*userinfo = result;
     KEYSTONE_METHOD_END
 }
 
@@ -107,6 +228,228 @@ keystone_error_t keystone_set_ca_certificate_filename(keystone_data_t* data, con
     KEYSTONE_METHOD_END
 }
 
+keystone_error_t keystone_set_http2(keystone_data_t* data, keystone_http2_t mode, unsigned max_streams) {
+    KEYSTONE_METHOD_START
+        if (unsigned(mode) >= keystone::impl::HTTP2_MODE_COUNT) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "invalid HTTP/2 mode");
+        }
+        keystone::impl::Status status = data->impl->setHttp2(keystone::impl::Http2Mode(mode), max_streams);
+        if (!status.isOk()) {
+            return setLastError(status);
+        }
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_set_hooks(keystone_data_t* data, const keystone_hooks_t* hooks) {
+    KEYSTONE_METHOD_START
+        keystone::impl::Hooks impl_hooks;
+        if (hooks != NULL) {
+            // A copy of its own, replaced together with the impl hooks, so that threads of the
+            // handle (eg. the session refresher) never see it half written.
+            std::shared_ptr<keystone_hooks_t> c_hooks = std::make_shared<keystone_hooks_t>(*hooks);
+            // Only forward the hooks that are set, so the others stay free on the request path.
+            impl_hooks.userData = c_hooks.get();
+            impl_hooks.userDataOwner = c_hooks;
+            impl_hooks.requestStart = hooks->on_request_start != NULL ? onRequestStart : NULL;
+            impl_hooks.requestEnd = hooks->on_request_end != NULL ? onRequestEnd : NULL;
+            impl_hooks.cacheHit = hooks->on_cache_hit != NULL ? onCacheHit : NULL;
+            impl_hooks.cacheMiss = hooks->on_cache_miss != NULL ? onCacheMiss : NULL;
+        }
+        data->impl->setHooks(impl_hooks);
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_set_token_format(keystone_data_t* data, keystone_token_charset_t charset, size_t min_length, size_t max_length) {
+    KEYSTONE_METHOD_START
+        if (unsigned(charset) >= keystone::impl::TokenFormat::CHARSET_COUNT || max_length < min_length) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "invalid token format");
+        }
+        data->impl->setTokenFormat(keystone::impl::TokenFormat(keystone::impl::TokenFormat::Charset(charset), min_length, max_length));
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_set_negative_cache(keystone_data_t* data, size_t expected_entries, double ttl) {
+    KEYSTONE_METHOD_START
+        if (expected_entries > 0 && !(ttl > 0)) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "invalid negative cache ttl");
+        }
+        data->impl->setNegativeCache(expected_entries, ttl);
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_set_token_cache(keystone_data_t* data, size_t max_entries, double ttl) {
+    KEYSTONE_METHOD_START
+        if (max_entries > 0 && !(ttl > 0)) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "invalid token cache ttl");
+        }
+        data->impl->setTokenCache(max_entries, ttl);
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_set_token_cache_l1(keystone_data_t* data, size_t entries, double max_staleness) {
+    KEYSTONE_METHOD_START
+        if (entries > 0 && !(max_staleness > 0)) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "invalid L1 staleness");
+        }
+        data->impl->setTokenCacheL1(entries, max_staleness);
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_set_token_cache_memory_limit(keystone_data_t* data, size_t max_bytes) {
+    KEYSTONE_METHOD_START
+        data->impl->setTokenCacheMemoryLimit(max_bytes);
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_set_shared_cache(keystone_data_t* data, const char* name, size_t max_entries, size_t entry_size, double ttl) {
+    KEYSTONE_METHOD_START
+        if (name != NULL && !(ttl > 0)) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "invalid shared cache ttl");
+        }
+        keystone::impl::Status status = data->impl->setSharedCache(name != NULL ? name : "", max_entries, entry_size, ttl);
+        if (!status.isOk()) {
+            return setLastError(status);
+        }
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_set_role_cache(keystone_data_t* data, size_t max_entries, double ttl) {
+    KEYSTONE_METHOD_START
+        if (max_entries > 0 && !(ttl > 0)) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "invalid role cache ttl");
+        }
+        data->impl->setRoleCache(max_entries, ttl);
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_set_session_cache(keystone_data_t* data, size_t max_sessions, double lifetime, double refresh_after) {
+    KEYSTONE_METHOD_START
+        if (max_sessions > 0 && !(lifetime > 0)) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "invalid session lifetime");
+        }
+        if (max_sessions > 0 && !(refresh_after >= 0 && refresh_after < lifetime)) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "invalid session refresh time");
+        }
+        data->impl->setSessionCache(max_sessions, lifetime, refresh_after > 0 ? refresh_after : lifetime * 0.75);
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_cache_save(keystone_data_t* data, const char* file_name) {
+    KEYSTONE_METHOD_START
+        if (file_name == NULL) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "file_name is NULL");
+        }
+        keystone::impl::Status status = data->impl->saveCache(file_name);
+        if (!status.isOk()) {
+            return setLastError(status);
+        }
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_cache_load(keystone_data_t* data, const char* file_name) {
+    KEYSTONE_METHOD_START
+        if (file_name == NULL) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "file_name is NULL");
+        }
+        keystone::impl::Status status = data->impl->loadCache(file_name);
+        if (!status.isOk()) {
+            return setLastError(status);
+        }
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_cache_prewarm(keystone_data_t* data, const char* tenant_name, const char* const* session_tokens,
+                                        size_t count, unsigned concurrency, double max_rate, size_t* cached) {
+    KEYSTONE_METHOD_START
+        if (tenant_name == NULL) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "tenant_name is NULL");
+        }
+        if (session_tokens == NULL && count > 0) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "session_tokens is NULL");
+        }
+        if (!(max_rate >= 0)) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "invalid max_rate");
+        }
+        std::vector<std::string> tokens;
+        tokens.reserve(count);
+        for (size_t i = 0; i < count; i++) {
+            if (session_tokens[i] == NULL) {
+                return setLastError(KEYSTONE_INVALID_ARGUMENT, "session_tokens contains NULL");
+            }
+            tokens.push_back(session_tokens[i]);
+        }
+        size_t found = 0;
+        keystone::impl::Status status = data->impl->prewarmCache(tenant_name, tokens, concurrency, max_rate, found);
+        if (cached != NULL) {
+            *cached = found;
+        }
+        if (!status.isOk()) {
+            return setLastError(status);
+        }
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_set_revocation_file(keystone_data_t* data, const char* file_name, double interval) {
+    KEYSTONE_METHOD_START
+        if (file_name == NULL) {
+            data->impl->setRevocationSource(keystone::impl::RevocationPoller::Source(), 0);
+            return KEYSTONE_SUCCESS;
+        }
+        if (!(interval > 0)) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "invalid interval");
+        }
+        const std::string path(file_name);
+        data->impl->setRevocationSource([path](keystone::impl::RevocationList& list) {
+            return keystone::impl::readRevocationFile(path, list);
+        }, interval);
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_set_revocation_callback(keystone_data_t* data, keystone_revocation_source_t source, void* user_data, double interval) {
+    KEYSTONE_METHOD_START
+        if (source == NULL) {
+            data->impl->setRevocationSource(keystone::impl::RevocationPoller::Source(), 0);
+            return KEYSTONE_SUCCESS;
+        }
+        if (!(interval > 0)) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "invalid interval");
+        }
+        data->impl->setRevocationSource([source, user_data](keystone::impl::RevocationList& list) {
+            keystone_revocation_list_t c_list;
+            c_list.impl = &list;
+            keystone_error_t error = source(user_data, &c_list);
+            if (error != KEYSTONE_SUCCESS) {
+                return keystone::impl::Status(keystone::impl::ErrorCode(error), "The revocation source failed");
+            }
+            return keystone::impl::Status();
+        }, interval);
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_revocation_list_add_token(keystone_revocation_list_t* list, const char* session_token) {
+    KEYSTONE_METHOD_START
+        if (list == NULL) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "revocation list is NULL");
+        }
+        if (session_token == NULL) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "session_token is NULL");
+        }
+        list->impl->tokens.insert(session_token);
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_revocation_list_add_user(keystone_revocation_list_t* list, const char* username) {
+    KEYSTONE_METHOD_START
+        if (list == NULL) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "revocation list is NULL");
+        }
+        if (username == NULL) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "username is NULL");
+        }
+        list->impl->usernames.insert(username);
+    KEYSTONE_METHOD_END
+}
+
 keystone_error_t keystone_userinfo_get_username(const keystone_userinfo_t* info, char* buffer, size_t buffer_length, size_t* data_written) {
     KEYSTONE_METHOD_START
         size_t size_to_write;
@@ -116,17 +459,15 @@ keystone_error_t keystone_userinfo_get_username(const keystone_userinfo_t* info,
         }
 
         if (buffer_length < size_to_write) {
-            return KEYSTONE_UNKNOWN_ERROR;
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "buffer too small");
         }
 
         if( size_to_write == 0 ) {
-            return KEYSTONE_UNKNOWN_ERROR;
+            return setLastError(KEYSTONE_UNKNOWN_ERROR, "no data to write");
         }
 
-        info->impl->getUsername().copy(buffer, size_to_write - 1);
-
-        // We need to null terminate (copy does not include it)
-        buffer[size_to_write - 1] = '\0';
+        // The stored username is already null terminated, so copy that as well
+        memcpy(buffer, info->impl.getUsername().data, size_to_write);
 
         *data_written = size_to_write;
     KEYSTONE_METHOD_END
@@ -134,29 +475,29 @@ keystone_error_t keystone_userinfo_get_username(const keystone_userinfo_t* info,
 
 keystone_error_t keystone_userinfo_get_username_buffer_size(const keystone_userinfo_t* info, size_t* size) {
     KEYSTONE_METHOD_START
-        *size = info->impl->getUsername().size() + 1;
+        *size = info->impl.getUsername().size + 1;
     KEYSTONE_METHOD_END
 }
 
 keystone_error_t keystone_userinfo_get_role_count(const keystone_userinfo_t* info, size_t* role_count) {
     KEYSTONE_METHOD_START
-        *role_count = info->impl->getRoles().size();
+        *role_count = info->impl.getRoleCount();
     KEYSTONE_METHOD_END
 }
 
 keystone_error_t keystone_userinfo_get_role_buffer_size(const keystone_userinfo_t* info, size_t index, size_t* buffer_size) {
     KEYSTONE_METHOD_START
-        if (index >= info->impl->getRoles().size()) {
-            return KEYSTONE_UNKNOWN_ERROR;
+        if (index >= info->impl.getRoleCount()) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "role index out of range");
         }
-        *buffer_size = info->impl->getRoles()[index].size() + 1;
+        *buffer_size = info->impl.getRole(index).size + 1;
     KEYSTONE_METHOD_END
 }
 
 keystone_error_t keystone_userinfo_get_role(const keystone_userinfo_t* info, size_t index, char* buffer, size_t buffer_len, size_t* data_written) {
     KEYSTONE_METHOD_START
-        if (index >= info->impl->getRoles().size()) {
-            return KEYSTONE_UNKNOWN_ERROR;
+        if (index >= info->impl.getRoleCount()) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "role index out of range");
         }
         size_t size_to_write;
 
@@ -167,11 +508,12 @@ keystone_error_t keystone_userinfo_get_role(const keystone_userinfo_t* info, siz
         }
 
         if ( buffer_len < size_to_write ) {
-            return KEYSTONE_UNKNOWN_ERROR;
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "buffer too small");
         }
 
-        info->impl->getRoles()[index].copy(buffer, size_to_write - 1);
-        buffer[size_to_write - 1] = '\0';
+        memcpy(buffer, info->impl.getRole(index).data, size_to_write);
+
+        *data_written = size_to_write;
 
     KEYSTONE_METHOD_END
 }
@@ -186,17 +528,15 @@ keystone_error_t keystone_userinfo_get_token(const keystone_userinfo_t* info, ch
         }
 
         if (buffer_length < size_to_write) {
-            return KEYSTONE_UNKNOWN_ERROR;
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "buffer too small");
         }
 
         if( size_to_write == 0 ) {
-            return KEYSTONE_UNKNOWN_ERROR;
+            return setLastError(KEYSTONE_UNKNOWN_ERROR, "no data to write");
         }
 
-        info->impl->getToken().copy(buffer, size_to_write - 1);
-
-        // We need to null terminate (copy does not include it)
-        buffer[size_to_write - 1] = '\0';
+        // The stored token is already null terminated, so copy that as well
+        memcpy(buffer, tokenOf(info).data, size_to_write);
 
         *data_written = size_to_write;
     KEYSTONE_METHOD_END
@@ -204,7 +544,195 @@ keystone_error_t keystone_userinfo_get_token(const keystone_userinfo_t* info, ch
 
 keystone_error_t keystone_userinfo_get_token_buffer_size(const keystone_userinfo_t* info, size_t* size) {
     KEYSTONE_METHOD_START
-        *size = info->impl->getToken().size() + 1;
+        *size = tokenOf(info).size + 1;
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_role_intern(const char* role_name, keystone_role_id_t* role_id) {
+    KEYSTONE_METHOD_START
+        keystone::impl::RoleId id;
+        if (!keystone::impl::RoleTable::instance().intern(role_name, strlen(role_name), id)) {
+            return setLastError(KEYSTONE_UNKNOWN_ERROR, "the role table is full");
+        }
+        *role_id = id;
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_userinfo_has_role(const keystone_userinfo_t* info, keystone_role_id_t role_id, int* has_role) {
+    KEYSTONE_METHOD_START
+        *has_role = info->impl.hasRole(role_id) ? 1 : 0;
     KEYSTONE_METHOD_END
 }
+
+keystone_error_t keystone_userinfo_has_any_role(const keystone_userinfo_t* info, const keystone_role_id_t* role_ids, size_t role_id_count, int* has_role) {
+    KEYSTONE_METHOD_START
+        *has_role = 0;
+        for (size_t i = 0; i < role_id_count; ++i) {
+            if (info->impl.hasRole(role_ids[i])) {
+                *has_role = 1;
+                break;
+            }
+        }
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_userinfo_has_all_roles(const keystone_userinfo_t* info, const keystone_role_id_t* role_ids, size_t role_id_count, int* has_roles) {
+    KEYSTONE_METHOD_START
+        *has_roles = 1;
+        for (size_t i = 0; i < role_id_count; ++i) {
+            if (!info->impl.hasRole(role_ids[i])) {
+                *has_roles = 0;
+                break;
+            }
+        }
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_policy_compile(const char* expression, keystone_policy_t** policy) {
+    KEYSTONE_METHOD_START
+        *policy = NULL;
+        keystone::impl::Policy* impl = new keystone::impl::Policy(expression);
+        try {
+            *policy = new keystone_policy_t();
+        } catch(...) {
+            delete impl;
+            throw;
+        }
+        (*policy)->impl = impl;
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_policy_free(keystone_policy_t* policy) {
+    KEYSTONE_METHOD_START
+        if (policy == NULL) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "policy handle is NULL");
+        }
+        delete policy->impl;
+        delete policy;
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_policy_eval(const keystone_policy_t* policy, const keystone_userinfo_t* info, int* allowed) {
+    KEYSTONE_METHOD_START
+        *allowed = policy->impl->evaluate(info->impl) ? 1 : 0;
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_userinfo_get_timing_count(const keystone_userinfo_t* info, size_t* timing_count) {
+    KEYSTONE_METHOD_START
+        *timing_count = info->timings.count;
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_userinfo_get_timings(const keystone_userinfo_t* info, keystone_timing_t* timings, size_t timings_length, size_t* timings_written) {
+    KEYSTONE_METHOD_START
+        if (timings_length < info->timings.count) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "timings array too small");
+        }
+        for (size_t i = 0; i < info->timings.count; ++i) {
+            const keystone::impl::RequestTiming& timing = info->timings.timings[i];
+            timings[i].operation = keystone_operation_t(timing.operation);
+            timings[i].name_lookup = timing.nameLookup;
+            timings[i].connect = timing.connect;
+            timings[i].app_connect = timing.appConnect;
+            timings[i].start_transfer = timing.startTransfer;
+            timings[i].total = timing.total;
+            timings[i].envelope_build = timing.envelopeBuild;
+            timings[i].parse = timing.parse;
+        }
+        *timings_written = info->timings.count;
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_get_stats(keystone_stats_t** stats) {
+    KEYSTONE_METHOD_START
+        keystone_stats_t* snapshot = new keystone_stats_t();
+        try {
+            keystone::impl::Metrics::instance().snapshot(snapshot->impl);
+            snapshot->impl.renderPrometheus(snapshot->prometheus);
+        } catch(...) {
+            delete snapshot;
+            throw;
+        }
+        *stats = snapshot;
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_stats_free(keystone_stats_t* stats) {
+    KEYSTONE_METHOD_START
+        delete stats;
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_stats_get_counter(const keystone_stats_t* stats, keystone_operation_t operation, keystone_counter_t counter, unsigned long long* value) {
+    KEYSTONE_METHOD_START
+        if (unsigned(operation) >= keystone::impl::OPERATION_COUNT) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "unknown operation");
+        }
+        keystone::impl::OperationMetrics::Snapshot total = stats->impl.total(keystone::impl::Operation(operation));
+        switch (counter) {
+        case KEYSTONE_COUNTER_REQUESTS:           *value = total.requests; break;
+        case KEYSTONE_COUNTER_ERRORS:             *value = total.totalErrors(); break;
+        case KEYSTONE_COUNTER_BYTES_SENT:         *value = total.bytesSent; break;
+        case KEYSTONE_COUNTER_BYTES_RECEIVED:     *value = total.bytesReceived; break;
+        case KEYSTONE_COUNTER_CONNECTIONS_OPENED: *value = total.connectionsOpened; break;
+        case KEYSTONE_COUNTER_CONNECTIONS_REUSED: *value = total.connectionsReused; break;
+        case KEYSTONE_COUNTER_TLS_HANDSHAKES:     *value = total.tlsHandshakes; break;
+        case KEYSTONE_COUNTER_CACHE_HITS:         *value = total.cacheHits; break;
+        case KEYSTONE_COUNTER_CACHE_MISSES:       *value = total.cacheMisses; break;
+        case KEYSTONE_COUNTER_IN_FLIGHT:          *value = total.inFlight > 0 ? total.inFlight : 0; break;
+        case KEYSTONE_COUNTER_REJECTED_LOCALLY:   *value = total.rejectedLocally; break;
+        default:
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "unknown counter");
+        }
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_stats_get_latency_quantile(const keystone_stats_t* stats, keystone_operation_t operation, double quantile, double* seconds) {
+    KEYSTONE_METHOD_START
+        if (unsigned(operation) >= keystone::impl::OPERATION_COUNT || quantile < 0 || quantile > 1) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "unknown operation or quantile out of range");
+        }
+        *seconds = stats->impl.total(keystone::impl::Operation(operation)).latency.quantile(quantile);
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_stats_get_prometheus_buffer_size(const keystone_stats_t* stats, size_t* size) {
+    KEYSTONE_METHOD_START
+        *size = stats->prometheus.size() + 1;
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_stats_get_prometheus(const keystone_stats_t* stats, char* buffer, size_t buffer_length, size_t* data_written) {
+    KEYSTONE_METHOD_START
+        size_t size_to_write = stats->prometheus.size() + 1;
+        if (buffer_length < size_to_write) {
+            return setLastError(KEYSTONE_INVALID_ARGUMENT, "buffer too small");
+        }
+        memcpy(buffer, stats->prometheus.c_str(), size_to_write);
+        *data_written = size_to_write;
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_stats_write_prometheus(const keystone_stats_t* stats, const char* file_name) {
+    KEYSTONE_METHOD_START
+        // Readable by the collector, which usually runs as another user.
+        keystone::impl::Status status = keystone::impl::replaceFile(file_name, stats->prometheus.data(),
+                                                                    stats->prometheus.size(), 0644);
+        if (!status.isOk()) {
+            return setLastError(KEYSTONE_UNKNOWN_ERROR, status.message);
+        }
+    KEYSTONE_METHOD_END
+}
+
+keystone_error_t keystone_last_error_detail(keystone_error_detail_t* detail) {
+    if (detail == NULL) {
+        return KEYSTONE_INVALID_ARGUMENT;
+    }
+    detail->code = lastError.code;
+    detail->http_status = lastError.http_status;
+    detail->transport_code = lastError.transport_code;
+    detail->message = lastError.message;
+    return KEYSTONE_SUCCESS;
+}
 }
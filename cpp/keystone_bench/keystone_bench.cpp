@@ -0,0 +1,255 @@
+#include "keystone/impl/TokenCache.hpp"
+#include "keystone/impl/CurlTransport.hpp"
+#include "keystone/impl/Hash.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using keystone::impl::KeystoneUserInfo;
+using keystone::impl::TokenCache;
+using keystone::impl::CacheKey;
+using keystone::impl::SipKey;
+using keystone::impl::CurlTransport;
+using keystone::impl::Http2Mode;
+using keystone::impl::Status;
+using keystone::impl::TransferInfo;
+using keystone::impl::HTTP2_NEGOTIATE;
+using keystone::impl::HTTP2_PRIOR_KNOWLEDGE;
+
+namespace {
+
+    /**
+     * What a cache bolted on behind one mutex would look like, for comparison.
+     */
+    class LockedCache {
+    public:
+        bool find(const CacheKey& key, KeystoneUserInfo& info) {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::unordered_map<CacheKey, KeystoneUserInfo, KeyHash, KeyEqual>::const_iterator it = entries.find(key);
+            if (it == entries.end()) {
+                return false;
+            }
+            info = it->second;
+            return true;
+        }
+
+        void insert(const CacheKey& key, const KeystoneUserInfo& info) {
+            std::lock_guard<std::mutex> lock(mutex);
+            entries[key] = info;
+        }
+
+    private:
+        struct KeyHash {
+            size_t operator()(const CacheKey& key) const { return static_cast<size_t>(key.low); }
+        };
+        struct KeyEqual {
+            bool operator()(const CacheKey& a, const CacheKey& b) const { return keystone::impl::sameCacheKey(a, b); }
+        };
+
+        std::mutex mutex;
+        std::unordered_map<CacheKey, KeystoneUserInfo, KeyHash, KeyEqual> entries;
+    };
+
+    struct Token {
+        std::string token;
+        CacheKey key;
+    };
+
+    std::vector<Token> makeTokens(size_t count) {
+        std::vector<Token> tokens(count);
+        SipKey sipKey = keystone::impl::randomSipKey();
+        const std::string tenant = "bench";
+        for (size_t i = 0; i < count; i++) {
+            std::ostringstream token;
+            token << "gAAAAABbench" << i << "-0123456789abcdef0123456789abcdef";
+            tokens[i].token = token.str();
+            tokens[i].key = keystone::impl::makeCacheKey(sipKey, tenant.data(), tenant.size(),
+                                                         tokens[i].token.data(), tokens[i].token.size());
+        }
+        return tokens;
+    }
+
+    /**
+     * Runs \c threads threads looking up random tokens for \c seconds.
+     * \return the lookups per second
+     */
+    template<class Cache>
+    double run(Cache& cache, const std::vector<Token>& tokens, unsigned threads, double seconds) {
+        std::atomic<bool> stop(false);
+        std::atomic<uint64_t> total(0);
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; t++) {
+            workers.push_back(std::thread([&, t]() {
+                uint64_t state = t + 1;
+                uint64_t lookups = 0;
+                KeystoneUserInfo info;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    for (int i = 0; i < 256; i++) {
+                        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+                        const Token& token = tokens[(state >> 33) % tokens.size()];
+                        if (!cache.find(token.key, info)) {
+                            std::abort();
+                        }
+                    }
+                    lookups += 256;
+                }
+                total.fetch_add(lookups);
+            }));
+        }
+        std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+        stop.store(true);
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+        return total.load() / seconds;
+    }
+
+    template<class Cache>
+    void fill(Cache& cache, const std::vector<Token>& tokens) {
+        std::vector<std::string> roles;
+        roles.push_back("member");
+        roles.push_back("operator");
+        for (size_t i = 0; i < tokens.size(); i++) {
+            cache.insert(tokens[i].key, KeystoneUserInfo("user", tokens[i].token, roles));
+        }
+    }
+
+    int benchCache(unsigned maxThreads, size_t tokenCount, double seconds, size_t l1Entries) {
+        std::vector<Token> tokens = makeTokens(tokenCount);
+        // Each shard holds capacity / shards entries, leave room for the uneven spread.
+        TokenCache sharded(2 * tokenCount, 3600);
+        TokenCache withL1(2 * tokenCount, 3600);
+        withL1.setLocalCache(l1Entries, 1.0);
+        LockedCache locked;
+        fill(sharded, tokens);
+        fill(withL1, tokens);
+        fill(locked, tokens);
+
+        std::printf("%8s %16s %16s %16s\n", "threads", "sharded [M/s]", "+L1 [M/s]", "one mutex [M/s]");
+        for (unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+            double shardedRate = run(sharded, tokens, threads, seconds);
+            double l1Rate = run(withL1, tokens, threads, seconds);
+            double lockedRate = run(locked, tokens, threads, seconds);
+            std::printf("%8u %16.2f %16.2f %16.2f\n", threads, shardedRate * 1e-6, l1Rate * 1e-6, lockedRate * 1e-6);
+        }
+        return 0;
+    }
+
+    struct TransportRun {
+        double postsPerSecond;
+        long connections;
+        uint64_t failures;
+    };
+
+    TransportRun runTransport(CurlTransport& transport, const std::string& url, unsigned threads, double seconds) {
+        const std::string request =
+            "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+            "<soap:Envelope xmlns:soap=\"http://schemas.xmlsoap.org/soap/envelope/\"><soap:Body/></soap:Envelope>";
+        std::atomic<bool> stop(false);
+        std::atomic<uint64_t> posts(0);
+        std::atomic<uint64_t> failures(0);
+        std::atomic<long> connections(0);
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; t++) {
+            workers.push_back(std::thread([&]() {
+                std::string response;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    TransferInfo info;
+                    if (transport.post(url, request, response, &info).isOk()) {
+                        posts.fetch_add(1);
+                    } else {
+                        failures.fetch_add(1);
+                    }
+                    connections.fetch_add(info.newConnections);
+                }
+            }));
+        }
+        std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+        stop.store(true);
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+        TransportRun run;
+        run.postsPerSecond = posts.load() / seconds;
+        run.connections = connections.load();
+        run.failures = failures.load();
+        return run;
+    }
+
+    int benchTransport(const std::string& url, unsigned maxThreads, double seconds, unsigned maxStreams,
+                       const std::string& caCertFileName) {
+        // A prior knowledge connection to a server without HTTP/2 fails, negotiate over TLS.
+        const Http2Mode http2 = url.compare(0, 8, "https://") == 0 ? HTTP2_NEGOTIATE : HTTP2_PRIOR_KNOWLEDGE;
+        std::printf("%8s %14s %12s %14s %12s\n", "threads", "HTTP/1 [1/s]", "connections", "HTTP/2 [1/s]", "connections");
+        for (unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+            // Fresh transports, so each run counts its own connections.
+            CurlTransport http1;
+            CurlTransport multiplexed;
+            if (!caCertFileName.empty()) {
+                http1.setCaCertFileName(caCertFileName);
+                multiplexed.setCaCertFileName(caCertFileName);
+            }
+            Status status = multiplexed.setHttp2(http2, maxStreams);
+            if (!status.isOk()) {
+                std::cerr << status.message << std::endl;
+                return 1;
+            }
+            TransportRun one = runTransport(http1, url, threads, seconds);
+            TransportRun two = runTransport(multiplexed, url, threads, seconds);
+            std::printf("%8u %14.0f %12ld %14.0f %12ld\n", threads, one.postsPerSecond, one.connections,
+                        two.postsPerSecond, two.connections);
+            if (one.failures > 0 || two.failures > 0) {
+                std::printf("%8s %14llu %12s %14llu\n", "failed", static_cast<unsigned long long>(one.failures), "",
+                            static_cast<unsigned long long>(two.failures));
+            }
+        }
+        return 0;
+    }
+}
+
+int main(int argc, char** argv) {
+
+    const std::string mode(argc > 1 ? argv[1] : "");
+    if((mode != "cache" && mode != "transport") || (mode == "transport" && argc < 3)) {
+        std::cout << "Usage: " <<std::endl;
+        std::cout << "\tkeystone_bench cache [<max threads> [<tokens> [<seconds per run> [<L1 entries>]]]]" << std::endl;
+        std::cout << "\t\tToken cache hits per second for 1, 2, 4, ... threads. The L1 only pays off" << std::endl;
+        std::cout << "\t\twhen the tokens fit in it (default 256 entries per thread)." << std::endl;
+        std::cout << "\tkeystone_bench transport <URL> [<max threads> [<seconds per run> [<max streams> [<CA file>]]]]"
+                  << std::endl;
+        std::cout << "\t\tPosts per second and connections opened for 1, 2, 4, ... threads, with a transfer" << std::endl;
+        std::cout << "\t\tper call and multiplexed over HTTP/2 (ALPN for https, prior knowledge otherwise)." << std::endl;
+        std::cout << "\t\tThe server must answer a POST with 200 (eg. nghttpd --echo-upload)." << std::endl;
+        return 1;
+    }
+
+    if (mode == "transport") {
+        unsigned maxThreads = argc > 3 ? std::atoi(argv[3]) : 16;
+        double seconds = argc > 4 ? std::atof(argv[4]) : 2.0;
+        unsigned maxStreams = argc > 5 ? std::atoi(argv[5]) : 0;
+        std::string caCertFileName = argc > 6 ? argv[6] : "";
+        if (maxThreads == 0 || !(seconds > 0)) {
+            std::cerr << "Invalid arguments" << std::endl;
+            return 1;
+        }
+        return benchTransport(argv[2], maxThreads, seconds, maxStreams, caCertFileName);
+    }
+
+    unsigned maxThreads = argc > 2 ? std::atoi(argv[2]) : std::thread::hardware_concurrency();
+    size_t tokens = argc > 3 ? std::atol(argv[3]) : 100000;
+    double seconds = argc > 4 ? std::atof(argv[4]) : 1.0;
+    size_t l1Entries = argc > 5 ? std::atol(argv[5]) : 256;
+    if (maxThreads == 0 || tokens == 0 || !(seconds > 0) || l1Entries == 0) {
+        std::cerr << "Invalid arguments" << std::endl;
+        return 1;
+    }
+    return benchCache(maxThreads, tokens, seconds, l1Entries);
+}
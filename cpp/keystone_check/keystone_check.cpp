@@ -1,22 +1,108 @@
 #include "keystone/Keystone.hpp"
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
-int main(int argc, char** argv) {
-
-    if(argc != 4) {
+namespace {
+    void usage() {
         std::cout << "Usage: " <<std::endl;
         std::cout << "\tkeystone_check <URL> <tenantname> <sessiontoken>" << std::endl;
+        std::cout << "\tkeystone_check --prewarm FILE [--concurrency N] [--rate PER_SECOND] [--ttl SECONDS]"
+                  << " [--save CACHEFILE] <URL> <tenantname>" << std::endl;
+        std::cout << std::endl;
+        std::cout << "--prewarm looks up the tokens of FILE (one per line), and --save writes the ones" << std::endl;
+        std::cout << "that are valid to a cache file for keystone_cache_load, to expire after --ttl" << std::endl;
+        std::cout << "seconds (300 by default)." << std::endl;
+    }
+
+    bool readTokens(const std::string& fileName, std::vector<std::string>& tokens) {
+        std::ifstream file(fileName.c_str());
+        if (!file) {
+            return false;
+        }
+        std::string line;
+        while (std::getline(file, line)) {
+            size_t end = line.find_last_not_of(" \t\r");
+            if (end != std::string::npos) {
+                tokens.push_back(line.substr(0, end + 1));
+            }
+        }
+        return !file.bad();
+    }
+
+    int prewarm(const std::string& url, const std::string& tenantName, const std::string& fileName,
+                unsigned concurrency, double rate, double ttl, const std::string& cacheFileName) {
+        std::vector<std::string> tokens;
+        if (!readTokens(fileName, tokens)) {
+            std::cerr << "Could not read " << fileName << std::endl;
+            return 1;
+        }
+
+        keystone::Keystone keystone(url);
+        try {
+            keystone.setTokenCache(tokens.size() > 0 ? 2 * tokens.size() : 1, ttl);
+            size_t cached = keystone.prewarmCache(tenantName, tokens, concurrency, rate);
+            std::cout << cached << " of " << tokens.size() << " tokens are valid" << std::endl;
+            if (!cacheFileName.empty()) {
+                keystone.saveCache(cacheFileName);
+            }
+            return 0;
+        } catch(std::runtime_error& e) {
+            std::cerr << "Could not prewarm the cache" << std::endl;
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+
+    std::string prewarmFileName;
+    std::string cacheFileName;
+    unsigned concurrency = 4;
+    double rate = 0;
+    double ttl = 300;
+    std::vector<std::string> arguments;
+    for (int i = 1; i < argc; i++) {
+        const std::string argument(argv[i]);
+        if (i + 1 < argc && argument == "--prewarm") {
+            prewarmFileName = argv[++i];
+        } else if (i + 1 < argc && argument == "--concurrency") {
+            concurrency = static_cast<unsigned>(std::atoi(argv[++i]));
+        } else if (i + 1 < argc && argument == "--rate") {
+            rate = std::atof(argv[++i]);
+        } else if (i + 1 < argc && argument == "--ttl") {
+            ttl = std::atof(argv[++i]);
+        } else if (i + 1 < argc && argument == "--save") {
+            cacheFileName = argv[++i];
+        } else {
+            arguments.push_back(argument);
+        }
+    }
+
+    if (!prewarmFileName.empty()) {
+        if (arguments.size() != 2 || !(ttl > 0)) {
+            usage();
+            return 1;
+        }
+        return prewarm(arguments[0], arguments[1], prewarmFileName, concurrency, rate, ttl, cacheFileName);
+    }
+
+    if(arguments.size() != 3) {
+        usage();
         return 1;
     }
-    
-    const std::string url(argv[1]);
-    const std::string tenantName(argv[2]);
-    const std::string sessionToken(argv[3]);
-    
+
+    const std::string url(arguments[0]);
+    const std::string tenantName(arguments[1]);
+    const std::string sessionToken(arguments[2]);
+
 
     keystone::Keystone keystone(url);
-    
+
     try {
         keystone::KeystoneUserInfo info;
         keystone.getUserInfoFromToken(tenantName, sessionToken, info);
@@ -28,4 +114,4 @@ int main(int argc, char** argv) {
         return 1;
     }
     return 1;
-}
\ No newline at end of file
+}